@@ -0,0 +1,106 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/** 領域の一単位の標準の大きさ */
+#define ARENA_CHUNK_SIZE 4096
+
+/** 確保する領域のアラインメント */
+#define ARENA_ALIGN sizeof(max_align_t)
+
+/**
+ * 領域を一単位確保してアリーナにつなぐ。
+ * \arena アリーナ
+ * \size 少なくとも確保すべき大きさ
+ */
+static ArenaChunk *arena_grow(Arena *arena, size_t size);
+
+Arena *arena_new(void)
+{
+	Arena *arena;
+	arena = (Arena *) malloc(sizeof(Arena));
+	if (NULL == arena) {
+		return NULL;
+	}
+	arena->chunks = NULL;
+	return arena;
+}
+
+void arena_free(Arena *arena)
+{
+	ArenaChunk *chunk;
+	while (NULL != (chunk = arena->chunks)) {
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+void arena_reset(Arena *arena)
+{
+	ArenaChunk *chunk;
+	ArenaChunk *kept = NULL;
+	/*
+	 * 標準の大きさの一単位だけを残す。大きな割り当てのために確保した
+	 * 巨大な領域は、使い回すと抱え続けることになるので解放する
+	 */
+	while (NULL != (chunk = arena->chunks)) {
+		arena->chunks = chunk->next;
+		if (NULL == kept && ARENA_CHUNK_SIZE == chunk->memlen) {
+			kept = chunk;
+		} else {
+			free(chunk);
+		}
+	}
+	if (NULL != kept) {
+		kept->len = 0;
+		kept->next = NULL;
+	}
+	arena->chunks = kept;
+}
+
+void arena_nofree(void *p)
+{
+	/* アリーナから確保したものは、アリーナとともに解放される */
+	(void) p;
+}
+
+static ArenaChunk *arena_grow(Arena *arena, size_t size)
+{
+	ArenaChunk *chunk;
+	size_t memlen;
+	memlen = ARENA_CHUNK_SIZE;
+	if (memlen < size) {
+		memlen = size;
+	}
+	chunk = (ArenaChunk *) malloc(sizeof(ArenaChunk) + memlen);
+	if (NULL == chunk) {
+		return NULL;
+	}
+	chunk->len = 0;
+	chunk->memlen = memlen;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	return chunk;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	ArenaChunk *chunk;
+	void *p;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	chunk = arena->chunks;
+	if (NULL == chunk || chunk->memlen < chunk->len + size) {
+		chunk = arena_grow(arena, size);
+		if (NULL == chunk) {
+			return NULL;
+		}
+	}
+	p = (char *) chunk->data + chunk->len;
+	chunk->len += size;
+	return p;
+}
@@ -0,0 +1,611 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/*
+ * 配列の語は要素をまとめて計算する。要素は + などと同じく 32 ビットの
+ * 整数で、桁あふれは回り込む。要素の先頭は AVX2 のレジスターの大きさ
+ * にそろえてあるので、x86-64 では SIMD 命令でそのまま読み書きできる。
+ * SSE4.1 (32 ビットの掛け算と最大値) を、実行時に使えると分かれば AVX2
+ * を用いる。割り算には SIMD 命令がないので、一要素ずつ計算する。
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ARRAY_SIMD
+#include <immintrin.h>
+#endif
+
+/** 二つの配列から三つ目の配列を計算する関数 */
+typedef void ArrayBinaryFunc(int *c, int const *a, int const *b, size_t len);
+
+/** 配列を一つの整数に畳み込む関数 */
+typedef int ArrayReduceFunc(int const *a, size_t len);
+
+/** 二つの配列の内積を求める関数 */
+typedef int ArrayDotFunc(int const *a, int const *b, size_t len);
+
+/** 一つの実装の関数の組 */
+typedef struct _ArrayKernels ArrayKernels;
+struct _ArrayKernels {
+	ArrayBinaryFunc *add;       /* 和 */
+	ArrayBinaryFunc *subtract;  /* 差 */
+	ArrayBinaryFunc *multiply;  /* 積 */
+	ArrayReduceFunc *sum;       /* 総和 */
+	ArrayReduceFunc *max;       /* 最大値 (要素は一つ以上) */
+	ArrayDotFunc *dot;          /* 内積 */
+};
+
+/** 回り込む足し算 */
+static inline int wrap_add(int a, int b)
+{
+	return (int) ((unsigned int) a + (unsigned int) b);
+}
+
+/** 回り込む引き算 */
+static inline int wrap_subtract(int a, int b)
+{
+	return (int) ((unsigned int) a - (unsigned int) b);
+}
+
+/** 回り込む掛け算 */
+static inline int wrap_multiply(int a, int b)
+{
+	return (int) ((unsigned int) a * (unsigned int) b);
+}
+
+static void add_scalar(int *c, int const *a, int const *b, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		c[i] = wrap_add(a[i], b[i]);
+	}
+}
+
+static void subtract_scalar(int *c, int const *a, int const *b, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		c[i] = wrap_subtract(a[i], b[i]);
+	}
+}
+
+static void multiply_scalar(int *c, int const *a, int const *b, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		c[i] = wrap_multiply(a[i], b[i]);
+	}
+}
+
+static int sum_scalar(int const *a, size_t len)
+{
+	size_t i;
+	int sum = 0;
+	for (i = 0; i < len; ++i) {
+		sum = wrap_add(sum, a[i]);
+	}
+	return sum;
+}
+
+static int max_scalar(int const *a, size_t len)
+{
+	size_t i;
+	int max = a[0];
+	for (i = 1; i < len; ++i) {
+		if (max < a[i]) {
+			max = a[i];
+		}
+	}
+	return max;
+}
+
+static int dot_scalar(int const *a, int const *b, size_t len)
+{
+	size_t i;
+	int sum = 0;
+	for (i = 0; i < len; ++i) {
+		sum = wrap_add(sum, wrap_multiply(a[i], b[i]));
+	}
+	return sum;
+}
+
+/** 一要素ずつ計算する実装 */
+static ArrayKernels const kernels_scalar = {
+	add_scalar, subtract_scalar, multiply_scalar,
+	sum_scalar, max_scalar, dot_scalar,
+};
+
+#ifdef ARRAY_SIMD
+/*
+ * SIMD 版はベクトルの幅の分だけまとめて計算し、半端な末尾を一要素ず
+ * つ計算する。要素の先頭はそろっているので、整列したロードを使う。
+ */
+
+/**
+ * 二つの配列の要素ごとの演算を SSE4.1 の命令で行う関数を定義する。
+ * \name 関数名
+ * \intrinsic 4 要素を計算する命令
+ * \scalar 一要素を計算する関数
+ */
+#define ARRAY_BINARY_SSE41(name, intrinsic, scalar) \
+	__attribute__((target("sse4.1"))) \
+	static void name(int *c, int const *a, int const *b, size_t len) \
+	{ \
+		size_t i; \
+		for (i = 0; i + 4 <= len; i += 4) { \
+			_mm_store_si128((__m128i *) &c[i], \
+							intrinsic(_mm_load_si128((__m128i const *) &a[i]), \
+									  _mm_load_si128((__m128i const *) &b[i]))); \
+		} \
+		for (; i < len; ++i) { \
+			c[i] = scalar(a[i], b[i]); \
+		} \
+	}
+
+/** ARRAY_BINARY_SSE41 の AVX2 版 */
+#define ARRAY_BINARY_AVX2(name, intrinsic, scalar) \
+	__attribute__((target("avx2"))) \
+	static void name(int *c, int const *a, int const *b, size_t len) \
+	{ \
+		size_t i; \
+		for (i = 0; i + 8 <= len; i += 8) { \
+			_mm256_store_si256( \
+				(__m256i *) &c[i], \
+				intrinsic(_mm256_load_si256((__m256i const *) &a[i]), \
+						  _mm256_load_si256((__m256i const *) &b[i]))); \
+		} \
+		for (; i < len; ++i) { \
+			c[i] = scalar(a[i], b[i]); \
+		} \
+	}
+
+ARRAY_BINARY_SSE41(add_sse41, _mm_add_epi32, wrap_add)
+ARRAY_BINARY_SSE41(subtract_sse41, _mm_sub_epi32, wrap_subtract)
+ARRAY_BINARY_SSE41(multiply_sse41, _mm_mullo_epi32, wrap_multiply)
+ARRAY_BINARY_AVX2(add_avx2, _mm256_add_epi32, wrap_add)
+ARRAY_BINARY_AVX2(subtract_avx2, _mm256_sub_epi32, wrap_subtract)
+ARRAY_BINARY_AVX2(multiply_avx2, _mm256_mullo_epi32, wrap_multiply)
+
+/** 4 要素の和を求める */
+__attribute__((target("sse4.1")))
+static inline int horizontal_add_sse41(__m128i x)
+{
+	x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+	x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(x);
+}
+
+/** 4 要素の最大値を求める */
+__attribute__((target("sse4.1")))
+static inline int horizontal_max_sse41(__m128i x)
+{
+	x = _mm_max_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+	x = _mm_max_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(x);
+}
+
+__attribute__((target("sse4.1")))
+static int sum_sse41(int const *a, size_t len)
+{
+	__m128i acc;
+	size_t i;
+	int sum;
+	acc = _mm_setzero_si128();
+	for (i = 0; i + 4 <= len; i += 4) {
+		acc = _mm_add_epi32(acc, _mm_load_si128((__m128i const *) &a[i]));
+	}
+	sum = horizontal_add_sse41(acc);
+	for (; i < len; ++i) {
+		sum = wrap_add(sum, a[i]);
+	}
+	return sum;
+}
+
+__attribute__((target("sse4.1")))
+static int max_sse41(int const *a, size_t len)
+{
+	__m128i acc;
+	size_t i;
+	int max;
+	if (len < 4) {
+		return max_scalar(a, len);
+	}
+	acc = _mm_load_si128((__m128i const *) a);
+	for (i = 4; i + 4 <= len; i += 4) {
+		acc = _mm_max_epi32(acc, _mm_load_si128((__m128i const *) &a[i]));
+	}
+	max = horizontal_max_sse41(acc);
+	for (; i < len; ++i) {
+		if (max < a[i]) {
+			max = a[i];
+		}
+	}
+	return max;
+}
+
+__attribute__((target("sse4.1")))
+static int dot_sse41(int const *a, int const *b, size_t len)
+{
+	__m128i acc;
+	size_t i;
+	int sum;
+	acc = _mm_setzero_si128();
+	for (i = 0; i + 4 <= len; i += 4) {
+		acc = _mm_add_epi32(acc, _mm_mullo_epi32(
+								_mm_load_si128((__m128i const *) &a[i]),
+								_mm_load_si128((__m128i const *) &b[i])));
+	}
+	sum = horizontal_add_sse41(acc);
+	for (; i < len; ++i) {
+		sum = wrap_add(sum, wrap_multiply(a[i], b[i]));
+	}
+	return sum;
+}
+
+/** 8 要素を 4 要素に畳む */
+#define FOLD_AVX2(op, x) \
+	op(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1))
+
+__attribute__((target("avx2")))
+static int sum_avx2(int const *a, size_t len)
+{
+	__m256i acc;
+	size_t i;
+	int sum;
+	acc = _mm256_setzero_si256();
+	for (i = 0; i + 8 <= len; i += 8) {
+		acc = _mm256_add_epi32(acc,
+							   _mm256_load_si256((__m256i const *) &a[i]));
+	}
+	sum = horizontal_add_sse41(FOLD_AVX2(_mm_add_epi32, acc));
+	for (; i < len; ++i) {
+		sum = wrap_add(sum, a[i]);
+	}
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static int max_avx2(int const *a, size_t len)
+{
+	__m256i acc;
+	size_t i;
+	int max;
+	if (len < 8) {
+		return max_scalar(a, len);
+	}
+	acc = _mm256_load_si256((__m256i const *) a);
+	for (i = 8; i + 8 <= len; i += 8) {
+		acc = _mm256_max_epi32(acc,
+							   _mm256_load_si256((__m256i const *) &a[i]));
+	}
+	max = horizontal_max_sse41(FOLD_AVX2(_mm_max_epi32, acc));
+	for (; i < len; ++i) {
+		if (max < a[i]) {
+			max = a[i];
+		}
+	}
+	return max;
+}
+
+__attribute__((target("avx2")))
+static int dot_avx2(int const *a, int const *b, size_t len)
+{
+	__m256i acc;
+	size_t i;
+	int sum;
+	acc = _mm256_setzero_si256();
+	for (i = 0; i + 8 <= len; i += 8) {
+		acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(
+								   _mm256_load_si256((__m256i const *) &a[i]),
+								   _mm256_load_si256((__m256i const *) &b[i])));
+	}
+	sum = horizontal_add_sse41(FOLD_AVX2(_mm_add_epi32, acc));
+	for (; i < len; ++i) {
+		sum = wrap_add(sum, wrap_multiply(a[i], b[i]));
+	}
+	return sum;
+}
+
+/** SSE4.1 で 4 要素ずつ計算する実装 */
+static ArrayKernels const kernels_sse41 = {
+	add_sse41, subtract_sse41, multiply_sse41,
+	sum_sse41, max_sse41, dot_sse41,
+};
+
+/** AVX2 で 8 要素ずつ計算する実装 */
+static ArrayKernels const kernels_avx2 = {
+	add_avx2, subtract_avx2, multiply_avx2,
+	sum_avx2, max_avx2, dot_avx2,
+};
+#endif
+
+/** 選択されている実装 */
+static ArrayKernels const *kernels = &kernels_scalar;
+
+/** 実装を一度だけ自動的に選ぶための制御変数 */
+static pthread_once_t array_once = PTHREAD_ONCE_INIT;
+
+/** 実装を自動的に選んだか、明示的に選んでいれば TRUE */
+static bool array_selected;
+
+/**
+ * 実装がまだ選ばれていなければ CPU に応じて選ぶ。pthread_once で一度
+ * だけ呼び出す。
+ */
+static void array_select_auto(void);
+
+/**
+ * スタックの上から n 個が同じ長さの配列であることを確かめる。下ろさ
+ * ない。arrays[0] が一番深い位置のものになる。
+ * \stack スタック
+ * \arrays 配列の書き込み先
+ * \n 配列の数
+ */
+static Error *array_peek(Stack *stack, Array **arrays, size_t n);
+
+/**
+ * 要素を読み書きする語の添字と配列を確かめる。下ろさない。
+ * \stack スタック
+ * \depth 配列の下にあるセルの数 (添字を含む)
+ * \array 配列の書き込み先
+ * \index 添字の書き込み先
+ */
+static Error *array_peek_index(Stack *stack, size_t depth,
+							   Array **array, size_t *index);
+
+/**
+ * 二つの配列から三つ目の配列を計算する語を実行する。
+ * \stack スタック
+ * \func 計算する関数
+ */
+static Error *array_binary(Stack *stack, ArrayBinaryFunc *func);
+
+/** 割り算 (回り込む) を一要素ずつ計算する */
+static void divide_scalar(int *c, int const *a, int const *b, size_t len);
+
+bool array_select(ArrayImpl impl)
+{
+	if (ARRAY_AUTO == impl) {
+#ifdef ARRAY_SIMD
+		__builtin_cpu_init();
+		impl = __builtin_cpu_supports("avx2") ? ARRAY_AVX2
+			: __builtin_cpu_supports("sse4.1") ? ARRAY_SSE41 : ARRAY_SCALAR;
+#else
+		impl = ARRAY_SCALAR;
+#endif
+	}
+	switch (impl) {
+	case ARRAY_SCALAR:
+		kernels = &kernels_scalar;
+		break;
+#ifdef ARRAY_SIMD
+	case ARRAY_SSE41:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("sse4.1")) {
+			return FALSE;
+		}
+		kernels = &kernels_sse41;
+		break;
+	case ARRAY_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2")) {
+			return FALSE;
+		}
+		kernels = &kernels_avx2;
+		break;
+#endif
+	default:
+		return FALSE;
+	}
+	array_selected = TRUE;
+	return TRUE;
+}
+
+static void array_select_auto(void)
+{
+	if (!array_selected) {
+		array_select(ARRAY_AUTO);
+	}
+}
+
+Array *array_new(Arena *arena, Symbol const *name, size_t len)
+{
+	Array *array;
+	char *p;
+	pthread_once(&array_once, array_select_auto);
+	if ((SIZE_MAX - sizeof(Array) - ARRAY_ALIGN) / sizeof(int) < len) {
+		return NULL;
+	}
+	array = (Array *) arena_alloc(arena, sizeof(Array) + ARRAY_ALIGN
+								  + sizeof(int) * len);
+	if (NULL == array) {
+		return NULL;
+	}
+	p = (char *) (array + 1);
+	array->name = name;
+	array->len = len;
+	array->values = (int *) (p + (ARRAY_ALIGN - (uintptr_t) p % ARRAY_ALIGN)
+							 % ARRAY_ALIGN);
+	memset(array->values, 0, sizeof(int) * len);
+	return array;
+}
+
+static Error *array_peek(Stack *stack, Array **arrays, size_t n)
+{
+	size_t i;
+	if (stack->len < n) {
+		return error_new(EmptyStackError, NULL);
+	}
+	for (i = 0; i < n; ++i) {
+		Cell cell;
+		cell = stack->values[stack->len - n + i];
+		if (!cell_is_array(cell)) {
+			return error_new(IllegalTypeError, NULL);
+		}
+		arrays[i] = cell_array(cell);
+		if (arrays[0]->len != arrays[i]->len) {
+			return error_new(IllegalAddressError, NULL);
+		}
+	}
+	return NULL;
+}
+
+static Error *array_peek_index(Stack *stack, size_t depth,
+							   Array **array, size_t *index)
+{
+	Cell cell, i;
+	if (stack->len < depth + 1) {
+		return error_new(EmptyStackError, NULL);
+	}
+	cell = stack->values[stack->len - 1];
+	i = stack->values[stack->len - 2];
+	if (!cell_is_array(cell) || !cell_is_integer(i)) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	*array = cell_array(cell);
+	if (cell_integer(i) < 0 || (*array)->len <= (size_t) cell_integer(i)) {
+		return error_new(IllegalAddressError, NULL);
+	}
+	*index = cell_integer(i);
+	return NULL;
+}
+
+Error *forsh_array_fetch(Stack *stack)
+{
+	Array *array;
+	Error *error;
+	size_t index;
+	if (NULL != (error = array_peek_index(stack, 1, &array, &index))) {
+		return error;
+	}
+	stack->len -= 2;
+	stack_push(stack, cell_from_integer(array->values[index]));
+	return NULL;
+}
+
+Error *forsh_array_store(Stack *stack)
+{
+	Array *array;
+	Error *error;
+	size_t index;
+	Cell x;
+	if (NULL != (error = array_peek_index(stack, 2, &array, &index))) {
+		return error;
+	}
+	x = stack->values[stack->len - 3];
+	if (!cell_is_integer(x)) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	array->values[index] = cell_integer(x);
+	stack->len -= 3;
+	return NULL;
+}
+
+Error *forsh_array_length(Stack *stack)
+{
+	Array *array;
+	Error *error;
+	if (NULL != (error = array_peek(stack, &array, 1))) {
+		return error;
+	}
+	stack->values[stack->len - 1] = cell_from_integer((int) array->len);
+	return NULL;
+}
+
+static Error *array_binary(Stack *stack, ArrayBinaryFunc *func)
+{
+	Array *arrays[3];
+	Error *error;
+	if (NULL != (error = array_peek(stack, arrays, 3))) {
+		return error;
+	}
+	func(arrays[2]->values, arrays[0]->values, arrays[1]->values,
+		 arrays[0]->len);
+	stack->len -= 3;
+	return NULL;
+}
+
+Error *forsh_array_plus(Stack *stack)
+{
+	return array_binary(stack, kernels->add);
+}
+
+Error *forsh_array_minus(Stack *stack)
+{
+	return array_binary(stack, kernels->subtract);
+}
+
+Error *forsh_array_star(Stack *stack)
+{
+	return array_binary(stack, kernels->multiply);
+}
+
+static void divide_scalar(int *c, int const *a, int const *b, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		c[i] = integer_divide(a[i], b[i]);
+	}
+}
+
+Error *forsh_array_slash(Stack *stack)
+{
+	Array *arrays[3];
+	Error *error;
+	size_t i;
+	if (NULL != (error = array_peek(stack, arrays, 3))) {
+		return error;
+	}
+	for (i = 0; i < arrays[1]->len; ++i) {
+		if (0 == arrays[1]->values[i]) {
+			return error_new(DividedByZeroError, NULL);
+		}
+	}
+	divide_scalar(arrays[2]->values, arrays[0]->values, arrays[1]->values,
+				  arrays[0]->len);
+	stack->len -= 3;
+	return NULL;
+}
+
+Error *forsh_array_sum(Stack *stack)
+{
+	Array *array;
+	Error *error;
+	if (NULL != (error = array_peek(stack, &array, 1))) {
+		return error;
+	}
+	stack->values[stack->len - 1]
+		= cell_from_integer(kernels->sum(array->values, array->len));
+	return NULL;
+}
+
+Error *forsh_array_max(Stack *stack)
+{
+	Array *array;
+	Error *error;
+	if (NULL != (error = array_peek(stack, &array, 1))) {
+		return error;
+	}
+	if (0 == array->len) {
+		return error_new(IllegalAddressError, NULL);
+	}
+	stack->values[stack->len - 1]
+		= cell_from_integer(kernels->max(array->values, array->len));
+	return NULL;
+}
+
+Error *forsh_array_dot(Stack *stack)
+{
+	Array *arrays[2];
+	Error *error;
+	if (NULL != (error = array_peek(stack, arrays, 2))) {
+		return error;
+	}
+	stack->len -= 1;
+	stack->values[stack->len - 1] = cell_from_integer(
+		kernels->dot(arrays[0]->values, arrays[1]->values, arrays[0]->len));
+	return NULL;
+}
@@ -43,43 +43,39 @@ static int multiply(int a, int b)
 
 static int divide(int a, int b)
 {
-	return a / b;
+	return integer_divide(a, b);
 }
 
 static Error *two_integer_func(Stack *stack,
 							   int (*func)(int, int),
 							   bool nozero)
 {
-	Value *a, *b;
+	Cell a, b;
 	int i;
 	Error *error;
-	a = stack_pop(stack);
-	if (NULL == a) {
+	if (!stack_pop(stack, &a)) {
 		error = error_new(EmptyStackError, NULL);
 		goto err_empty_a;
 	}
-	if (a->type != TYPE_INTEGER) {
+	if (!cell_is_integer(a)) {
 		error = error_new(IllegalTypeError, NULL);
 		goto err_invalid_a;
 	}
-	if (nozero && 0 == value_integer_value(a)) {
+	if (nozero && 0 == cell_integer(a)) {
 		error = error_new(DividedByZeroError, NULL);
 		goto err_invalid_a;
 	}
-	b = stack_pop(stack);
-	if (NULL == b) {
+	if (!stack_pop(stack, &b)) {
 		error = error_new(EmptyStackError, NULL);
 		goto err_empty_b;
 	}
-	if (b->type != TYPE_INTEGER) {
+	if (!cell_is_integer(b)) {
 		error = error_new(IllegalTypeError, NULL);
 		goto err_invalid_b;
 	}
 	/* スタックから下ろしたのと逆にして計算する必要がある */
-	i = func(value_integer_value(b), value_integer_value(a));
-	value_free(a);
-	value_free(b);
-	stack_push(stack, value_new_integer(i));
+	i = func(cell_integer(b), cell_integer(a));
+	stack_push(stack, cell_from_integer(i));
 	return NULL;
 err_invalid_b:
 	stack_push(stack, b);
@@ -110,3 +106,83 @@ Error *forsh_slash(Stack *stack)
 	return two_integer_func(stack, divide, TRUE);
 }
 
+Error *forsh_dup(Stack *stack)
+{
+	Cell a;
+	if (!stack_pop(stack, &a)) {
+		return error_new(EmptyStackError, NULL);
+	}
+	stack_push(stack, a);
+	stack_push(stack, a);
+	return NULL;
+}
+
+Error *forsh_drop(Stack *stack)
+{
+	Cell a;
+	if (!stack_pop(stack, &a)) {
+		return error_new(EmptyStackError, NULL);
+	}
+	return NULL;
+}
+
+Error *forsh_swap(Stack *stack)
+{
+	Cell a, b;
+	if (!stack_pop(stack, &a)) {
+		return error_new(EmptyStackError, NULL);
+	}
+	if (!stack_pop(stack, &b)) {
+		stack_push(stack, a);
+		return error_new(EmptyStackError, NULL);
+	}
+	stack_push(stack, a);
+	stack_push(stack, b);
+	return NULL;
+}
+
+Error *forsh_over(Stack *stack)
+{
+	Cell a, b;
+	if (!stack_pop(stack, &a)) {
+		return error_new(EmptyStackError, NULL);
+	}
+	if (!stack_pop(stack, &b)) {
+		stack_push(stack, a);
+		return error_new(EmptyStackError, NULL);
+	}
+	stack_push(stack, b);
+	stack_push(stack, a);
+	stack_push(stack, b);
+	return NULL;
+}
+
+Error *forsh_throw(Stack *stack)
+{
+	Cell a;
+	if (!stack_pop(stack, &a)) {
+		return error_new(EmptyStackError, NULL);
+	}
+	if (!cell_is_integer(a)) {
+		stack_push(stack, a);
+		return error_new(IllegalTypeError, NULL);
+	}
+	if (0 == cell_integer(a)) {  // 0 THROW は何もしない
+		return NULL;
+	}
+	return error_new_code(cell_integer(a));
+}
+
+Error *forsh_cells(Stack *stack)
+{
+	Cell a;
+	if (!stack_pop(stack, &a)) {
+		return error_new(EmptyStackError, NULL);
+	}
+	if (!cell_is_integer(a)) {
+		stack_push(stack, a);
+		return error_new(IllegalTypeError, NULL);
+	}
+	stack_push(stack, cell_from_integer(cell_integer(a) * (int) sizeof(Cell)));
+	return NULL;
+}
@@ -7,58 +7,419 @@
 #include "forsh.h"
 
 /**
- * 文字列が整数として判別できる場合は TRUE を返す。
- * \str 文字列
+ * シンボル・テーブルにビルトイン関数を束縛する。
+ * \map シンボル・テーブル
+ * \arena 値を確保するアリーナ
  */
-static bool str_is_integer(char const *str);
+static void context_builtin(Map *map, Arena *arena);
 
 /**
- * 頭に空白を加えて値を表示する。
- * \value 表示する値
+ * すべての文脈が共有する状態 (語のシンボルとビルトインのシンボル・テー
+ * ブル) を初期化する。pthread_once で一度だけ呼び出す。
  */
-static void print_value(Value *value);
+static void context_init(void);
 
 /**
- * 文脈のシンボル・テーブルにビルトイン関数を束縛する。
+ * 共有するシンボル・テーブルの値を、文脈のシンボル・テーブルに複製す
+ * る。map_each に渡す。
+ * \key 語の名前
+ * \value 共有する値
+ * \data 文脈
+ */
+static void context_copy_builtin(Symbol const *key, void *value, void *data);
+
+/**
+ * VARIABLE や : などの語に続く名前を解釈する。
+ * \context 文脈
+ * \str 名前
+ * \len 名前の長さ
+ */
+static Error *context_parse_name(Context *context,
+								 char const *str, size_t len);
+
+/**
+ * コロン定義のコンパイル中にトークンを解釈する。
+ * \context 文脈
+ * \str 解釈するトークン文字列
+ * \len トークン文字列の長さ
+ */
+static Error *context_compile(Context *context, char const *str, size_t len);
+
+/**
+ * 解釈できなかったトークンのエラーを返す。コンパイル中の定義があれば
+ * 破棄する。
+ * \context 文脈
+ * \str 解釈できなかったトークン文字列
+ * \len トークン文字列の長さ
+ */
+static Error *context_abandon(Context *context, char const *str, size_t len);
+
+/**
+ * 制御構造の語 (IF, ELSE, THEN, BEGIN, UNTIL, DO, LOOP, I, J,
+ * RECURSE) をコンパイル中の定義に加える。開いた構造は、分岐を埋める位
+ * 置と開いた語の組として制御フロー・スタックに積む。構造の対応が取れ
+ * ていなければ FALSE を返す。
+ * \context 文脈
+ * \symbol 制御構造の語
+ */
+static bool context_compile_control(Context *context, Symbol const *symbol);
+
+/**
+ * 制御構造を開き、制御フロー・スタックに積む。
+ * \context 文脈
+ * \symbol 開いた語
+ * \position 分岐を埋める位置、または分岐先の位置
+ */
+static bool context_open(Context *context, Symbol const *symbol,
+						 size_t position);
+
+/**
+ * 開いている DO ... LOOP の数を返す。
  * \context 文脈
  */
-static void context_builtin(Context *context);
+static size_t context_loops(Context const *context);
 
-static void context_builtin(Context *context)
+/**
+ * 語の呼び出しをコンパイル中の定義に加える。
+ * \definition コンパイル中の定義
+ * \value 呼び出す語
+ */
+static bool context_compile_value(Definition *definition, Value const *value);
+
+/**
+ * コンパイル中の定義を完了し、シンボル・テーブルに登録する。
+ * \context 文脈
+ */
+static Error *context_end_definition(Context *context);
+
+/**
+ * 基数を変える語 (HEX, DECIMAL, BASE) を実行する。数値の読み方を変え
+ * るので、HEX と DECIMAL はコロン定義の中でもその場で実行される。
+ * BASE はスタックから下ろした値 (2 以上 36 以下) を基数にする。コン
+ * パイル中のスタックには基数がないので、コロン定義の中では使えない。
+ * \context 文脈
+ * \symbol 基数を変える語
+ */
+static Error *context_set_base(Context *context, Symbol const *symbol);
+
+/**
+ * Context の新しいインスタンスを生成する。
+ * \guarded スタックをガード・ページで挟んだ固定長にするなら TRUE
+ * \memlen 固定長のスタックに格納できる要素の数
+ */
+static Context *context_create(bool guarded, size_t memlen);
+
+/**
+ * トークンを一つ解釈する。
+ * \context 文脈
+ * \str トークン
+ * \len トークンの長さ
+ */
+static Error *context_interpret_token(Context *context, const char *str,
+									  size_t len);
+
+/**
+ * コロン定義を最適化するまでの呼び出し回数を、スタックから下ろした値
+ * (0 以上) にする。0 にすると定義した時点で最適化する。
+ * \context 文脈
+ */
+static Error *context_set_tier_threshold(Context *context);
+
+/**
+ * PMAP と PREDUCE が使うスレッドの数を、スタックから下ろした値 (0 以
+ * 上) にする。0 にするとプールのすべてのスレッドを使う。
+ * \context 文脈
+ */
+static Error *context_set_threads(Context *context);
+
+/**
+ * 計測を操作する語 (PROFILE, PROFILE-OFF, PROFILE-RESET, .PROFILE)
+ * を実行する。
+ * \context 文脈
+ * \symbol 計測を操作する語
+ */
+static void context_profile(Context *context, Symbol const *symbol);
+
+/**
+ * 語を呼び出し、呼び出しの回数と実行に要したサイクル数を記録する。
+ * \context 文脈
+ * \value 呼び出す語 (関数、命令またはコロン定義)
+ */
+static Error *context_call_profiled(Context *context, Value *value);
+
+/**
+ * すべての文脈が共有する、ビルトインの語のシンボル・テーブル。一度だ
+ * け作り、以後は書き換えないので、どのスレッドからもロックせずに読め
+ * る。文脈ごとの定義は Context.map に置き、こちらより優先する。
+ */
+static Map *base_map;
+
+/** base_map の値を確保するアリーナ。プロセスの終了まで解放しない */
+static Arena *base_arena;
+
+/** context_init を一度だけ呼び出すための制御変数 */
+static pthread_once_t context_once = PTHREAD_ONCE_INIT;
+
+/** 変数定義を開始する語 */
+static Symbol const *symbol_variable;
+/** 定数定義を開始する語 */
+static Symbol const *symbol_constant;
+/** 配列定義を開始する語 */
+static Symbol const *symbol_array;
+/** コロン定義を開始する語 */
+static Symbol const *symbol_colon;
+/** コロン定義を終了する語 */
+static Symbol const *symbol_semicolon;
+/** 語を逆アセンブルして表示する語 */
+static Symbol const *symbol_see;
+/** 基数を 16 にする語 */
+static Symbol const *symbol_hex;
+/** 基数を 10 にする語 */
+static Symbol const *symbol_decimal;
+/** 基数を設定する語 */
+static Symbol const *symbol_base;
+/** コロン定義を最適化するまでの呼び出し回数を設定する語 */
+static Symbol const *symbol_tier_threshold;
+/** PMAP と PREDUCE が使うスレッドの数を設定する語 */
+static Symbol const *symbol_threads;
+/** 語の実行トークンを積む語 */
+static Symbol const *symbol_tick;
+
+/* 制御構造の語 */
+static Symbol const *symbol_if;
+static Symbol const *symbol_else;
+static Symbol const *symbol_then;
+static Symbol const *symbol_begin;
+static Symbol const *symbol_until;
+static Symbol const *symbol_do;
+static Symbol const *symbol_loop;
+static Symbol const *symbol_i;
+static Symbol const *symbol_j;
+static Symbol const *symbol_recurse;
+
+/** 計測を開始する語 */
+static Symbol const *symbol_profile;
+/** 計測を終了する語 */
+static Symbol const *symbol_profile_off;
+/** 計測結果を消去する語 */
+static Symbol const *symbol_profile_reset;
+/** 計測結果を表示する語 */
+static Symbol const *symbol_dot_profile;
+
+/** 計測を操作する語であれば TRUE */
+#define IS_PROFILE_WORD(symbol) \
+	((symbol) == symbol_profile || (symbol) == symbol_profile_off \
+	 || (symbol) == symbol_profile_reset || (symbol) == symbol_dot_profile)
+
+/** 制御構造の語であれば TRUE */
+#define IS_CONTROL_WORD(symbol) \
+	((symbol) == symbol_if || (symbol) == symbol_else \
+	 || (symbol) == symbol_then || (symbol) == symbol_begin \
+	 || (symbol) == symbol_until || (symbol) == symbol_do \
+	 || (symbol) == symbol_loop || (symbol) == symbol_i \
+	 || (symbol) == symbol_j || (symbol) == symbol_recurse)
+
+/** 基数を変える語であれば TRUE */
+#define IS_RADIX_WORD(symbol) \
+	((symbol) == symbol_hex || (symbol) == symbol_decimal \
+	 || (symbol) == symbol_base)
+
+static void context_builtin(Map *map, Arena *arena)
 {
-	map_put(context->map, "+", value_new_function(forsh_plus));
-	map_put(context->map, "-", value_new_function(forsh_minus));
-	map_put(context->map, "*", value_new_function(forsh_star));
-	map_put(context->map, "/", value_new_function(forsh_slash));
+	map_put(map, "+", value_new_function(arena, forsh_plus));
+	map_put(map, "-", value_new_function(arena, forsh_minus));
+	map_put(map, "*", value_new_function(arena, forsh_star));
+	map_put(map, "/", value_new_function(arena, forsh_slash));
+	map_put(map, "DUP", value_new_function(arena, forsh_dup));
+	map_put(map, "DROP", value_new_function(arena, forsh_drop));
+	map_put(map, "SWAP", value_new_function(arena, forsh_swap));
+	map_put(map, "OVER", value_new_function(arena, forsh_over));
+	map_put(map, "THROW", value_new_function(arena, forsh_throw));
+	map_put(map, "CELLS", value_new_function(arena, forsh_cells));
+	map_put(map, "A@", value_new_function(arena, forsh_array_fetch));
+	map_put(map, "A!", value_new_function(arena, forsh_array_store));
+	map_put(map, "ALEN", value_new_function(arena, forsh_array_length));
+	map_put(map, "A+", value_new_function(arena, forsh_array_plus));
+	map_put(map, "A-", value_new_function(arena, forsh_array_minus));
+	map_put(map, "A*", value_new_function(arena, forsh_array_star));
+	map_put(map, "A/", value_new_function(arena, forsh_array_slash));
+	map_put(map, "ASUM", value_new_function(arena, forsh_array_sum));
+	map_put(map, "AMAX", value_new_function(arena, forsh_array_max));
+	map_put(map, "ADOT", value_new_function(arena, forsh_array_dot));
+	/* 文脈を扱う語は内部インタープリターの命令として実行する */
+	map_put(map, "CATCH", value_new_opcode(arena, OP_CATCH));
+	map_put(map, "HERE", value_new_opcode(arena, OP_HERE));
+	map_put(map, "ALLOT", value_new_opcode(arena, OP_ALLOT));
+	map_put(map, ",", value_new_opcode(arena, OP_COMMA));
+	map_put(map, "@", value_new_opcode(arena, OP_FETCH));
+	map_put(map, "!", value_new_opcode(arena, OP_STORE));
+	map_put(map, "+!", value_new_opcode(arena, OP_PLUS_STORE));
+	map_put(map, ".", value_new_opcode(arena, OP_DOT));
+	map_put(map, "EMIT", value_new_opcode(arena, OP_EMIT));
+	map_put(map, "CR", value_new_opcode(arena, OP_CR));
+	map_put(map, "TYPE", value_new_opcode(arena, OP_TYPE));
+	map_put(map, "SPAWN", value_new_opcode(arena, OP_SPAWN));
+	map_put(map, "JOIN", value_new_opcode(arena, OP_JOIN));
+	map_put(map, "PMAP", value_new_opcode(arena, OP_PMAP));
+	map_put(map, "PREDUCE", value_new_opcode(arena, OP_PREDUCE));
 }
 
-static void value_free_ignoring_symbols(Value *value)
+Context *context_new(void)
 {
-	if (value->type != TYPE_SYMBOL) {
-		value_free(value);
+	return context_create(FALSE, 0);
+}
+
+Context *context_new_guarded(size_t memlen)
+{
+	return context_create(TRUE, memlen);
+}
+
+static void context_init(void)
+{
+	symbol_variable = symbol_intern("VARIABLE");
+	symbol_constant = symbol_intern("CONSTANT");
+	symbol_array = symbol_intern("ARRAY");
+	symbol_colon = symbol_intern(":");
+	symbol_see = symbol_intern("SEE");
+	symbol_semicolon = symbol_intern(";");
+	symbol_hex = symbol_intern("HEX");
+	symbol_decimal = symbol_intern("DECIMAL");
+	symbol_base = symbol_intern("BASE");
+	symbol_tier_threshold = symbol_intern("TIER-THRESHOLD");
+	symbol_threads = symbol_intern("THREADS");
+	symbol_tick = symbol_intern("'");
+	symbol_if = symbol_intern("IF");
+	symbol_else = symbol_intern("ELSE");
+	symbol_then = symbol_intern("THEN");
+	symbol_begin = symbol_intern("BEGIN");
+	symbol_until = symbol_intern("UNTIL");
+	symbol_do = symbol_intern("DO");
+	symbol_loop = symbol_intern("LOOP");
+	symbol_i = symbol_intern("I");
+	symbol_j = symbol_intern("J");
+	symbol_recurse = symbol_intern("RECURSE");
+	symbol_profile = symbol_intern("PROFILE");
+	symbol_profile_off = symbol_intern("PROFILE-OFF");
+	symbol_profile_reset = symbol_intern("PROFILE-RESET");
+	symbol_dot_profile = symbol_intern(".PROFILE");
+	base_arena = arena_new();
+	if (NULL == base_arena) {
+		return;
+	}
+	base_map = map_new(arena_nofree);
+	if (NULL == base_map) {
+		return;
 	}
+	context_builtin(base_map, base_arena);
 }
 
-Context *context_new(void)
+static Context *context_create(bool guarded, size_t memlen)
 {
 	Context *context;
+	pthread_once(&context_once, context_init);
+	if (NULL == base_map) {
+		goto err_malloc;
+	}
 	context = (Context *) malloc(sizeof(Context));
 	if (NULL == context) {
 		goto err_malloc;
 	}
-	context->stack = stack_new((FreeFunc *) value_free_ignoring_symbols);
+	context->stack = guarded ? stack_new_guarded(memlen) : stack_new();
 	if (NULL == context->stack) {
 		goto err_malloc_stack;
 	}
-	context->map = map_new((FreeFunc *) value_free);
+	context->rstack = guarded ? stack_new_guarded(memlen) : stack_new();
+	if (NULL == context->rstack) {
+		goto err_malloc_rstack;
+	}
+	context->data = stack_new();
+	if (NULL == context->data) {
+		goto err_malloc_data;
+	}
+	context->control = stack_new();
+	if (NULL == context->control) {
+		goto err_malloc_control;
+	}
+	context->output = output_new(fileno(stdout));
+	if (NULL == context->output) {
+		goto err_malloc_output;
+	}
+	context->arena = arena_new();
+	if (NULL == context->arena) {
+		goto err_malloc_arena;
+	}
+	context->map = map_new(arena_nofree);
 	if (NULL == context->map) {
 		goto err_malloc_map;
 	}
-	context_builtin(context);
-	context->defining_variable = FALSE;
+	context->jit = jit_new();
+	context->base = 10;
+	context->parsing = NULL;
+	context->compiling = NULL;
+	context->definitions = NULL;
+	context->profiling = FALSE;
+	context->tier_threshold = FORSH_TIER_THRESHOLD;
+	context->guarded = guarded;
+	context->handler = NO_HANDLER;
+	context->parent = NULL;
+	context->tasks = NULL;
+	context->running = 0;
+	context->threads = 0;
 	return context;
 err_malloc_map:
-	free(context->stack);
+	arena_free(context->arena);
+err_malloc_arena:
+	output_free(context->output);
+err_malloc_output:
+	stack_free(context->control);
+err_malloc_control:
+	stack_free(context->data);
+err_malloc_data:
+	stack_free(context->rstack);
+err_malloc_rstack:
+	stack_free(context->stack);
+err_malloc_stack:
+	free(context);
+err_malloc:
+	return NULL;
+}
+
+Context *context_new_task(Context *parent)
+{
+	Context *context;
+	context = (Context *) malloc(sizeof(Context));
+	if (NULL == context) {
+		goto err_malloc;
+	}
+	context->stack = stack_new();
+	if (NULL == context->stack) {
+		goto err_malloc_stack;
+	}
+	context->rstack = stack_new();
+	if (NULL == context->rstack) {
+		goto err_malloc_rstack;
+	}
+	context->map = parent->map;
+	context->arena = parent->arena;
+	context->data = parent->data;
+	context->output = parent->output;  // 実行するスレッドの出力に差し替える
+	context->base = parent->base;
+	context->parsing = NULL;
+	context->compiling = NULL;
+	context->control = NULL;
+	context->definitions = NULL;
+	context->profiling = FALSE;
+	context->jit = parent->jit;
+	context->tier_threshold = SIZE_MAX;
+	context->guarded = FALSE;
+	context->handler = NO_HANDLER;
+	context->parent = parent;
+	context->tasks = NULL;
+	context->running = 0;
+	context->threads = parent->threads;
+	return context;
+err_malloc_rstack:
+	stack_free(context->stack);
 err_malloc_stack:
 	free(context);
 err_malloc:
@@ -67,69 +428,535 @@ err_malloc:
 
 void context_free(Context *context)
 {
+	task_discard(context);
+	if (NULL != context->tasks) {
+		stack_free(context->tasks);
+	}
+	if (NULL != context->parent) {  // 共有しているものは親が解放する
+		stack_free(context->stack);
+		stack_free(context->rstack);
+		free(context);
+		return;
+	}
 	stack_free(context->stack);
+	stack_free(context->rstack);
+	stack_free(context->data);
+	stack_free(context->control);
+	output_free(context->output);
 	map_free(context->map);
+	if (NULL != context->compiling) {
+		definition_free(context->compiling);
+	}
+	if (NULL != context->jit) {
+		jit_free(context->jit);
+	}
+	/* シンボル・テーブルの値と定義はアリーナごとまとめて解放する */
+	arena_free(context->arena);
 	free(context);
 }
 
+void context_reset(Context *context)
+{
+	task_discard(context);
+	if (fileno(stdout) != context->output->fd) {
+		output_redirect(context->output, fileno(stdout));
+	} else {
+		output_flush(context->output);
+	}
+	context->stack->len = 0;
+	context->rstack->len = 0;
+	context->control->len = 0;
+	context->data->len = 0;
+	if (NULL != context->compiling) {
+		definition_free(context->compiling);
+		context->compiling = NULL;
+	}
+	/* 定義と複製したビルトインの値はアリーナにあるので、まとめて捨てる */
+	map_clear(context->map);
+	context->definitions = NULL;
+	if (NULL != context->jit) {
+		jit_reset(context->jit);
+	}
+	arena_reset(context->arena);
+	context->base = 10;
+	context->parsing = NULL;
+	context->profiling = FALSE;
+	context->tier_threshold = FORSH_TIER_THRESHOLD;
+	context->handler = NO_HANDLER;
+	context->threads = 0;
+}
+
 void context_describe(Context const *context)
 {
-	putchar('#');
-	stack_each(context->stack, (void (*)(void *)) print_value);
-	putchar('\n');
+	size_t i;
+	output_char(context->output, '#');
+	for (i = 0; i < context->stack->len; ++i) {
+		output_char(context->output, ' ');
+		output_cell(context->output, context->stack->values[i], context->base);
+	}
+	output_char(context->output, '\n');
+}
+
+Value *context_resolve(Context const *context, Symbol const *key)
+{
+	Value *value;
+	value = (Value *) map_get_symbol(context->map, key);
+	if (NULL == value) {
+		value = (Value *) map_get_symbol(base_map, key);
+	}
+	return value;
+}
+
+static void context_copy_builtin(Symbol const *key, void *value, void *data)
+{
+	Context *context;
+	Value *copy;
+	context = (Context *) data;
+	if (NULL != map_get_symbol(context->map, key)) {  // 再定義されている
+		return;
+	}
+	copy = (Value *) arena_alloc(context->arena, sizeof(Value));
+	if (NULL == copy) {
+		return;
+	}
+	*copy = *(Value const *) value;
+	map_put_symbol(context->map, key, copy);
 }
 
-Value *context_resolve(Context const *context, char const *key)
+void context_own_builtins(Context *context)
 {
-	return map_get(context->map, key);
+	map_each(base_map, context_copy_builtin, context);
 }
 
 Error *context_interpret(Context *context, const char *str)
+{
+	return context_interpret_n(context, str, strlen(str));
+}
+
+Error *context_interpret_n(Context *context, const char *str, size_t len)
+{
+	Guard guard;
+	Error *error;
+	if (!context->guarded) {
+		return context_interpret_token(context, str, len);
+	}
+	guard_begin(&guard, context->stack, context->rstack);
+	if (0 != sigsetjmp(guard.env, 0)) {
+		/* 途中の状態は信頼できないので、ABORT と同じくスタックを空にする */
+		context->stack->len = 0;
+		context->rstack->len = 0;
+		context->handler = NO_HANDLER;
+		return error_new(guard.fault, NULL);
+	}
+	error = context_interpret_token(context, str, len);
+	guard_end(&guard);
+	return error;
+}
+
+static Error *context_interpret_token(Context *context, const char *str,
+									  size_t len)
 {
 	Value *value;
-	if (context->defining_variable) {  // 変数定義
-		context->defining_variable = FALSE;
-		value = value_new_symbol(str);
-		if (NULL == value) {  // エラー (変数名不正など)
+	Symbol const *symbol;
+	int n;
+	if (NULL != context->parsing) {  // 名前を待っている語
+		return context_parse_name(context, str, len);
+	} else if (NULL != context->compiling) {  // コロン定義の本体
+		return context_compile(context, str, len);
+	} else if (lexer_integer(str, len, context->base, &n)) {  // 整数
+		stack_push(context->stack, cell_from_integer(n));
+	} else if (NULL == (symbol = symbol_lookup_n(str, len))) {
+		return error_new_n(IllegalDefinitionError, str, len);
+	} else if (IS_RADIX_WORD(symbol)) {  // 基数の変更
+		return context_set_base(context, symbol);
+	} else if (IS_PROFILE_WORD(symbol)) {  // 計測の操作
+		context_profile(context, symbol);
+	} else if (symbol == symbol_tier_threshold) {  // 最適化の閾値
+		return context_set_tier_threshold(context);
+	} else if (symbol == symbol_threads) {  // 並列に計算するスレッドの数
+		return context_set_threads(context);
+	} else if (symbol == symbol_variable  // 変数定義の開始
+			   || symbol == symbol_constant  // 定数定義の開始
+			   || symbol == symbol_array  // 配列定義の開始
+			   || symbol == symbol_colon  // コロン定義の開始
+			   || symbol == symbol_see  // 逆アセンブル
+			   || symbol == symbol_tick) {  // 実行トークン
+		context->parsing = symbol;
+	} else if (NULL != (value = context_resolve(context, symbol))) {  // シンボル
+		if (context->profiling && TYPE_CONSTANT != value->type
+			&& TYPE_ARRAY != value->type) {
+			return context_call_profiled(context, value);
+		}
+		return context_execute(context, value);
+	} else {  // 未定義の語
+		return error_new_n(IllegalDefinitionError, str, len);
+	}
+	return NULL;
+}
+
+Error *context_execute(Context *context, Value *value)
+{
+	switch (value->type) {
+	case TYPE_FUNCTION:
+		return value_function(value)(context->stack);
+	case TYPE_DEFINITION:
+		return vm_execute(context, value_definition(value));
+	case TYPE_OPCODE:
+		return vm_execute_op(context, value_opcode(value));
+	default:
+		stack_push(context->stack, value_constant(value));
+		return NULL;
+	}
+}
+
+static Error *context_parse_name(Context *context,
+								 char const *str, size_t len)
+{
+	Symbol const *parsing;
+	Symbol const *symbol;
+	Value *value;
+	parsing = context->parsing;
+	context->parsing = NULL;
+	if (parsing == symbol_variable || parsing == symbol_constant) {
+		Cell cell;
+		if (!value_is_valid_symbol(str, len)
+			|| NULL == (symbol = symbol_intern_n(str, len))) {
+			// エラー (変数名不正など)
 			return error_new(IllegalVariableError, NULL);
 		}
-		map_put(context->map, value_symbol_name(value), value);
-	} else if (str_is_integer(str)) {  // 整数
-		value = value_new_integer_str(str);
-		stack_push(context->stack, value);
-	} else if (0 == strcmp(str, "VARIABLE")) {  // 変数定義の開始
-		context->defining_variable = TRUE;
-	} else if (NULL != (value = context_resolve(context, str))) {  // シンボル
-		ForshFunc *func;
-		switch (value->type) {
-		case TYPE_FUNCTION:
-			func = value_function(value);
-			return func(context->stack);
-		default:
-			stack_push(context->stack, value);
-			break;
+		task_quiesce(context);  // タスクが読むデータ空間と語を書き換える
+		if (parsing == symbol_variable) {  // 変数はデータ空間の一セル
+			cell = cell_from_integer(data_here(context->data));
+			if (!data_allot(context->data, sizeof(Cell))) {
+				return error_new(IllegalAddressError, NULL);
+			}
+		} else if (!stack_pop(context->stack, &cell)) {
+			return error_new(EmptyStackError, NULL);
+		}
+		if (NULL == (value = value_new_constant(context->arena, cell))) {
+			return error_new(IllegalVariableError, NULL);
+		}
+		map_put_symbol(context->map, symbol, value);
+	} else if (parsing == symbol_array) {  // 要素の数を下ろして配列を確保する
+		Array *array;
+		Cell cell;
+		if (!value_is_valid_symbol(str, len)
+			|| NULL == (symbol = symbol_intern_n(str, len))) {
+			return error_new(IllegalVariableError, NULL);
+		}
+		if (!stack_pop(context->stack, &cell)) {
+			return error_new(EmptyStackError, NULL);
+		}
+		if (!cell_is_integer(cell) || cell_integer(cell) < 0) {
+			stack_push(context->stack, cell);
+			return error_new(IllegalTypeError, NULL);
+		}
+		task_quiesce(context);  // タスクが読む語を書き換える
+		if (NULL == (array = array_new(context->arena, symbol,
+									   cell_integer(cell)))) {
+			return error_new(IllegalAddressError, NULL);
+		}
+		if (NULL == (value = value_new_array(context->arena, array))) {
+			return error_new(IllegalVariableError, NULL);
+		}
+		map_put_symbol(context->map, symbol, value);
+	} else if (parsing == symbol_colon) {  // コロン定義の名前
+		if (NULL == (symbol = symbol_intern_n(str, len))
+			|| NULL == (context->compiling
+						= definition_new(context->arena, symbol))) {
+			return error_new_n(IllegalDefinitionError, str, len);
+		}
+		context->control->len = 0;
+	} else if (parsing == symbol_tick) {  // 実行トークン
+		Inst inst;
+		if (NULL == (symbol = symbol_lookup_n(str, len))
+			|| NULL == context_resolve(context, symbol)) {
+			return context_abandon(context, str, len);
+		}
+		inst.cell = cell_from_symbol(symbol);
+		if (NULL == context->compiling) {
+			stack_push(context->stack, inst.cell);
+		} else if (!definition_emit_op(context->compiling, OP_LIT)
+				   || !definition_emit(context->compiling, inst)) {
+			return context_abandon(context, str, len);
+		}
+	} else if (parsing == symbol_see) {  // 逆アセンブル
+		if (NULL == (symbol = symbol_lookup_n(str, len))
+			|| NULL == (value = context_resolve(context, symbol))) {
+			return error_new_n(IllegalDefinitionError, str, len);
+		} else if (TYPE_DEFINITION == value->type) {
+			definition_dump(value_definition(value), context->output);
+		} else if (TYPE_FUNCTION == value->type
+				   || TYPE_OPCODE == value->type) {
+			output_format(context->output, "%s is builtin\n",
+						  symbol_name(symbol));
+		} else {
+			char buf[1024];
+			value_str(value, buf, sizeof(buf));
+			output_format(context->output, "%s is %s\n",
+						  symbol_name(symbol), buf);
 		}
-	} else {
-		fprintf(stderr, "Failed to interpret: %s\n", str);
 	}
 	return NULL;
 }
 
-static bool str_is_integer(char const *str)
+static Error *context_compile(Context *context, char const *str, size_t len)
 {
-	if ('\0' == *str) { return FALSE; }
-	while (*str) {
-		if (!isdigit(*str)) {
+	Definition *definition;
+	Symbol const *symbol;
+	Value const *value;
+	bool ok;
+	int n;
+	definition = context->compiling;
+	if (lexer_integer(str, len, context->base, &n)) {
+		Inst inst;
+		inst.cell = cell_from_integer(n);
+		ok = definition_emit_op(definition, OP_LIT)
+			&& definition_emit(definition, inst);
+	} else if (NULL == (symbol = symbol_lookup_n(str, len))) {
+		ok = FALSE;
+	} else if (symbol == symbol_semicolon) {
+		return context_end_definition(context);
+	} else if (symbol == symbol_base) {  // 実行時の値で基数は変えられない
+		ok = FALSE;
+	} else if (IS_RADIX_WORD(symbol)) {
+		return context_set_base(context, symbol);
+	} else if (symbol == symbol_tick) {
+		context->parsing = symbol;
+		ok = TRUE;
+	} else if (IS_CONTROL_WORD(symbol)) {
+		ok = context_compile_control(context, symbol);
+	} else if (NULL != (value = context_resolve(context, symbol))) {
+		ok = context_compile_value(definition, value);
+	} else {  // 未定義の語
+		ok = FALSE;
+	}
+	if (!ok) {
+		return context_abandon(context, str, len);
+	}
+	return NULL;
+}
+
+static Error *context_abandon(Context *context, char const *str, size_t len)
+{
+	if (NULL != context->compiling) {  // 定義を破棄する
+		definition_free(context->compiling);
+		context->compiling = NULL;
+		context->control->len = 0;
+	}
+	return error_new_n(IllegalDefinitionError, str, len);
+}
+
+static bool context_compile_value(Definition *definition, Value const *value)
+{
+	Inst inst;
+	Opcode op;
+	switch (value->type) {
+	case TYPE_FUNCTION:
+		inst.func = value_function(value);
+		op = opcode_of_function(inst.func);
+		if (OP_CALL != op) {  // 内部インタープリターが直接実装している
+			return definition_emit_op(definition, op);
+		}
+		break;
+	case TYPE_DEFINITION:
+		op = OP_ENTER;
+		inst.definition = value_definition(value);
+		break;
+	case TYPE_OPCODE:
+		return definition_emit_op(definition, value_opcode(value));
+	case TYPE_CONSTANT:
+	case TYPE_ARRAY:
+		op = OP_LIT;
+		inst.cell = value_constant(value);
+		break;
+	default:
+		return FALSE;
+	}
+	return definition_emit_op(definition, op)
+		&& definition_emit(definition, inst);
+}
+
+static bool context_compile_control(Context *context, Symbol const *symbol)
+{
+	Definition *definition;
+	Cell kind, origin;
+	size_t here;
+	Inst inst;
+	definition = context->compiling;
+	here = definition->len;
+	if (symbol == symbol_if) {  // 偽であれば ELSE か THEN の後へ分岐する
+		return definition_emit_branch(definition, OP_ZBRANCH, here + 1)
+			&& context_open(context, symbol, here + 1);
+	} else if (symbol == symbol_begin) {
+		return context_open(context, symbol, here);
+	} else if (symbol == symbol_do) {
+		return definition_emit_op(definition, OP_DO)
+			&& context_open(context, symbol, here + 1);
+	} else if (symbol == symbol_i || symbol == symbol_j) {
+		/* リターン・スタックの上にループの添字があることを保証する */
+		return (symbol == symbol_i ? 1 : 2) <= context_loops(context)
+			&& definition_emit_op(definition,
+								  symbol == symbol_i ? OP_I : OP_J);
+	} else if (symbol == symbol_recurse) {
+		inst.definition = definition;
+		return definition_emit_op(definition, OP_ENTER)
+			&& definition_emit(definition, inst);
+	}
+	/* 残りは一番内側の構造を閉じる語 */
+	if (!stack_pop(context->control, &kind)
+		|| !stack_pop(context->control, &origin)) {
+		return FALSE;
+	}
+	if (symbol == symbol_else) {
+		if (cell_from_symbol(symbol_if) != kind
+			|| !definition_emit_branch(definition, OP_BRANCH, here + 1)) {
+			return FALSE;
+		}
+		definition_resolve(definition, cell_integer(origin));
+		return context_open(context, symbol, here + 1);
+	} else if (symbol == symbol_then) {
+		if (cell_from_symbol(symbol_if) != kind
+			&& cell_from_symbol(symbol_else) != kind) {
 			return FALSE;
 		}
-		++str;
+		definition_resolve(definition, cell_integer(origin));
+		return TRUE;
+	} else if (symbol == symbol_until) {
+		return cell_from_symbol(symbol_begin) == kind
+			&& definition_emit_branch(definition, OP_ZBRANCH,
+									  cell_integer(origin));
+	} else {  // LOOP
+		return cell_from_symbol(symbol_do) == kind
+			&& definition_emit_branch(definition, OP_LOOP,
+									  cell_integer(origin));
+	}
+}
+
+static bool context_open(Context *context, Symbol const *symbol,
+						 size_t position)
+{
+	return stack_push(context->control, cell_from_integer((int) position))
+		&& stack_push(context->control, cell_from_symbol(symbol));
+}
+
+static size_t context_loops(Context const *context)
+{
+	size_t i, n = 0;
+	for (i = 1; i < context->control->len; i += 2) {
+		if (cell_from_symbol(symbol_do) == context->control->values[i]) {
+			n += 1;
+		}
+	}
+	return n;
+}
+
+static Error *context_end_definition(Context *context)
+{
+	Definition *definition;
+	Value *value;
+	definition = context->compiling;
+	context->compiling = NULL;
+	task_quiesce(context);  // タスクが読むシンボル・テーブルを書き換える
+	if (0 != context->control->len  // 閉じていない制御構造がある
+		|| !definition_finish(context->arena, definition)
+		|| NULL == (value = value_new_definition(context->arena,
+												 definition))) {
+		definition_free(definition);
+		return error_new(IllegalDefinitionError, NULL);
 	}
-	return TRUE;
+	/*
+	 * 既存の定義を参照しているコードがありうるので、再定義された場合も
+	 * 古い定義はアリーナに残しておく
+	 */
+	map_put_symbol(context->map, definition->name, value);
+	definition->next = context->definitions;
+	context->definitions = definition;
+	if (context->profiling) {
+		vm_profile(definition, TRUE);
+	}
+	if (0 == context->tier_threshold) {
+		vm_promote(context, definition);
+	}
+	return NULL;
+}
+
+static Error *context_set_base(Context *context, Symbol const *symbol)
+{
+	Cell cell;
+	if (symbol == symbol_hex) {
+		context->base = 16;
+	} else if (symbol == symbol_decimal) {
+		context->base = 10;
+	} else if (!stack_pop(context->stack, &cell)) {
+		return error_new(EmptyStackError, NULL);
+	} else if (!cell_is_integer(cell)
+			   || cell_integer(cell) < 2 || 36 < cell_integer(cell)) {
+		stack_push(context->stack, cell);
+		return error_new(IllegalTypeError, NULL);
+	} else {
+		context->base = cell_integer(cell);
+	}
+	return NULL;
 }
 
-static void print_value(Value *value)
+static Error *context_set_tier_threshold(Context *context)
 {
-	char buf[1024];
-	value_str(value, buf, sizeof(buf));
-	printf(" %s", buf);
+	Cell cell;
+	if (!stack_pop(context->stack, &cell)) {
+		return error_new(EmptyStackError, NULL);
+	} else if (!cell_is_integer(cell) || cell_integer(cell) < 0) {
+		stack_push(context->stack, cell);
+		return error_new(IllegalTypeError, NULL);
+	}
+	context->tier_threshold = cell_integer(cell);
+	return NULL;
 }
+
+static Error *context_set_threads(Context *context)
+{
+	Cell cell;
+	if (!stack_pop(context->stack, &cell)) {
+		return error_new(EmptyStackError, NULL);
+	} else if (!cell_is_integer(cell) || cell_integer(cell) < 0) {
+		stack_push(context->stack, cell);
+		return error_new(IllegalTypeError, NULL);
+	}
+	context->threads = cell_integer(cell);
+	return NULL;
+}
+
+static void context_profile(Context *context, Symbol const *symbol)
+{
+	if (symbol == symbol_profile) {
+		profile_enable(context, TRUE);
+	} else if (symbol == symbol_profile_off) {
+		profile_enable(context, FALSE);
+	} else if (symbol == symbol_profile_reset) {
+		profile_reset(context);
+	} else {
+		profile_report(context, context->output);
+	}
+}
+
+static Error *context_call_profiled(Context *context, Value *value)
+{
+	Profile *profile;
+	Error *error;
+	uint64_t start;
+	start = profile_clock();
+	if (TYPE_FUNCTION == value->type) {
+		profile = &value->profile;
+		error = value_function(value)(context->stack);
+	} else if (TYPE_OPCODE == value->type) {
+		profile = &value->profile;
+		error = vm_execute_op(context, value_opcode(value));
+	} else {
+		profile = &value_definition(value)->profile;
+		error = vm_execute(context, value_definition(value));
+	}
+	profile->calls += 1;
+	profile->cycles += profile_clock() - start;
+	return error;
+}
+
@@ -0,0 +1,833 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+#include <signal.h>
+#include <sys/mman.h>
+
+/**
+ * 空白で区切られたソースを文脈に解釈させる。最後に起きたエラーの種別
+ * を返し、エラーがなければ -1 を返す。
+ * \context 文脈
+ * \source ソース
+ */
+static int interpret(Context *context, char const *source)
+{
+	char *buffer;
+	char *tofree;
+	char *token;
+	int error_type = -1;
+	tofree = buffer = strdup(source);
+	while (NULL != (token = strsep(&buffer, " "))) {
+		Error *error;
+		if ('\0' == *token) {
+			continue;
+		}
+		error = context_interpret(context, token);
+		if (NULL != error) {
+			error_type = error->type;
+			error_free(error);
+		}
+	}
+	free(tofree);
+	return error_type;
+}
+
+/**
+ * スタックの内容を空白区切りの文字列にする。
+ * \stack スタック
+ * \buf 文字列の書き込み先
+ * \size 書き込み文字数の制限値
+ */
+static void stack_str(Stack *stack, char *buf, size_t size)
+{
+	size_t i;
+	size_t len = 0;
+	buf[0] = '\0';
+	for (i = 0; i < stack->len && len < size; ++i) {
+		if (0 < i) {
+			len += snprintf(&buf[len], size - len, " ");
+		}
+		cell_str(stack->values[i], &buf[len], size - len);
+		len += strlen(&buf[len]);
+	}
+}
+
+/**
+ * ソースを新しい文脈で解釈し、スタックの内容とエラーを確かめる。
+ * \source ソース
+ * \expected 期待するスタックの内容
+ * \expected_error 期待するエラーの種別。エラーがなければ -1
+ */
+static bool expect(char const *source, char const *expected,
+				   int expected_error)
+{
+	Context *context;
+	char buf[1024];
+	int error_type;
+	bool ok = TRUE;
+	context = context_new();
+	error_type = interpret(context, source);
+	stack_str(context->stack, buf, sizeof(buf));
+	if (0 != strcmp(expected, buf)) {
+		printf("[[%s]] expected: [[%s]], received: [[%s]]\n",
+			   source, expected, buf);
+		ok = FALSE;
+	}
+	if (expected_error != error_type) {
+		printf("[[%s]] expected error: %d, received: %d\n",
+			   source, expected_error, error_type);
+		ok = FALSE;
+	}
+	context_free(context);
+	return ok;
+}
+
+/**
+ * 語の呼び出し回数を返す。
+ * \context 文脈
+ * \name 語の名前
+ */
+static uint64_t calls(Context *context, char const *name)
+{
+	Value *value;
+	value = (Value *) map_get(context->map, name);
+	if (TYPE_DEFINITION == value->type) {
+		return value_definition(value)->profile.calls;
+	}
+	return value->profile.calls;
+}
+
+/** 計測中も計測していないときと同じ結果になり、呼び出しが数えられる */
+static bool test_profile(void)
+{
+	Context *context;
+	char buf[1024];
+	bool ok = TRUE;
+	context = context_new();
+	interpret(context, ": sq DUP * ; : f sq sq ; 2 f");
+	interpret(context, "PROFILE 2 f 3 f : g f 1 + ; 2 g DUP");
+	interpret(context, "PROFILE-OFF 2 g");
+	stack_str(context->stack, buf, sizeof(buf));
+	if (0 != strcmp("16 16 81 17 17 17", buf)) {
+		printf("profile expected: [[16 16 81 17 17 17]], received: [[%s]]\n",
+			   buf);
+		ok = FALSE;
+	}
+	if (3 != calls(context, "f") || 6 != calls(context, "sq")
+		|| 1 != calls(context, "g") || 1 != calls(context, "DUP")) {
+		printf("profile calls: f %lu, sq %lu, g %lu, DUP %lu\n",
+			   (unsigned long) calls(context, "f"),
+			   (unsigned long) calls(context, "sq"),
+			   (unsigned long) calls(context, "g"),
+			   (unsigned long) calls(context, "DUP"));
+		ok = FALSE;
+	}
+	interpret(context, "PROFILE-RESET");
+	if (0 != calls(context, "f") || 0 != calls(context, "DUP")) {
+		printf("profile was not reset\n");
+		ok = FALSE;
+	}
+	context_free(context);
+	return ok;
+}
+
+/**
+ * コロン定義が最適化されていなければ TRUE を返す。
+ * \context 文脈
+ * \name 語の名前
+ */
+static bool cold(Context *context, char const *name)
+{
+	return definition_is_cold(value_definition(
+		(Value *) map_get(context->map, name)));
+}
+
+/** 呼び出し回数が閾値に達した定義と、その呼び出し先が最適化される */
+static bool test_tier(void)
+{
+	Context *context;
+	char buf[1024];
+	bool ok = TRUE;
+	context = context_new();
+	interpret(context, "3 TIER-THRESHOLD : sq DUP * ; : f sq 1 + ; 2 f f");
+	if (!cold(context, "f") || !cold(context, "sq")) {
+		printf("tier: promoted before the threshold\n");
+		ok = FALSE;
+	}
+	interpret(context, "f : sq 100 ; f sq");
+	stack_str(context->stack, buf, sizeof(buf));
+	if (0 != strcmp("458330 100", buf)) {
+		printf("tier expected: [[458330 100]], received: [[%s]]\n", buf);
+		ok = FALSE;
+	}
+	/* 再定義された sq は新しい定義として呼び出し回数を数え直す */
+	if (cold(context, "f") || !cold(context, "sq")) {
+		printf("tier: f was not promoted\n");
+		ok = FALSE;
+	}
+	context_free(context);
+	return ok;
+}
+
+/**
+ * コロン定義のスタック効果が期待どおりであることを確かめる。
+ * \context 文脈
+ * \name 語の名前
+ * \in 実行前に必要な要素の数。推論できないはずなら -1
+ * \out 実行後に残る要素の数
+ * \integers 整数でなければならない要素
+ */
+static bool expect_effect(Context *context, char const *name, int in,
+						  size_t out, uint32_t integers)
+{
+	Effect const *effect;
+	effect = &value_definition((Value *) map_get(context->map, name))->effect;
+	if (in < 0 ? effect->known
+		: !effect->known || (size_t) in != effect->in || out != effect->out
+		|| integers != effect->integers) {
+		printf("effect of %s: known %d, in %lu, out %lu, integers %x\n",
+			   name, effect->known, (unsigned long) effect->in,
+			   (unsigned long) effect->out, (unsigned) effect->integers);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/** 最適化した定義のスタック効果が推論される */
+static bool test_effect(void)
+{
+	Context *context;
+	bool ok = TRUE;
+	context = context_new();
+	interpret(context, "0 TIER-THRESHOLD VARIABLE x");
+	interpret(context, ": sq DUP * ; : f sq 1 + ; : g SWAP ; : h g - g ;");
+	interpret(context, ": v ' x ; : w v + ; : k OVER OVER DROP DROP ;");
+	interpret(context, ": p x @ ; : q p 1 + ; : s x ! ;");
+	ok &= expect_effect(context, "sq", 1, 1, 0x1);
+	ok &= expect_effect(context, "f", 1, 1, 0x1);
+	ok &= expect_effect(context, "g", 2, 2, 0x0);
+	ok &= expect_effect(context, "h", 3, 2, 0x3);
+	ok &= expect_effect(context, "v", 0, 1, 0x0);
+	ok &= expect_effect(context, "w", -1, 0, 0x0);
+	ok &= expect_effect(context, "k", 2, 2, 0x0);
+	ok &= expect_effect(context, "p", 0, 1, 0x0);
+	ok &= expect_effect(context, "q", -1, 0, 0x0);
+	ok &= expect_effect(context, "s", 1, 0, 0x0);
+	if (2 != value_definition((Value *) map_get(context->map, "k"))
+		->effect.peak) {
+		printf("effect of k: peak is not 2\n");
+		ok = FALSE;
+	}
+	context_free(context);
+	return ok;
+}
+
+/**
+ * 語を繰り返し実行してスタックを溢れさせ、エラーになった後もスタック
+ * が空の状態から実行を続けられることを確かめる。
+ * \context ガード・ページで挟んだスタックを持つ文脈
+ * \word 実行する語
+ */
+static bool expect_overflow(Context *context, char const *word)
+{
+	Error *error = NULL;
+	char buf[1024];
+	size_t n;
+	bool ok = TRUE;
+	for (n = 0; n < 100000 && NULL == error; ++n) {
+		error = context_interpret(context, word);
+	}
+	if (NULL == error || StackOverflowError != error->type
+		|| 0 != context->stack->len || 0 != context->rstack->len) {
+		printf("overflow by %s: %s\n", word,
+			   NULL == error ? "no error" : error_str(error, buf, sizeof(buf)));
+		ok = FALSE;
+	}
+	if (NULL != error) {
+		error_free(error);
+	}
+	interpret(context, "1 2 +");
+	stack_str(context->stack, buf, sizeof(buf));
+	if (0 != strcmp("3", buf)) {
+		printf("after overflow by %s: [[%s]]\n", word, buf);
+		ok = FALSE;
+	}
+	context->stack->len = 0;
+	return ok;
+}
+
+/** ホストのハンドラーが戻る先 */
+static sigjmp_buf host_env;
+
+/** ホストのハンドラーが回復するなら TRUE */
+static volatile sig_atomic_t host_armed;
+
+/**
+ * SIGSEGV から回復するホスト (言語処理系など) のハンドラー。
+ * \sig シグナル
+ * \info シグナルの情報
+ * \ucontext シグナルを受けたときの文脈
+ */
+static void host_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	(void) info;
+	(void) ucontext;
+	if (!host_armed) {
+		signal(sig, SIG_DFL);
+		return;
+	}
+	host_armed = FALSE;
+	siglongjmp(host_env, 1);
+}
+
+/** ガード・ページで挟んだスタックが溢れるとエラーになる */
+static bool test_guard(void)
+{
+	static char const *const source =
+		": f 1 2 3 4 5 6 7 8 ; : g f f f f f f f f ; : h g DUP + ;";
+	struct sigaction action;
+	Context *context;
+	volatile int *page;
+	bool ok = TRUE;
+	/* ガードより先に、SIGSEGV から回復するホストのハンドラーを設定する */
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = host_handler;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, NULL);
+	/* 第 0 層の定義 */
+	context = context_new_guarded(1000);
+	interpret(context, source);
+	ok &= expect_overflow(context, "1");
+	/* スタックと関係のないアクセスはホストに渡り、ガードは残る */
+	page = (volatile int *) mmap(NULL, 4096, PROT_NONE,
+								 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	host_armed = TRUE;
+	if (0 == sigsetjmp(host_env, 1)) {
+		*page = 1;
+		printf("guard: no fault on a PROT_NONE page\n");
+		ok = FALSE;
+	}
+	munmap((void *) page, 4096);
+	ok &= expect_overflow(context, "h");
+	context_free(context);
+	/* 最適化した定義 (JIT が使えれば機械語) */
+	context = context_new_guarded(1000);
+	interpret(context, "0 TIER-THRESHOLD");
+	interpret(context, source);
+	ok &= expect_overflow(context, "h");
+	context_free(context);
+	return ok;
+}
+
+/**
+ * ソースを新しい文脈で解釈し、出力とエラーを確かめる。出力は書き出さ
+ * ずにバッファの中で比べる。
+ * \source ソース
+ * \expected 期待する出力
+ * \expected_error 期待するエラーの種別。エラーがなければ -1
+ */
+static bool expect_output(char const *source, char const *expected,
+						  int expected_error)
+{
+	Context *context;
+	int error_type;
+	bool ok = TRUE;
+	context = context_new();
+	context->output->line_buffered = FALSE;
+	error_type = interpret(context, source);
+	if (strlen(expected) != context->output->len
+		|| 0 != memcmp(expected, context->output->buf, context->output->len)) {
+		printf("[[%s]] expected output: [[%s]], received: [[%.*s]]\n",
+			   source, expected, (int) context->output->len,
+			   context->output->buf);
+		ok = FALSE;
+	}
+	if (expected_error != error_type) {
+		printf("[[%s]] expected error: %d, received: %d\n",
+			   source, expected_error, error_type);
+		ok = FALSE;
+	}
+	context->output->len = 0;
+	context_free(context);
+	return ok;
+}
+
+/** 出力する語と文脈の内容の表示 */
+static bool test_output(void)
+{
+	Context *context;
+	bool ok = TRUE;
+	ok &= expect_output("1 . -23 . 0 . 2147483647 1 + .",
+						"1 -23 0 -2147483648 ", -1);
+	ok &= expect_output("255 HEX . -1F . 5 2 BASE . DECIMAL 5 .",
+						"FF -1F 101 5 ", -1);
+	ok &= expect_output("72 EMIT 105 EMIT CR 33 EMIT", "Hi\n!", -1);
+	ok &= expect_output("HERE 79 , 75 , 2 TYPE HERE 0 TYPE", "OK", -1);
+	ok &= expect_output(": f 0 DO I . LOOP CR ; 3 f 2 f", "0 1 2 \n0 1 \n", -1);
+	ok &= expect_output("1 . .", "1 ", EmptyStackError);
+	ok &= expect_output("VARIABLE x ' x .", "", IllegalTypeError);
+	ok &= expect_output("VARIABLE x ' x x ! x 1 TYPE", "", IllegalTypeError);
+	ok &= expect_output("HERE 1 , 2 TYPE", "", IllegalAddressError);
+	ok &= expect_output("4 1 TYPE", "", IllegalAddressError);
+	/* バッファより長い出力はまとめて書き出される */
+	context = context_new();
+	context->output->fd = -1;  // 書き出しに失敗してもバッファは空になる
+	context->output->line_buffered = FALSE;
+	interpret(context, ": f 0 DO 1234567 . LOOP ; 10000 f");
+	if (OUTPUT_SIZE <= context->output->len) {
+		printf("output is not flushed: %zu\n", context->output->len);
+		ok = FALSE;
+	}
+	context->output->len = 0;
+	context_free(context);
+	/* 文脈の内容は基数に従って表示する */
+	context = context_new();
+	context->output->line_buffered = FALSE;
+	interpret(context, "VARIABLE x 10 ' x 255 HEX");
+	context_describe(context);
+	if (0 != strncmp("# A x FF\n", context->output->buf,
+					 context->output->len)
+		|| 9 != context->output->len) {
+		printf("context_describe: [[%.*s]]\n", (int) context->output->len,
+			   context->output->buf);
+		ok = FALSE;
+	}
+	context->output->len = 0;
+	context_free(context);
+	return ok;
+}
+
+/** メッセージを持たないエラーは確保せず、種別ごとに同じものを返す */
+/**
+ * 配列の語を、CPU が対応しているすべての実装で確かめる。要素の数は
+ * SIMD 命令の幅で割り切れないようにしてある。
+ */
+static bool test_array(void)
+{
+	static ArrayImpl const impls[] = { ARRAY_SCALAR, ARRAY_SSE41, ARRAY_AVX2 };
+	/* a[i] = 3i - 5, b[i] = i + 1 (0 <= i < 19) */
+	static char const prelude[] =
+		"19 ARRAY a 19 ARRAY b 19 ARRAY c 19 ARRAY z "
+		": fill 19 0 DO I 3 * 5 - I a A! I 1 + I b A! LOOP ; fill ";
+	static struct {
+		char const *source;
+		char const *expected;
+		int error;
+	} const cases[] = {
+		{ "a ASUM b ASUM", "418 190", -1 },
+		{ "a AMAX b AMAX z AMAX", "49 19 0", -1 },
+		{ "a b c A+ c ASUM 18 c A@", "608 68", -1 },
+		{ "a b c A- c ASUM 0 c A@", "228 -6", -1 },
+		{ "a b c A* c ASUM a b ADOT", "5890 5890", -1 },
+		{ "a b c A/ 0 c A@ 18 c A@ c ASUM", "-5 2 22", -1 },
+		{ "a a a A+ a a a A+ a ASUM", "1672", -1 },
+		{ "z b c A- c AMAX", "-1", -1 },
+		{ ": f a b ADOT b ASUM + ; f", "6080", -1 },
+		{ "a z c A/ c ASUM", "a[19] z[19] c[19] 0", DividedByZeroError },
+	};
+	char source[1024];
+	bool ok = TRUE;
+	size_t i, j;
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+		if (!array_select(impls[i])) {  // CPU が対応していない
+			continue;
+		}
+		for (j = 0; j < sizeof(cases) / sizeof(cases[0]); ++j) {
+			snprintf(source, sizeof(source), "%s%s", prelude, cases[j].source);
+			ok &= expect(source, cases[j].expected, cases[j].error);
+		}
+	}
+	array_select(ARRAY_AUTO);
+	return ok;
+}
+
+static bool test_static_error(void)
+{
+	Error *error;
+	bool ok = TRUE;
+	if (error_new(EmptyStackError, NULL) != error_new(EmptyStackError, NULL)
+		|| error_new_code(-10) != error_new(DividedByZeroError, NULL)) {
+		printf("static error is not shared\n");
+		ok = FALSE;
+	}
+	error = error_new_code(42);
+	if (ThrownError != error->type || 42 != error->code) {
+		printf("error_new_code(42): %d %d\n", error->type, error->code);
+		ok = FALSE;
+	}
+	error_free(error);
+	error = error_new(StackOverflowError, NULL);
+	error_free(error);  // 静的なエラーを解放しても壊れない
+	if (StackOverflowError != error->type || -3 != error->code) {
+		printf("static error is broken by error_free\n");
+		ok = FALSE;
+	}
+	return ok;
+}
+
+/**
+ * リターン・スタックが溢れるまで語を実行し、エラーになった後も実行を
+ * 続けられることを確かめる。
+ * \source 溢れるまで呼び出しを重ねるソース
+ * \fixed リターン・スタックを拡大できない状態にするなら TRUE
+ */
+static bool expect_rstack_overflow(char const *source, bool fixed)
+{
+	Context *context;
+	char buf[1024];
+	int error_type;
+	bool ok = TRUE;
+	context = context_new();
+	/* 固定長のスタックに見せかけて、拡大に失敗させる */
+	context->rstack->guard = fixed ? 1 : 0;
+	error_type = interpret(context, source);
+	if (StackOverflowError != error_type || 0 != context->rstack->len
+		|| FORSH_RSTACK_MAX < context->rstack->memlen) {
+		printf("[[%s]] overflowing the return stack: %d\n", source,
+			   error_type);
+		ok = FALSE;
+	}
+	context->stack->len = 0;
+	interpret(context, "1 2 +");
+	stack_str(context->stack, buf, sizeof(buf));
+	if (0 != strcmp("3", buf)) {
+		printf("[[%s]] after overflow: [[%s]]\n", source, buf);
+		ok = FALSE;
+	}
+	context->rstack->guard = 0;
+	context_free(context);
+	return ok;
+}
+
+/**
+ * リターン・スタックを拡大できない状態で CATCH を重ね、一番内側の
+ * CATCH が積めずに起こしたエラーを、その外側の CATCH が捕まえること
+ * を確かめる。
+ * \source CATCH を重ねるソース
+ * \expected 期待するスタックの内容
+ */
+static bool expect_catch_overflow(char const *source, char const *expected)
+{
+	Context *context;
+	char buf[1024];
+	int error_type;
+	bool ok = TRUE;
+	context = context_new();
+	context->rstack->guard = 1;
+	error_type = interpret(context, source);
+	stack_str(context->stack, buf, sizeof(buf));
+	if (-1 != error_type || 0 != strcmp(expected, buf)
+		|| 0 != context->rstack->len || NO_HANDLER != context->handler) {
+		printf("[[%s]] expected: [[%s]], received: [[%s]] (%d)\n",
+			   source, expected, buf, error_type);
+		ok = FALSE;
+	}
+	context->rstack->guard = 0;
+	context_free(context);
+	return ok;
+}
+
+/**
+ * リターン・スタックに積めないか、上限を超えて積もうとすれば
+ * StackOverflowError になる
+ */
+static bool test_rstack(void)
+{
+	bool ok = TRUE;
+	ok &= expect_rstack_overflow(": f DUP IF 1 - RECURSE 1 + THEN ; 100 f",
+								 TRUE);
+	ok &= expect_rstack_overflow("0 TIER-THRESHOLD : f DUP IF 1 - RECURSE 1 + "
+								 "THEN ; 100 f", TRUE);
+	ok &= expect_rstack_overflow("0 TIER-THRESHOLD : g 1 + ; : f g 1 - ; "
+								 ": h DUP IF 1 - f RECURSE 1 + THEN ; 100 h",
+								 TRUE);
+	ok &= expect_rstack_overflow(": f 1 0 DO RECURSE LOOP ; f", TRUE);
+	ok &= expect_rstack_overflow("PROFILE : f DUP IF 1 - RECURSE 1 + THEN ; "
+								 "100 f", TRUE);
+	/* 例外フレームは 3 個、戻り先は 1 個、計測中は定義と時刻も積む */
+	ok &= expect_catch_overflow(": f ; : f ' f CATCH ; f", "-3 0 0 0");
+	ok &= expect_catch_overflow("PROFILE : f ; : f ' f CATCH ; f", "-3 0");
+	/* 上限があるので、メモリーを使い尽くす前に止まる */
+	ok &= expect_rstack_overflow(": f DUP IF 1 - RECURSE 1 + THEN ; "
+								 "30000000 f", FALSE);
+	ok &= expect_rstack_overflow(": f 1 0 DO RECURSE LOOP ; f", FALSE);
+	return ok;
+}
+
+/** 語を引くだけではインターン表に登録せず、定義した名前だけを登録する */
+static bool test_lookup(void)
+{
+	static char const *const missing[] = {
+		"no-such-word-1", "no-such-word-2", "no-such-word-3",
+		"no-such-word-4", "no-such-word-5",
+	};
+	Context *context;
+	bool ok = TRUE;
+	size_t i;
+	context = context_new();
+	interpret(context, "no-such-word-1 : f no-such-word-2 ; "
+			  "' no-such-word-3 SEE no-such-word-4 VARIABLE definedword");
+	if (NULL != map_get(context->map, "no-such-word-5")) {
+		printf("lookup: map_get found an undefined word\n");
+		ok = FALSE;
+	}
+	for (i = 0; i < sizeof(missing) / sizeof(missing[0]); ++i) {
+		if (NULL != symbol_lookup(missing[i])) {
+			printf("lookup: %s was interned\n", missing[i]);
+			ok = FALSE;
+		}
+	}
+	if (NULL == symbol_lookup("definedword")) {
+		printf("lookup: definedword was not interned\n");
+		ok = FALSE;
+	}
+	context_free(context);
+	return ok;
+}
+
+/** リセットした文脈は、生成した直後の文脈と同じように解釈する */
+static bool test_reset(void)
+{
+	static char const setup[] =
+		"10000 ARRAY big HEX VARIABLE x 5 x ! 10 ARRAY a 0 TIER-THRESHOLD "
+		"2 THREADS PROFILE "
+		": sq DUP * ; : f sq sq ; 3 f : open 1";
+	Context *context;
+	char buf[1024];
+	bool ok = TRUE;
+	int i;
+	context = context_new();
+	for (i = 0; i < 3; ++i) {
+		interpret(context, setup);
+		context_reset(context);
+		if (0 != context->stack->len || NULL != context->compiling
+			|| NULL != context->definitions || context->profiling
+			|| NULL != map_get(context->map, "sq")
+			|| NULL != map_get(context->map, "x")) {
+			printf("reset: state is left over\n");
+			ok = FALSE;
+		}
+		/* 最初の大きな配列の領域は抱え続けない */
+		if (NULL != context->arena->chunks
+			&& (NULL != context->arena->chunks->next
+				|| 10000 * sizeof(int) <= context->arena->chunks->memlen)) {
+			printf("reset: arena keeps a large chunk\n");
+			ok = FALSE;
+		}
+		/* 基数とデータ空間は元に戻り、ビルトインの語は残る */
+		interpret(context, "10 HERE 2 DUP * : sq 1 + ; 4 sq x");
+		stack_str(context->stack, buf, sizeof(buf));
+		if (0 != strcmp("10 0 4 5", buf)) {
+			printf("reset expected: [[10 0 4 5]], received: [[%s]]\n", buf);
+			ok = FALSE;
+		}
+		context_reset(context);
+	}
+	/* 捨てた機械語の領域に、新しい定義を翻訳し直す */
+	interpret(context, "0 TIER-THRESHOLD : cube DUP DUP * * ; 3 cube");
+	stack_str(context->stack, buf, sizeof(buf));
+	if (0 != strcmp("27", buf)) {
+		printf("reset expected: [[27]], received: [[%s]]\n", buf);
+		ok = FALSE;
+	}
+	context_free(context);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	bool ok = TRUE;
+	/* 組み込みの語 */
+	ok &= expect("1 2 + 3 *", "9", -1);
+	ok &= expect("10 3 - 2 /", "3", -1);
+	ok &= expect("1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 + + +",
+				 "1 2 3 4 5 6 7 8 9 10 11 12 13 14 66", -1);
+	ok &= expect("1 DUP 2 SWAP OVER DROP", "1 2 1", -1);
+	ok &= expect("1 +", "1", EmptyStackError);
+	ok &= expect("1 0 /", "1 0", DividedByZeroError);
+	ok &= expect("-2147483648 -1 / 7 -1 /", "-2147483648 -7", -1);
+	ok &= expect(": f -1 / ; : g / ; -2147483648 f -2147483648 -1 g",
+				 "-2147483648 -2147483648", -1);
+	ok &= expect("0 TIER-THRESHOLD : f -1 / ; : g / ; "
+				 "-2147483648 f -2147483648 -1 g 9 -1 g",
+				 "-2147483648 -2147483648 -9", -1);
+	ok &= expect("VARIABLE x ' x 1 +", "x 1", IllegalTypeError);
+	/* 数値の基数 */
+	ok &= expect("-3 5 +", "2", -1);
+	ok &= expect("HEX ff 10 + DECIMAL 10 +", "281", -1);
+	ok &= expect("2 BASE 1010 DECIMAL", "10", -1);
+	ok &= expect("HEX : g 10 ; DECIMAL g 10", "16 10", -1);
+	ok &= expect(": g DECIMAL 10 ; HEX 10 g", "16 10", -1);
+	ok &= expect("1 BASE", "1", IllegalTypeError);
+	ok &= expect("16 : f BASE 10 ; 11", "16 10 11", IllegalDefinitionError);
+	ok &= expect("BASE", "", EmptyStackError);
+	ok &= expect("2147483648", "", IllegalDefinitionError);
+	ok &= expect("-1 TIER-THRESHOLD", "-1", IllegalTypeError);
+	/* コロン定義 */
+	ok &= expect(": sq DUP * ; 3 sq", "9", -1);
+	ok &= expect(": sq DUP * ; : cube DUP sq * ; 2 cube sq", "64", -1);
+	ok &= expect(": s2 SWAP OVER - ; 10 3 s2", "3 7", -1);
+	ok &= expect("' DUP CONSTANT v : pv v v ; pv", "DUP DUP", -1);
+	ok &= expect(": sq DUP * ; : f sq ; : sq 100 ; 3 f sq", "9 100", -1);
+	ok &= expect(": f 1 0 / ; : g 5 f ; g 7", "5 1 0 7", DividedByZeroError);
+	/* スーパー命令はまとめる前のコードと同じ結果とエラーを返す */
+	ok &= expect(": f 3 + 2 * 5 - 4 / ; 7 f", "3", -1);
+	ok &= expect(": f DUP + DUP * ; 3 f", "36", -1);
+	ok &= expect(": f OVER + OVER - ; 2 5 f", "2 5", -1);
+	ok &= expect(": f SWAP - SWAP DROP ; 1 2 10 f", "8", -1);
+	ok &= expect(": f 1 + ; f", "1", EmptyStackError);
+	ok &= expect("VARIABLE x : f 1 + ; ' x f", "x 1", IllegalTypeError);
+	ok &= expect(": f 0 / ; 5 f", "5 0", DividedByZeroError);
+	ok &= expect("VARIABLE x : f DUP * ; ' x f", "x x", IllegalTypeError);
+	ok &= expect(": f OVER - ; 1 f", "1", EmptyStackError);
+	ok &= expect("VARIABLE x : f OVER - ; ' x 1 f", "x 1 x",
+				 IllegalTypeError);
+	ok &= expect("VARIABLE x : f SWAP - ; 1 ' x f", "x 1", IllegalTypeError);
+	ok &= expect(": f SWAP DROP ; 1 f", "1", EmptyStackError);
+	ok &= expect("VARIABLE x : f ' x + ; 1 f", "1 x", IllegalTypeError);
+	ok &= expect(": f nosuchword ; 1", "1", IllegalDefinitionError);
+	ok &= expect(": f : ; 1", "1", IllegalDefinitionError);
+	/* データ空間 */
+	ok &= expect("VARIABLE x VARIABLE y x y HERE", "0 8 16", -1);
+	ok &= expect("VARIABLE x 5 x ! x @ 3 x +! x @", "5 8", -1);
+	ok &= expect("HERE 1 , 2 , 3 , DUP 2 CELLS + @ SWAP @", "3 1", -1);
+	ok &= expect("HERE 3 CELLS ALLOT 1 CELLS + @ HERE", "0 24", -1);
+	ok &= expect("1 ALLOT HERE 1 CELLS ALLOT -1 CELLS ALLOT HERE", "8 8", -1);
+	ok &= expect("42 CONSTANT k : f k 1 + ; f", "43", -1);
+	ok &= expect("VARIABLE a : f 10 a +! a @ ; f f", "10 20", -1);
+	ok &= expect("VARIABLE x ' x x ! x @", "x", -1);
+	ok &= expect("0 TIER-THRESHOLD VARIABLE x : f x ! x @ DUP * ; 3 f 4 f",
+				 "9 16", -1);
+	ok &= expect("VARIABLE x 8 @", "8", IllegalAddressError);
+	ok &= expect("VARIABLE x 4 @", "4", IllegalAddressError);
+	ok &= expect("VARIABLE x -8 @", "-8", IllegalAddressError);
+	ok &= expect("1 2 !", "1 2", IllegalAddressError);
+	ok &= expect("VARIABLE x ' x @", "x", IllegalTypeError);
+	ok &= expect("VARIABLE x ' x x ! 1 x +!", "1 0", IllegalTypeError);
+	ok &= expect("-8 ALLOT", "-8", IllegalAddressError);
+	ok &= expect("CONSTANT k", "", EmptyStackError);
+	/* 例外 */
+	ok &= expect(": f 1 2 ; ' f CATCH", "1 2 0", -1);
+	ok &= expect(": f 1 0 / ; 3 ' f CATCH", "3 -10", -1);
+	ok &= expect("1 2 ' + CATCH", "3 0", -1);
+	ok &= expect("1 ' + CATCH", "1 -4", -1);
+	ok &= expect("VARIABLE x ' x CATCH 7 CONSTANT y ' y CATCH", "0 0 7 0", -1);
+	ok &= expect(": f 42 THROW 7 ; : g ' f CATCH 1 ; g", "42 1", -1);
+	ok &= expect(": f -10 THROW ; : g ' f CATCH 100 THROW ; : h ' g CATCH ; 1 h",
+				 "1 100", -1);
+	ok &= expect(": f 1 0 THROW 2 ; f", "1 2", -1);
+	ok &= expect(": f 42 THROW ; f 5", "5", ThrownError);
+	ok &= expect("-4 THROW 1", "1", EmptyStackError);
+	ok &= expect("1 CATCH", "1", IllegalTypeError);
+	ok &= expect("' nosuchword 1", "1", IllegalDefinitionError);
+	ok &= expect(": f ' nosuchword ; 1", "1", IllegalDefinitionError);
+	ok &= expect("0 TIER-THRESHOLD : f 1 0 / ; : g 5 ' f CATCH ; g g",
+				 "5 -10 5 -10", -1);
+	ok &= expect("PROFILE : f 1 ; : g ' f CATCH ; ' f CATCH g", "1 0 1 0", -1);
+	/* 制御構造 */
+	ok &= expect(": f IF 1 ELSE 2 THEN ; 5 f 0 f", "1 2", -1);
+	ok &= expect(": f DUP IF 1 + THEN 3 ; 0 f 4 f", "0 3 5 3", -1);
+	ok &= expect(": f IF IF 1 ELSE 2 THEN ELSE 3 THEN ; 1 1 f 0 1 f 1 0 f",
+				 "1 2 1 3", -1);
+	ok &= expect(": f BEGIN DUP 1 - DUP IF 0 ELSE 1 THEN UNTIL ; 3 f", "3 2 1 0", -1);
+	ok &= expect(": f 0 SWAP 0 DO I + LOOP ; 5 f", "10", -1);
+	ok &= expect(": f 3 0 DO 2 0 DO J 10 * I + LOOP LOOP ; f",
+				 "0 1 10 11 20 21", -1);
+	ok &= expect(": f DUP IF 1 - RECURSE THEN ; 1000000 f 7", "0 7", -1);
+	ok &= expect(": g 1 + ; : f 2 * g ; 3 f", "7", -1);
+	ok &= expect("0 TIER-THRESHOLD : f DUP IF 1 + THEN 3 + ; 0 f 4 f", "3 8",
+				 -1);
+	ok &= expect("0 TIER-THRESHOLD : f 0 SWAP 0 DO I + LOOP ; 5 f 3 f",
+				 "10 3", -1);
+	ok &= expect(": f IF 1 0 / THEN 2 ; 3 1 f", "3 1 0", DividedByZeroError);
+	ok &= expect(": f 1 0 DO 1 0 / LOOP ; : g ' f CATCH ; g 2", "-10 2", -1);
+	ok &= expect(": f IF 1 ; 2", "2", IllegalDefinitionError);
+	ok &= expect(": f 1 THEN ; 2", "2", IllegalDefinitionError);
+	ok &= expect(": f BEGIN 1 LOOP ; 2", "2", IllegalDefinitionError);
+	ok &= expect(": f 1 IF ELSE ELSE THEN ; 2", "2", IllegalDefinitionError);
+	ok &= expect(": f I ; : g 1 0 DO J LOOP ; 2", "2", IllegalDefinitionError);
+	ok &= expect("VARIABLE x : f 1 ' x DO LOOP ; f", "1 x", IllegalTypeError);
+	/* タスク */
+	ok &= expect(": g 1 + ; : f 1 ' g SPAWN JOIN 2 * ; 5 1 ' f SPAWN JOIN",
+				 "12", -1);
+	ok &= expect("3 4 2 ' * SPAWN 5 1 ' DUP SPAWN SWAP JOIN SWAP JOIN",
+				 "12 5 5", -1);
+	ok &= expect(": fib DUP IF DUP 1 - IF DUP 1 - RECURSE SWAP 2 - RECURSE + "
+				 "THEN THEN ; 20 1 ' fib SPAWN 10 1 ' fib SPAWN JOIN SWAP JOIN",
+				 "55 6765", -1);
+	ok &= expect(": g 1 ; : f 0 ' g SPAWN DROP 2 ; 0 ' f SPAWN JOIN", "2", -1);
+	ok &= expect(": g 1 ; 0 ' g SPAWN : h 2 ; JOIN h", "1 2", -1);
+	ok &= expect("1 1 ' DUP SPAWN DROP 7", "7", -1);
+	ok &= expect(": f 1 0 / ; 1 0 ' f SPAWN JOIN", "1", DividedByZeroError);
+	ok &= expect(": f 1 0 / ; : g 0 ' f SPAWN JOIN ; ' g CATCH", "-10", -1);
+	ok &= expect(": f 1 ALLOT ; 0 ' f SPAWN JOIN", "", IllegalAddressError);
+	ok &= expect("0 ' DUP SPAWN JOIN", "", EmptyStackError);
+	ok &= expect("1 5 ' + SPAWN", "1 5 +", EmptyStackError);
+	ok &= expect("1 2 SPAWN", "1 2", IllegalTypeError);
+	ok &= expect("5 JOIN", "5", IllegalTypeError);
+	ok &= expect("0 ' DUP SPAWN JOIN 0 JOIN", "0", IllegalTypeError);
+	/* 配列 */
+	ok &= expect("4 ARRAY a a ALEN a", "4 a[4]", -1);
+	ok &= expect("3 ARRAY a 7 1 a A! 1 a A@ 0 a A@", "7 0", -1);
+	ok &= expect("3 ARRAY a : f 2 a A! ; 9 f 2 a A@ a ASUM", "9 9", -1);
+	ok &= expect("1 ARRAY a 2147483647 0 a A! a a a A+ 0 a A@", "-2", -1);
+	ok &= expect("3 ARRAY a 3 a A@", "3 a[3]", IllegalAddressError);
+	ok &= expect("3 ARRAY a 1 -1 a A!", "1 -1 a[3]", IllegalAddressError);
+	ok &= expect("3 ARRAY a ' a 0 a A!", "a 0 a[3]", IllegalTypeError);
+	ok &= expect("3 ARRAY a 4 ARRAY b a b a A+", "a[3] b[4] a[3]",
+				 IllegalAddressError);
+	ok &= expect("0 ARRAY e e ASUM e AMAX", "0 e[0]", IllegalAddressError);
+	ok &= expect("1 2 3 A+", "1 2 3", IllegalTypeError);
+	ok &= expect("ASUM", "", EmptyStackError);
+	ok &= expect("-1 ARRAY a", "-1", IllegalTypeError);
+	ok &= expect("ARRAY a", "", EmptyStackError);
+	ok &= test_array();
+	/* 配列の並列計算 (10000 要素は複数の塊になる) */
+	ok &= expect("5 ARRAY a : fill 5 0 DO I 1 + I a A! LOOP ; fill "
+				 ": sq DUP * ; a a ' sq PMAP a ASUM a 100 ' + PREDUCE",
+				 "55 155", -1);
+	ok &= expect("10000 ARRAY a : fill 10000 0 DO I I a A! LOOP ; fill "
+				 ": inc 1 + ; a a ' inc PMAP a ASUM a 0 ' + PREDUCE",
+				 "50005000 50005000", -1);
+	ok &= expect("10000 ARRAY a : fill 10000 0 DO I 2 * 1 + I a A! LOOP ; "
+				 "fill : serial 1 10000 0 DO I a A@ * LOOP ; serial "
+				 "a 1 ' * PREDUCE 1 THREADS a 1 ' * PREDUCE "
+				 "3 THREADS a 1 ' * PREDUCE",
+				 "995660577 995660577 995660577 995660577", -1);
+	ok &= expect("10000 ARRAY a : fill 10000 0 DO I I a A! LOOP ; fill "
+				 ": last SWAP DROP ; : first DROP ; "
+				 "a 7 ' last PREDUCE a 7 ' first PREDUCE", "9999 7", -1);
+	ok &= expect("0 ARRAY e e 7 ' + PREDUCE e e ' DUP PMAP", "7", -1);
+	ok &= expect("9000 ARRAY a : bad DROP 1 0 / ; a a ' bad PMAP",
+				 "a[9000] a[9000] bad", DividedByZeroError);
+	ok &= expect("9000 ARRAY a : bad 1 0 / ; : g a 0 ' bad PREDUCE ; "
+				 "' g CATCH", "-10", -1);
+	ok &= expect("3 ARRAY a a a ' DUP PMAP", "a[3] a[3] DUP",
+				 IllegalTypeError);
+	ok &= expect("3 ARRAY a a a ' DROP PMAP", "a[3] a[3] DROP",
+				 EmptyStackError);
+	ok &= expect("3 ARRAY a 4 ARRAY b a b ' DUP PMAP", "a[3] b[4] DUP",
+				 IllegalAddressError);
+	ok &= expect("3 ARRAY a a a 1 PMAP 1 2 ' + PREDUCE",
+				 "a[3] a[3] 1 1 2 +", IllegalTypeError);
+	ok &= expect("-1 THREADS", "-1", IllegalTypeError);
+	ok &= test_static_error();
+	ok &= test_reset();
+	ok &= test_lookup();
+	ok &= test_rstack();
+	ok &= test_output();
+	ok &= test_profile();
+	ok &= test_tier();
+	ok &= test_effect();
+	ok &= test_guard();
+	if (ok) {
+		puts("OK");
+	}
+	return ok ? 0 : 1;
+}
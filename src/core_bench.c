@@ -0,0 +1,1193 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * インタープリターの中核部分のマイクロ・ベンチマーク。結果は一件ごと
+ * に一行の JSON として標準出力に書き出すので、版ごとの結果を機械的に
+ * 比べられる。
+ *
+ *   {"name": "map_get/1024", "ops": 4194304, "ns_per_op": 3.21,
+ *    "allocs_per_op": 0.000}
+ *
+ * 入力の大きさが決まっているもの (字句解析) は、"mb_per_s" も加える。
+ *
+ * 引数を与えると、名前がそのいずれかで始まるものだけを実行する。
+ */
+
+#include "forsh.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+/** 計測を繰り返す回数。最も速かった回を採る */
+static int const ROUNDS = 5;
+
+/** ベンチマーク */
+typedef struct _Bench Bench;
+struct _Bench {
+	char const *name;         /* 名前 */
+	size_t ops;               /* 一回の計測で行う操作の数 */
+	void (*setup)(size_t);    /* 準備 (計測しない)。NULL でもよい */
+	void (*run)(size_t);      /* 計測する処理 */
+	void (*teardown)(void);   /* 後始末 (計測しない)。NULL でもよい */
+};
+
+/** これまでにメモリを確保した回数。複数のスレッドから数える */
+static size_t allocations;
+
+#ifdef __GLIBC__
+/*
+ * glibc では malloc などを差し替えて確保の回数を数える。libc 内部から
+ * の呼び出し (strndup など) も数えられる。
+ */
+#define COUNT_ALLOCATIONS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+	__libc_free(p);
+}
+#endif
+
+/** 現在の時刻を秒で返す */
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** 計測中の処理が最適化で消えないように結果を書き込む先 */
+static volatile intptr_t sink;
+
+/** 一回の計測で処理するバイト数。0 なら報告しない */
+static size_t bench_bytes;
+
+/* map */
+
+/** マップに入れるキーの最大数 */
+#define MAP_MAX_KEYS 65536
+
+/** 計測に用いるキー */
+static Symbol const *map_keys[MAP_MAX_KEYS];
+/** 計測に用いるマップ */
+static Map *bench_map;
+
+/** キーを n 個用意する */
+static void map_setup_keys(size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "key%lu", (unsigned long) i);
+		map_keys[i] = symbol_intern(name);
+	}
+}
+
+/** 空のマップに n 個のキーを加える */
+static void map_put_run(size_t ops, size_t n)
+{
+	size_t i, j;
+	for (i = 0; i < ops; i += n) {
+		Map *map;
+		map = map_new(arena_nofree);
+		for (j = 0; j < n; ++j) {
+			map_put_symbol(map, map_keys[j], (void *) map_keys[j]);
+		}
+		map_free(map);
+	}
+}
+
+/** キーを最大数だけ用意する */
+static void map_put_setup(size_t ops)
+{
+	map_setup_keys(MAP_MAX_KEYS);
+}
+
+static void map_put_run_16(size_t ops) { map_put_run(ops, 16); }
+static void map_put_run_1024(size_t ops) { map_put_run(ops, 1024); }
+static void map_put_run_65536(size_t ops) { map_put_run(ops, 65536); }
+
+/** n 個のキーを持つマップを作る */
+static void map_get_setup(size_t n)
+{
+	size_t i;
+	map_setup_keys(n);
+	bench_map = map_new(arena_nofree);
+	for (i = 0; i < n; ++i) {
+		map_put_symbol(bench_map, map_keys[i], (void *) map_keys[i]);
+	}
+}
+
+static void map_get_setup_16(size_t ops) { map_get_setup(16); }
+static void map_get_setup_1024(size_t ops) { map_get_setup(1024); }
+static void map_get_setup_65536(size_t ops) { map_get_setup(65536); }
+
+/** n 個のキーを順に引く */
+static void map_get_run(size_t ops, size_t n)
+{
+	size_t i;
+	intptr_t sum = 0;
+	for (i = 0; i < ops; ++i) {
+		sum += (intptr_t) map_get_symbol(bench_map, map_keys[i & (n - 1)]);
+	}
+	sink = sum;
+}
+
+static void map_get_run_16(size_t ops) { map_get_run(ops, 16); }
+static void map_get_run_1024(size_t ops) { map_get_run(ops, 1024); }
+static void map_get_run_65536(size_t ops) { map_get_run(ops, 65536); }
+
+/** 文字列のキーで引く (インターンを含む) */
+static void map_get_str_run(size_t ops)
+{
+	static char const *const names[] = { "key1", "key7", "key15", "nokey" };
+	size_t i;
+	intptr_t sum = 0;
+	for (i = 0; i < ops; ++i) {
+		sum += (intptr_t) map_get(bench_map, names[i & 3]);
+	}
+	sink = sum;
+}
+
+static void map_teardown(void)
+{
+	map_free(bench_map);
+	bench_map = NULL;
+}
+
+/* stack */
+
+/** 計測に用いるスタック */
+static Stack *bench_stack;
+
+static void stack_setup(size_t ops)
+{
+	bench_stack = stack_new();
+}
+
+/** 1024 個ずつ積んでは下ろす */
+static void stack_push_pop_run(size_t ops)
+{
+	size_t i, j;
+	Cell cell;
+	intptr_t sum = 0;
+	for (i = 0; i < ops; i += 1024) {
+		for (j = 0; j < 1024; ++j) {
+			stack_push(bench_stack, cell_from_integer(j));
+		}
+		for (j = 0; j < 1024; ++j) {
+			stack_pop(bench_stack, &cell);
+			sum += cell;
+		}
+	}
+	sink = sum;
+}
+
+static void stack_teardown(void)
+{
+	stack_free(bench_stack);
+	bench_stack = NULL;
+}
+
+/* output */
+
+/** 計測に用いる出力。/dev/null に書き出す */
+static Output *bench_output;
+
+static void output_setup(size_t ops)
+{
+	bench_output = output_new(open("/dev/null", O_WRONLY));
+}
+
+/** 整数を十進数で出力する (.) */
+static void output_integer_run(size_t ops)
+{
+	size_t i;
+	for (i = 0; i < ops; ++i) {
+		output_integer(bench_output, (int) (i * 2654435761u), 10);
+		output_char(bench_output, ' ');
+	}
+}
+
+static void output_teardown(void)
+{
+	int fd;
+	fd = bench_output->fd;
+	output_free(bench_output);
+	close(fd);
+	bench_output = NULL;
+}
+
+/* context */
+
+/** 計測に用いる文脈 */
+static Context *bench_context;
+
+/**
+ * トークンを解釈する。エラーは起きないものとする。
+ * \token トークン
+ */
+static void interpret(char const *token)
+{
+	Error *error;
+	error = context_interpret(bench_context, token);
+	if (NULL != error) {
+		error_free(error);
+	}
+}
+
+static void context_setup(size_t ops)
+{
+	bench_context = context_new();
+	interpret("1");
+}
+
+/** 整数のトークンを解釈する */
+static void context_integer_run(size_t ops)
+{
+	static char const *const tokens[] = { "1", "42", "12345", "-7" };
+	size_t i;
+	for (i = 0; i < ops; ++i) {
+		context_interpret_n(bench_context, tokens[i & 3],
+							strlen(tokens[i & 3]));
+		if (0 == (i & 1023)) {  // スタックが伸び続けないように空ける
+			bench_context->stack->len = 1;
+		}
+	}
+}
+
+/** ビルトイン関数のトークンを解釈する */
+static void context_builtin_run(size_t ops)
+{
+	size_t i;
+	for (i = 0; i < ops; i += 2) {
+		interpret("DUP");
+		interpret("DROP");
+	}
+}
+
+static void context_teardown(void)
+{
+	context_free(bench_context);
+	bench_context = NULL;
+}
+
+/** 計算の核となる語を bench_context に定義する */
+static void vm_kernel_define(void)
+{
+	static char const *const source[] = {
+		":", "sq", "DUP", "*", ";",
+		":", "poly", "DUP", "sq", "SWAP", "3", "*", "+", "1", "+", ";",
+		":", "k", "poly", "7", "/", "poly", "1000", "/", "poly", "13", "-",
+		"5", "/", ";",
+		":", "kernel", "1", "k", "2", "k", "+", "3", "k", "-", "4", "k",
+		"OVER", "OVER", "*", "SWAP", "DROP", "+", ";",
+	};
+	size_t i;
+	for (i = 0; i < sizeof(source) / sizeof(source[0]); ++i) {
+		interpret(source[i]);
+	}
+}
+
+/** 計算の核となる語を定義する */
+static void vm_kernel_setup(size_t ops)
+{
+	bench_context = context_new();
+	vm_kernel_define();
+}
+
+/** ガード・ページで挟んだスタックで、計算の核となる語を定義する */
+static void vm_guarded_setup(size_t ops)
+{
+	bench_context = context_new_guarded(1 << 16);
+	vm_kernel_define();
+}
+
+/** JIT を使わずに、最適化した計算の核となる語を定義する */
+static void vm_threaded_setup(size_t ops)
+{
+	bench_context = context_new();
+	if (NULL != bench_context->jit) {
+		jit_free(bench_context->jit);
+		bench_context->jit = NULL;
+	}
+	bench_context->tier_threshold = 0;
+	vm_kernel_define();
+}
+
+/** 例外を投げる語を CATCH する語を kernel として定義する */
+static void vm_catch_setup(size_t ops)
+{
+	static char const *const source[] = {
+		":", "t", "1", "0", "/", ";",
+		":", "u", "42", "THROW", ";",
+		":", "kernel", "'", "t", "CATCH", "'", "u", "CATCH", "+", "DROP", ";",
+	};
+	size_t i;
+	bench_context = context_new();
+	bench_context->tier_threshold = 0;
+	for (i = 0; i < sizeof(source) / sizeof(source[0]); ++i) {
+		interpret(source[i]);
+	}
+}
+
+/** 百回まわる DO ... LOOP と末尾呼び出しを含む語を kernel として定義する */
+static void vm_loop_setup(size_t ops)
+{
+	static char const *const source[] = {
+		":", "step", "DUP", "*", "+", ";",
+		":", "sum", "0", "100", "0", "DO", "I", "step", "LOOP", ";",
+		":", "finish", "DROP", ";",
+		":", "kernel", "sum", "finish", ";",
+	};
+	size_t i;
+	bench_context = context_new();
+	bench_context->tier_threshold = 0;
+	for (i = 0; i < sizeof(source) / sizeof(source[0]); ++i) {
+		interpret(source[i]);
+	}
+}
+
+/** 定義した語を実行する */
+static void vm_kernel_run(size_t ops)
+{
+	Definition const *kernel;
+	size_t i;
+	kernel = value_definition(map_get(bench_context->map, "kernel"));
+	for (i = 0; i < ops; ++i) {
+		Error *error;
+		error = vm_execute(bench_context, kernel);
+		if (NULL != error) {
+			error_free(error);
+		}
+		bench_context->stack->len = 0;
+	}
+}
+
+/* parallel */
+
+/** 並列に動かすスレッドの最大数 */
+#define PARALLEL_MAX 8
+
+/** スレッドごとの文脈 */
+static Context *parallel_contexts[PARALLEL_MAX];
+/** 動かすスレッドの数 */
+static size_t parallel_threads;
+/** 一つのスレッドが解釈するトークンの数 */
+static size_t parallel_ops;
+
+/** スレッドごとに文脈を作り、計算の核となる語を定義する */
+static void parallel_setup(size_t ops, size_t threads)
+{
+	size_t i;
+	parallel_threads = threads;
+	parallel_ops = ops / threads;
+	for (i = 0; i < threads; ++i) {
+		bench_context = context_new();
+		vm_kernel_define();
+		parallel_contexts[i] = bench_context;
+	}
+	bench_context = NULL;
+}
+
+static void parallel_setup_1(size_t ops) { parallel_setup(ops, 1); }
+static void parallel_setup_2(size_t ops) { parallel_setup(ops, 2); }
+static void parallel_setup_4(size_t ops) { parallel_setup(ops, 4); }
+static void parallel_setup_8(size_t ops) { parallel_setup(ops, 8); }
+
+/**
+ * 一つの文脈でトークンを解釈し続ける。ビルトインの語は共有するシンボ
+ * ル・テーブルから引く。
+ * \arg 文脈
+ */
+static void *parallel_worker(void *arg)
+{
+	static char const *const tokens[] = { "kernel", "3", "DUP", "*", "DROP" };
+	Context *context;
+	size_t i;
+	context = (Context *) arg;
+	for (i = 0; i < parallel_ops; ++i) {
+		Error *error;
+		error = context_interpret(context, tokens[i % 5]);
+		if (NULL != error) {
+			error_free(error);
+		}
+		if (0 == (i & 1023)) {  // スタックが伸び続けないように空ける
+			context->stack->len = 0;
+		}
+	}
+	return NULL;
+}
+
+/** スレッドごとの文脈で同時に解釈する。スレッドの数に比例して速くなるはず */
+static void parallel_run(size_t ops)
+{
+	pthread_t threads[PARALLEL_MAX];
+	size_t i;
+	for (i = 0; i < parallel_threads; ++i) {
+		pthread_create(&threads[i], NULL, parallel_worker,
+					   parallel_contexts[i]);
+	}
+	for (i = 0; i < parallel_threads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+static void parallel_teardown(void)
+{
+	size_t i;
+	for (i = 0; i < parallel_threads; ++i) {
+		context_free(parallel_contexts[i]);
+		parallel_contexts[i] = NULL;
+	}
+}
+
+/* request */
+
+/** 要求ごとに解釈する短いスクリプト */
+static char const REQUEST_SCRIPT[] =
+	"VARIABLE hits 1 hits +! : sq DUP * ; 12 sq hits @ + DROP";
+
+/** 要求に使う文脈のプール */
+static ContextPool *request_pool;
+
+/**
+ * 要求のスクリプトを文脈に解釈させる。
+ * \context 文脈
+ */
+static void request_eval(Context *context)
+{
+	Lexer lexer;
+	char const *token;
+	size_t len;
+	lexer_init(&lexer, REQUEST_SCRIPT, sizeof(REQUEST_SCRIPT) - 1);
+	while (lexer_next(&lexer, &token, &len)) {
+		Error *error;
+		error = context_interpret_n(context, token, len);
+		if (NULL != error) {
+			error_free(error);
+		}
+	}
+}
+
+/** 要求ごとに文脈を生成して解放する */
+static void request_new_run(size_t ops)
+{
+	size_t i;
+	for (i = 0; i < ops; ++i) {
+		Context *context;
+		context = context_new();
+		request_eval(context);
+		context_free(context);
+	}
+}
+
+static void request_pool_setup(size_t ops)
+{
+	request_pool = context_pool_new(1);
+}
+
+/** 要求ごとにプールから文脈を借りて返す */
+static void request_pool_run(size_t ops)
+{
+	size_t i;
+	for (i = 0; i < ops; ++i) {
+		Context *context;
+		context = context_pool_acquire(request_pool);
+		request_eval(context);
+		context_pool_release(request_pool, context);
+	}
+}
+
+static void request_pool_teardown(void)
+{
+	context_pool_free(request_pool);
+	request_pool = NULL;
+}
+
+/* array */
+
+/** 配列の要素の数 (三つの配列が L2 キャッシュに収まる大きさ) */
+#define ARRAY_BENCH_LEN 16384
+
+/**
+ * 配列 a, b, c を定義して埋め、kernel を定義する。
+ * \impl 配列の語の実装
+ * \kernel kernel の本体
+ */
+static void array_setup(ArrayImpl impl, char const *kernel)
+{
+	static char const *const names[] = { "a", "b", "c" };
+	char n[16];
+	Lexer lexer;
+	char const *token;
+	size_t len, i, j;
+	bench_context = context_new();
+	snprintf(n, sizeof(n), "%d", ARRAY_BENCH_LEN);
+	for (i = 0; i < 3; ++i) {
+		Array *array;
+		interpret(n);
+		interpret("ARRAY");
+		interpret(names[i]);
+		array = value_array(map_get(bench_context->map, names[i]));
+		for (j = 0; j < array->len; ++j) {
+			array->values[j] = (int) (j * 7 + i) % 1000 + 1;
+		}
+	}
+	interpret(":");
+	interpret("kernel");
+	lexer_init(&lexer, kernel, strlen(kernel));
+	while (lexer_next(&lexer, &token, &len)) {
+		context_interpret_n(bench_context, token, len);
+	}
+	interpret(";");
+	if (!array_select(impl)) {  // CPU が対応していなければ何もしない
+		interpret(":");
+		interpret("kernel");
+		interpret(";");
+	}
+}
+
+static void array_sum_setup_scalar(size_t ops)
+{
+	array_setup(ARRAY_SCALAR, "a ASUM DROP");
+}
+
+static void array_sum_setup_sse41(size_t ops)
+{
+	array_setup(ARRAY_SSE41, "a ASUM DROP");
+}
+
+static void array_sum_setup_avx2(size_t ops)
+{
+	array_setup(ARRAY_AVX2, "a ASUM DROP");
+}
+
+/** 比べるために、一要素ずつ A@ で読んで足す */
+static void array_sum_setup_loop(size_t ops)
+{
+	char kernel[128];
+	snprintf(kernel, sizeof(kernel), "0 %d 0 DO I a A@ + LOOP DROP",
+			 ARRAY_BENCH_LEN);
+	array_setup(ARRAY_AUTO, kernel);
+}
+
+static void array_add_setup_scalar(size_t ops)
+{
+	array_setup(ARRAY_SCALAR, "a b c A+");
+}
+
+static void array_add_setup_sse41(size_t ops)
+{
+	array_setup(ARRAY_SSE41, "a b c A+");
+}
+
+static void array_add_setup_avx2(size_t ops)
+{
+	array_setup(ARRAY_AVX2, "a b c A+");
+}
+
+static void array_dot_setup_scalar(size_t ops)
+{
+	array_setup(ARRAY_SCALAR, "a b ADOT DROP");
+}
+
+static void array_dot_setup_avx2(size_t ops)
+{
+	array_setup(ARRAY_AVX2, "a b ADOT DROP");
+}
+
+static void array_divide_setup(size_t ops)
+{
+	array_setup(ARRAY_AUTO, "a b c A/");
+}
+
+static void array_teardown(void)
+{
+	array_select(ARRAY_AUTO);
+	context_teardown();
+}
+
+/** PMAP と PREDUCE で計算する配列の要素の数 */
+#define PARALLEL_ARRAY_LEN 10000000
+
+/**
+ * 大きな配列 a を定義して埋め、スレッドの数を設定して kernel を定義す
+ * る。
+ * \threads THREADS に設定する値
+ * \kernel kernel の本体
+ */
+static void parallel_array_setup(int threads, char const *kernel)
+{
+	char n[16];
+	Lexer lexer;
+	char const *token;
+	Array *array;
+	size_t len, i;
+	bench_context = context_new();
+	snprintf(n, sizeof(n), "%d", PARALLEL_ARRAY_LEN);
+	interpret(n);
+	interpret("ARRAY");
+	interpret("a");
+	array = value_array(map_get(bench_context->map, "a"));
+	for (i = 0; i < array->len; ++i) {
+		array->values[i] = (int) (i % 1000);
+	}
+	snprintf(n, sizeof(n), "%d", threads);
+	interpret(n);
+	interpret("THREADS");
+	lexer_init(&lexer, kernel, strlen(kernel));
+	while (lexer_next(&lexer, &token, &len)) {
+		context_interpret_n(bench_context, token, len);
+	}
+}
+
+/** 要素ごとに実行する語と、それを PMAP する kernel */
+#define PMAP_KERNEL ": f DUP * 3 + ; : kernel a a ' f PMAP ;"
+
+/** 要素を足し合わせる語と、それで PREDUCE する kernel */
+#define PREDUCE_KERNEL ": f DUP * + ; : kernel a 0 ' f PREDUCE DROP ;"
+
+static void pmap_setup_1(size_t ops) { parallel_array_setup(1, PMAP_KERNEL); }
+static void pmap_setup_2(size_t ops) { parallel_array_setup(2, PMAP_KERNEL); }
+static void pmap_setup_4(size_t ops) { parallel_array_setup(4, PMAP_KERNEL); }
+static void pmap_setup_8(size_t ops) { parallel_array_setup(8, PMAP_KERNEL); }
+
+static void preduce_setup_1(size_t ops)
+{
+	parallel_array_setup(1, PREDUCE_KERNEL);
+}
+
+static void preduce_setup_2(size_t ops)
+{
+	parallel_array_setup(2, PREDUCE_KERNEL);
+}
+
+static void preduce_setup_4(size_t ops)
+{
+	parallel_array_setup(4, PREDUCE_KERNEL);
+}
+
+static void preduce_setup_8(size_t ops)
+{
+	parallel_array_setup(8, PREDUCE_KERNEL);
+}
+
+/* task */
+
+/** 並列に計算するフィボナッチ数の引数 */
+#define TASK_FIB 25
+
+/** SPAWN するタスクの数 */
+#define TASK_LEAVES 16
+
+/** 二重再帰でフィボナッチ数を求める fib を定義する */
+static void task_fib_define(void)
+{
+	static char const *const source[] = {
+		":", "fib", "DUP", "IF", "DUP", "1", "-", "IF",
+		"DUP", "1", "-", "RECURSE", "SWAP", "2", "-", "RECURSE", "+",
+		"THEN", "THEN", ";",
+	};
+	size_t i;
+	bench_context = context_new();
+	for (i = 0; i < sizeof(source) / sizeof(source[0]); ++i) {
+		interpret(source[i]);
+	}
+}
+
+/** fib を一つの文脈で計算する語を kernel として定義する */
+static void task_serial_setup(size_t ops)
+{
+	char n[16];
+	task_fib_define();
+	snprintf(n, sizeof(n), "%d", TASK_FIB);
+	interpret(":");
+	interpret("kernel");
+	interpret(n);
+	interpret("fib");
+	interpret(";");
+}
+
+/**
+ * fib の再帰を TASK_LEAVES 個の葉まで展開し、葉ごとに SPAWN して JOIN
+ * した結果を足す語を kernel として定義する。比較の語がないので、分割
+ * は定義の外で行う。
+ */
+static void task_spawn_setup(size_t ops)
+{
+	int leaves[TASK_LEAVES];
+	char n[16];
+	size_t len, i;
+	task_fib_define();
+	leaves[0] = TASK_FIB;
+	for (len = 1; len < TASK_LEAVES; len += 1) {  // 最も大きい葉を分ける
+		size_t max = 0;
+		for (i = 1; i < len; ++i) {
+			if (leaves[max] < leaves[i]) {
+				max = i;
+			}
+		}
+		leaves[len] = leaves[max] - 2;
+		leaves[max] -= 1;
+	}
+	interpret(":");
+	interpret("kernel");
+	for (i = 0; i < TASK_LEAVES; ++i) {
+		snprintf(n, sizeof(n), "%d", leaves[i]);
+		interpret(n);
+		interpret("1");
+		interpret("'");
+		interpret("fib");
+		interpret("SPAWN");
+	}
+	interpret("JOIN");
+	for (i = 1; i < TASK_LEAVES; ++i) {
+		interpret("SWAP");
+		interpret("JOIN");
+		interpret("+");
+	}
+	interpret(";");
+}
+
+/* script */
+
+/** 計測に用いるスクリプト */
+static char *script;
+/** スクリプトの長さ */
+static size_t script_len;
+
+/**
+ * 前置きの後に本体を繰り返したスクリプトを作る。
+ * \prelude 前置き
+ * \body 繰り返す本体
+ * \count 繰り返す回数
+ */
+static void make_script(char const *prelude, char const *body, size_t count)
+{
+	size_t i, len;
+	len = strlen(body);
+	script_len = strlen(prelude) + len * count;
+	script = (char *) malloc(script_len + 1);
+	strcpy(script, prelude);
+	for (i = 0; i < count; ++i) {
+		memcpy(&script[strlen(prelude) + len * i], body, len);
+	}
+	script[script_len] = '\0';
+}
+
+/** 一回の計測でスクリプトの本体を繰り返す回数 */
+#define SCRIPT_REPEAT 100000
+
+/** 整数の演算だけのスクリプト。本体は 13 トークン */
+static void script_arith_setup(size_t ops)
+{
+	make_script("", "1 2 + 3 * 4 - 5 SWAP OVER * + DROP\n", SCRIPT_REPEAT);
+}
+
+/** コロン定義を呼び出すスクリプト。本体は 4 トークン */
+static void script_colon_setup(size_t ops)
+{
+	make_script(": sq DUP * ; : poly DUP sq SWAP 3 * + 1 + ; "
+				": f poly poly 1000 / poly DROP ;\n",
+				"2 f 3 f\n", SCRIPT_REPEAT);
+}
+
+/** スクリプトを字句解析しながら新しい文脈で解釈する */
+static void script_run(size_t ops)
+{
+	Lexer lexer;
+	char const *token;
+	size_t len;
+	bench_context = context_new();
+	lexer_init(&lexer, script, script_len);
+	while (lexer_next(&lexer, &token, &len)) {
+		Error *error;
+		error = context_interpret_n(bench_context, token, len);
+		if (NULL != error) {
+			error_free(error);
+		}
+	}
+	context_free(bench_context);
+	bench_context = NULL;
+}
+
+static void script_teardown(void)
+{
+	free(script);
+	script = NULL;
+}
+
+/* lexer */
+
+/** 字句解析する入力の大きさ */
+#define LEXER_INPUT_SIZE (16 * 1024 * 1024)
+
+/** 入力のトークンの数 */
+static size_t lexer_tokens;
+
+/** strsep が書き換える入力の複製 */
+static char *lexer_copy;
+
+/** スクリプトらしい入力を作る */
+static void lexer_setup(size_t ops)
+{
+	static char const *const words[] = {
+		"1", "2", "+", "DUP", "*", "12345", "OVER", "-", "SWAP",
+		"DROP", "VARIABLE", "counter", ":", "square", ";", "\n", "\r\n",
+	};
+	size_t len = 0;
+	script = (char *) malloc(LEXER_INPUT_SIZE);
+	srand(1);
+	while (TRUE) {
+		char const *word;
+		size_t n;
+		word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+		n = strlen(word);
+		if (LEXER_INPUT_SIZE < len + n + 1) {
+			break;
+		}
+		memcpy(&script[len], word, n);
+		len += n;
+		script[len++] = ' ';
+	}
+	memset(&script[len], ' ', LEXER_INPUT_SIZE - len);
+	script_len = LEXER_INPUT_SIZE;
+	bench_bytes = LEXER_INPUT_SIZE;
+}
+
+/** 入力をトークンに区切る */
+static void lexer_run(size_t ops)
+{
+	Lexer lexer;
+	char const *token;
+	size_t len;
+	size_t n = 0;
+	lexer_init(&lexer, script, script_len);
+	while (lexer_next(&lexer, &token, &len)) {
+		++n;
+	}
+	lexer_tokens = n;
+}
+
+/**
+ * strsep はバッファを書き換えるので、複製しておく (複製する時間は計ら
+ * ない)
+ */
+static void lexer_setup_strsep(size_t ops)
+{
+	lexer_setup(ops);
+	lexer_copy = (char *) malloc(script_len + 1);
+	memcpy(lexer_copy, script, script_len);
+	lexer_copy[script_len] = '\0';
+}
+
+/** 字句解析器の前に main.c が使っていた strsep で区切る */
+static void lexer_strsep_run(size_t ops)
+{
+	char *copy = lexer_copy;
+	char *token;
+	size_t n = 0;
+	while (NULL != (token = strsep(&copy, " \n"))) {
+		if ('\0' != *token) {
+			++n;
+		}
+	}
+	lexer_tokens = n;
+}
+
+static void lexer_teardown_strsep(void)
+{
+	free(lexer_copy);
+	lexer_copy = NULL;
+	script_teardown();
+}
+
+static void lexer_setup_scalar(size_t ops)
+{
+	lexer_select(LEXER_SCALAR);
+	lexer_setup(ops);
+}
+
+static void lexer_setup_sse2(size_t ops)
+{
+	lexer_setup(ops);
+	if (!lexer_select(LEXER_SSE2)) {
+		script_len = 0;
+	}
+}
+
+static void lexer_setup_avx2(size_t ops)
+{
+	lexer_setup(ops);
+	if (!lexer_select(LEXER_AVX2)) {
+		script_len = 0;
+	}
+}
+
+static void lexer_teardown(void)
+{
+	lexer_select(LEXER_AUTO);
+	script_teardown();
+}
+
+/** 桁数のそろった数値を読む。データ・ファイルの列を想定する */
+static void lexer_integer_setup(size_t ops)
+{
+	size_t i;
+	script = (char *) malloc(ops * 16);
+	srand(1);
+	for (i = 0; i < ops; ++i) {
+		snprintf(&script[i * 16], 16, "%d", rand() % 100000000);
+	}
+}
+
+/** lexer_integer の前に context.c が使っていた、判別してから変換する方法 */
+static bool old_integer(char const *str, size_t len, int *value)
+{
+	size_t i;
+	int n = 0;
+	if (0 == len) { return FALSE; }
+	for (i = 0; i < len; ++i) {
+		if (!isdigit((unsigned char) str[i])) {
+			return FALSE;
+		}
+	}
+	for (i = 0; i < len; ++i) {
+		n = n * 10 + (str[i] - '0');
+	}
+	*value = n;
+	return TRUE;
+}
+
+static void lexer_integer_old_run(size_t ops)
+{
+	size_t i;
+	intptr_t sum = 0;
+	for (i = 0; i < ops; ++i) {
+		char const *p;
+		int n;
+		p = &script[i * 16];
+		if (old_integer(p, strlen(p), &n)) {
+			sum += n;
+		}
+	}
+	sink = sum;
+}
+
+static void lexer_integer_run(size_t ops)
+{
+	size_t i;
+	intptr_t sum = 0;
+	for (i = 0; i < ops; ++i) {
+		char const *p;
+		int n;
+		p = &script[i * 16];
+		if (lexer_integer(p, strlen(p), 10, &n)) {
+			sum += n;
+		}
+	}
+	sink = sum;
+}
+
+/** ベンチマークの一覧 */
+static Bench const benches[] = {
+	{ "map_put/16", 1 << 20, map_put_setup, map_put_run_16, NULL },
+	{ "map_put/1024", 1 << 20, map_put_setup, map_put_run_1024, NULL },
+	{ "map_put/65536", 1 << 20, map_put_setup, map_put_run_65536, NULL },
+	{ "map_get/16", 1 << 22, map_get_setup_16, map_get_run_16,
+	  map_teardown },
+	{ "map_get/1024", 1 << 22, map_get_setup_1024, map_get_run_1024,
+	  map_teardown },
+	{ "map_get/65536", 1 << 22, map_get_setup_65536, map_get_run_65536,
+	  map_teardown },
+	{ "map_get_str/16", 1 << 20, map_get_setup_16, map_get_str_run,
+	  map_teardown },
+	{ "stack_push_pop", 1 << 22, stack_setup, stack_push_pop_run,
+	  stack_teardown },
+	{ "output_integer", 1 << 22, output_setup, output_integer_run,
+	  output_teardown },
+	{ "context_interpret/integer", 1 << 20, context_setup,
+	  context_integer_run, context_teardown },
+	{ "context_interpret/builtin", 1 << 20, context_setup,
+	  context_builtin_run, context_teardown },
+	{ "vm_execute/kernel", 1 << 20, vm_kernel_setup, vm_kernel_run,
+	  context_teardown },
+	{ "vm_execute/threaded", 1 << 20, vm_threaded_setup, vm_kernel_run,
+	  context_teardown },
+	{ "vm_execute/guarded", 1 << 20, vm_guarded_setup, vm_kernel_run,
+	  context_teardown },
+	{ "vm_execute/catch", 1 << 20, vm_catch_setup, vm_kernel_run,
+	  context_teardown },
+	{ "vm_execute/loop", 1 << 14, vm_loop_setup, vm_kernel_run,
+	  context_teardown },
+	{ "array_sum/loop", 1 << 6, array_sum_setup_loop, vm_kernel_run,
+	  array_teardown },
+	{ "array_sum/scalar", 1 << 12, array_sum_setup_scalar, vm_kernel_run,
+	  array_teardown },
+	{ "array_sum/sse41", 1 << 12, array_sum_setup_sse41, vm_kernel_run,
+	  array_teardown },
+	{ "array_sum/avx2", 1 << 12, array_sum_setup_avx2, vm_kernel_run,
+	  array_teardown },
+	{ "array_add/scalar", 1 << 12, array_add_setup_scalar, vm_kernel_run,
+	  array_teardown },
+	{ "array_add/sse41", 1 << 12, array_add_setup_sse41, vm_kernel_run,
+	  array_teardown },
+	{ "array_add/avx2", 1 << 12, array_add_setup_avx2, vm_kernel_run,
+	  array_teardown },
+	{ "array_dot/scalar", 1 << 12, array_dot_setup_scalar, vm_kernel_run,
+	  array_teardown },
+	{ "array_dot/avx2", 1 << 12, array_dot_setup_avx2, vm_kernel_run,
+	  array_teardown },
+	{ "array_divide", 1 << 10, array_divide_setup, vm_kernel_run,
+	  array_teardown },
+	{ "array_pmap/1", 1, pmap_setup_1, vm_kernel_run, context_teardown },
+	{ "array_pmap/2", 1, pmap_setup_2, vm_kernel_run, context_teardown },
+	{ "array_pmap/4", 1, pmap_setup_4, vm_kernel_run, context_teardown },
+	{ "array_pmap/8", 1, pmap_setup_8, vm_kernel_run, context_teardown },
+	{ "array_preduce/1", 1, preduce_setup_1, vm_kernel_run,
+	  context_teardown },
+	{ "array_preduce/2", 1, preduce_setup_2, vm_kernel_run,
+	  context_teardown },
+	{ "array_preduce/4", 1, preduce_setup_4, vm_kernel_run,
+	  context_teardown },
+	{ "array_preduce/8", 1, preduce_setup_8, vm_kernel_run,
+	  context_teardown },
+	{ "task_fib/serial", 4, task_serial_setup, vm_kernel_run,
+	  context_teardown },
+	{ "task_fib/spawn", 4, task_spawn_setup, vm_kernel_run,
+	  context_teardown },
+	{ "context_parallel/1", 1 << 22, parallel_setup_1, parallel_run,
+	  parallel_teardown },
+	{ "context_parallel/2", 1 << 22, parallel_setup_2, parallel_run,
+	  parallel_teardown },
+	{ "context_parallel/4", 1 << 22, parallel_setup_4, parallel_run,
+	  parallel_teardown },
+	{ "context_parallel/8", 1 << 22, parallel_setup_8, parallel_run,
+	  parallel_teardown },
+	{ "request/new", 1 << 16, NULL, request_new_run, NULL },
+	{ "request/pool", 1 << 16, request_pool_setup, request_pool_run,
+	  request_pool_teardown },
+	{ "script/arith", 13 * SCRIPT_REPEAT, script_arith_setup, script_run,
+	  script_teardown },
+	{ "script/colon", 4 * SCRIPT_REPEAT, script_colon_setup, script_run,
+	  script_teardown },
+	{ "lexer_integer", 1 << 20, lexer_integer_setup, lexer_integer_run,
+	  script_teardown },
+	{ "lexer_integer/old", 1 << 20, lexer_integer_setup,
+	  lexer_integer_old_run, script_teardown },
+	{ "lexer/strsep", 0, lexer_setup_strsep, lexer_strsep_run,
+	  lexer_teardown_strsep },
+	{ "lexer/scalar", 0, lexer_setup_scalar, lexer_run, lexer_teardown },
+	{ "lexer/sse2", 0, lexer_setup_sse2, lexer_run, lexer_teardown },
+	{ "lexer/avx2", 0, lexer_setup_avx2, lexer_run, lexer_teardown },
+};
+
+/**
+ * ベンチマークを実行し、結果を一行の JSON として表示する。
+ * \bench ベンチマーク
+ */
+static void bench_run(Bench const *bench)
+{
+	double best = 1e9;
+	size_t best_allocations = (size_t) -1;
+	size_t ops;
+	int round;
+	ops = bench->ops;
+	bench_bytes = 0;
+	for (round = 0; round < ROUNDS; ++round) {
+		double start, elapsed;
+		size_t before;
+		if (NULL != bench->setup) {
+			bench->setup(ops);
+		}
+		before = allocations;
+		start = now();
+		bench->run(ops);
+		elapsed = now() - start;
+		if (allocations - before < best_allocations) {
+			best_allocations = allocations - before;
+		}
+		if (0 == ops) {  // 操作の数は実行してみて決まる (字句解析)
+			ops = lexer_tokens;
+		}
+		if (NULL != bench->teardown) {
+			bench->teardown();
+		}
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+	if (0 == ops) {
+		return;  // この CPU では実行できない
+	}
+	printf("{\"name\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.2f, ",
+		   bench->name, (unsigned long) ops, best / ops * 1e9);
+	if (0 != bench_bytes) {
+		printf("\"mb_per_s\": %.1f, ", bench_bytes / best / 1e6);
+	}
+#ifdef COUNT_ALLOCATIONS
+	printf("\"allocs_per_op\": %.3f}\n", (double) best_allocations / ops);
+#else
+	printf("\"allocs_per_op\": null}\n");
+#endif
+	fflush(stdout);
+}
+
+/**
+ * 名前が引数のいずれかで始まれば TRUE を返す。引数がなければすべて選ぶ。
+ * \name ベンチマークの名前
+ * \argc 引数の数
+ * \argv 引数
+ */
+static bool selected(char const *name, int argc, char **argv)
+{
+	int i;
+	if (argc <= 1) {
+		return TRUE;
+	}
+	for (i = 1; i < argc; ++i) {
+		if (0 == strncmp(name, argv[i], strlen(argv[i]))) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+		if (selected(benches[i].name, argc, argv)) {
+			bench_run(&benches[i]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/*
+ * データ空間。セルを隙間なく並べた伸縮する領域で、スタックと同じく
+ * Stack で表す。番地は先頭からのバイト数を整数のセルで表すので、領域
+ * を確保し直しても番地は変わらない。
+ */
+
+/** データ空間に確保できるセルの数の上限。番地が int に収まるようにする */
+#define DATA_MAX ((size_t) INT_MAX / sizeof(Cell))
+
+int data_here(Stack const *data)
+{
+	return (int) (data->len * sizeof(Cell));
+}
+
+bool data_allot(Stack *data, int bytes)
+{
+	size_t cells;
+	size_t i;
+	if (bytes < 0) {
+		cells = ((size_t) -(intptr_t) bytes + sizeof(Cell) - 1) / sizeof(Cell);
+		if (data->len < cells) {
+			return FALSE;
+		}
+		data->len -= cells;
+		return TRUE;
+	}
+	cells = ((size_t) bytes + sizeof(Cell) - 1) / sizeof(Cell);
+	if (DATA_MAX - data->len < cells
+		|| !stack_reserve(data, data->len + cells)) {
+		return FALSE;
+	}
+	for (i = 0; i < cells; ++i) {
+		data->values[data->len + i] = cell_from_integer(0);
+	}
+	data->len += cells;
+	return TRUE;
+}
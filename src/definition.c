@@ -0,0 +1,493 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/** ビルトイン関数と命令の対応 */
+typedef struct _FunctionOpcode FunctionOpcode;
+struct _FunctionOpcode {
+	ForshFunc *func;
+	Opcode op;
+};
+
+static FunctionOpcode const function_opcodes[] = {
+	{ forsh_plus, OP_PLUS },
+	{ forsh_minus, OP_MINUS },
+	{ forsh_star, OP_STAR },
+	{ forsh_slash, OP_SLASH },
+	{ forsh_dup, OP_DUP },
+	{ forsh_drop, OP_DROP },
+	{ forsh_swap, OP_SWAP },
+	{ forsh_over, OP_OVER },
+	{ forsh_throw, OP_THROW },
+	{ forsh_cells, OP_CELLS },
+};
+
+/** 命令の名前 */
+static char const *const opcode_names[OP_COUNT] = {
+	[OP_LIT] = "LIT",
+	[OP_CALL] = "CALL",
+	[OP_ENTER] = "ENTER",
+	[OP_EXIT] = "EXIT",
+	[OP_PLUS] = "+",
+	[OP_MINUS] = "-",
+	[OP_STAR] = "*",
+	[OP_SLASH] = "/",
+	[OP_DUP] = "DUP",
+	[OP_DROP] = "DROP",
+	[OP_SWAP] = "SWAP",
+	[OP_OVER] = "OVER",
+	[OP_CATCH] = "CATCH",
+	[OP_THROW] = "THROW",
+	[OP_HERE] = "HERE",
+	[OP_ALLOT] = "ALLOT",
+	[OP_COMMA] = ",",
+	[OP_FETCH] = "@",
+	[OP_STORE] = "!",
+	[OP_PLUS_STORE] = "+!",
+	[OP_CELLS] = "CELLS",
+	[OP_DOT] = ".",
+	[OP_EMIT] = "EMIT",
+	[OP_CR] = "CR",
+	[OP_TYPE] = "TYPE",
+	[OP_SPAWN] = "SPAWN",
+	[OP_JOIN] = "JOIN",
+	[OP_PMAP] = "PMAP",
+	[OP_PREDUCE] = "PREDUCE",
+	[OP_BRANCH] = "BRANCH",
+	[OP_ZBRANCH] = "0BRANCH",
+	[OP_DO] = "DO",
+	[OP_LOOP] = "LOOP",
+	[OP_I] = "I",
+	[OP_J] = "J",
+	[OP_TAIL] = "TAIL",
+	[OP_LIT_PLUS] = "LIT+",
+	[OP_LIT_MINUS] = "LIT-",
+	[OP_LIT_STAR] = "LIT*",
+	[OP_LIT_SLASH] = "LIT/",
+	[OP_DUP_PLUS] = "DUP+",
+	[OP_DUP_STAR] = "DUP*",
+	[OP_OVER_PLUS] = "OVER+",
+	[OP_OVER_MINUS] = "OVER-",
+	[OP_SWAP_MINUS] = "SWAP-",
+	[OP_NIP] = "NIP",
+	[OP_PROFILE_ENTER] = "PROFILE-ENTER",
+	[OP_PROFILE_EXIT] = "PROFILE-EXIT",
+	[OP_TIER_UP] = "TIER-UP",
+	[OP_CHECK] = "CHECK",
+	[OP_UNCATCH] = "UNCATCH",
+	[OP_OVERFLOW] = "OVERFLOW",
+};
+
+/** 二つの命令をまとめたスーパー命令 */
+typedef struct _Superinstruction Superinstruction;
+struct _Superinstruction {
+	Opcode first;   /* 一つ目の命令。被演算子はスーパー命令に引き継がれる */
+	Opcode second;  /* 二つ目の命令。被演算子を持たない */
+	Opcode fused;   /* まとめた命令 */
+};
+
+/*
+ * 算術を中心としたコードで隣り合って現れることの多い組。リテラルとの
+ * 演算、二乗や倍数、二つの値の差や和がほとんどを占める。
+ */
+static Superinstruction const superinstructions[] = {
+	{ OP_LIT, OP_PLUS, OP_LIT_PLUS },
+	{ OP_LIT, OP_MINUS, OP_LIT_MINUS },
+	{ OP_LIT, OP_STAR, OP_LIT_STAR },
+	{ OP_LIT, OP_SLASH, OP_LIT_SLASH },
+	{ OP_DUP, OP_PLUS, OP_DUP_PLUS },
+	{ OP_DUP, OP_STAR, OP_DUP_STAR },
+	{ OP_OVER, OP_PLUS, OP_OVER_PLUS },
+	{ OP_OVER, OP_MINUS, OP_OVER_MINUS },
+	{ OP_SWAP, OP_MINUS, OP_SWAP_MINUS },
+	{ OP_SWAP, OP_DROP, OP_NIP },
+};
+
+/**
+ * 隣り合う二つの命令に対応するスーパー命令を返す。なければ OP_COUNT
+ * を返す。
+ * \first 一つ目の命令
+ * \operand 一つ目の命令の被演算子
+ * \second 二つ目の命令
+ */
+static Opcode superinstruction_of(Opcode first, Inst const *operand,
+								  Opcode second);
+
+/**
+ * コードの中の命令の組をスーパー命令に置き換える。
+ * \definition コロン定義
+ */
+static void definition_optimize(Definition *definition);
+
+/**
+ * コードのメモリの長さを拡大する。
+ * \definition コロン定義
+ */
+static bool definition_realloc(Definition *definition);
+
+Definition *definition_new(Arena *arena, Symbol const *name)
+{
+	Definition *definition;
+	Inst inst;
+	definition = (Definition *) arena_alloc(arena, sizeof(Definition));
+	if (NULL == definition) {
+		return NULL;
+	}
+	/* コンパイル中のコードは伸ばせるように個別に確保しておく */
+	definition->memlen = 16;
+	definition->code = (Inst *) malloc(sizeof(Inst) * definition->memlen);
+	if (NULL == definition->code) {
+		return NULL;
+	}
+	definition->name = name;
+	definition->len = 0;
+	definition->threaded = NULL;
+	definition->checked = NULL;
+	definition->effect.known = FALSE;
+	definition->profile.calls = 0;
+	definition->profile.cycles = 0;
+	definition->next = NULL;
+	definition->native = NULL;
+	definition->hotness = 0;
+	inst.definition = definition;
+	if (!definition_emit_op(definition, OP_TIER_UP)
+		|| !definition_emit(definition, inst)) {
+		definition_free(definition);
+		return NULL;
+	}
+	return definition;
+}
+
+void definition_free(Definition *definition)
+{
+	free(definition->code);
+	definition->code = NULL;
+}
+
+int opcode_operands(Opcode op)
+{
+	switch (op) {
+	case OP_LIT:
+	case OP_CALL:
+	case OP_ENTER:
+	case OP_PROFILE_ENTER:
+	case OP_TIER_UP:
+	case OP_CHECK:
+	case OP_BRANCH:
+	case OP_ZBRANCH:
+	case OP_LOOP:
+	case OP_TAIL:
+	case OP_LIT_PLUS:
+	case OP_LIT_MINUS:
+	case OP_LIT_STAR:
+	case OP_LIT_SLASH:
+	case OP_LIT_UNCHECKED:
+	case OP_ENTER_UNCHECKED:
+	case OP_TAIL_UNCHECKED:
+	case OP_LIT_PLUS_UNCHECKED:
+	case OP_LIT_MINUS_UNCHECKED:
+	case OP_LIT_STAR_UNCHECKED:
+	case OP_LIT_SLASH_UNCHECKED:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+char const *opcode_name(Opcode op)
+{
+	return opcode_names[op];
+}
+
+bool opcode_is_branch(Opcode op)
+{
+	return OP_BRANCH == op || OP_ZBRANCH == op || OP_LOOP == op;
+}
+
+Opcode opcode_of_function(ForshFunc *func)
+{
+	size_t i;
+	for (i = 0; i < sizeof(function_opcodes) / sizeof(function_opcodes[0]);
+		 ++i) {
+		if (func == function_opcodes[i].func) {
+			return function_opcodes[i].op;
+		}
+	}
+	return OP_CALL;
+}
+
+static bool definition_realloc(Definition *definition)
+{
+	Inst *code;
+	code = (Inst *) realloc(definition->code,
+							sizeof(Inst) * definition->memlen * 2);
+	if (NULL == code) {
+		return FALSE;
+	}
+	definition->code = code;
+	definition->memlen *= 2;
+	return TRUE;
+}
+
+bool definition_emit(Definition *definition, Inst inst)
+{
+	if (definition->memlen <= definition->len) {
+		if (!definition_realloc(definition)) {
+			return FALSE;
+		}
+	}
+	definition->code[definition->len] = inst;
+	definition->len += 1;
+	return TRUE;
+}
+
+bool definition_emit_op(Definition *definition, Opcode op)
+{
+	Inst inst;
+	inst.op = op;
+	return definition_emit(definition, inst);
+}
+
+bool definition_emit_branch(Definition *definition, Opcode op, size_t target)
+{
+	Inst inst;
+	inst.offset = (intptr_t) target - (intptr_t) (definition->len + 1);
+	return definition_emit_op(definition, op)
+		&& definition_emit(definition, inst);
+}
+
+void definition_resolve(Definition *definition, size_t operand)
+{
+	definition->code[operand].offset
+		= (intptr_t) definition->len - (intptr_t) operand;
+}
+
+static Opcode superinstruction_of(Opcode first, Inst const *operand,
+								  Opcode second)
+{
+	size_t i;
+	/*
+	 * 整数でないリテラル (変数) との演算やゼロによる割り算はエラーとし
+	 * て報告できるよう残しておく
+	 */
+	if (OP_LIT == first
+		&& (!cell_is_integer(operand->cell)
+			|| (OP_SLASH == second && 0 == cell_integer(operand->cell)))) {
+		return OP_COUNT;
+	}
+	for (i = 0;
+		 i < sizeof(superinstructions) / sizeof(superinstructions[0]);
+		 ++i) {
+		if (first == superinstructions[i].first
+			&& second == superinstructions[i].second) {
+			return superinstructions[i].fused;
+		}
+	}
+	return OP_COUNT;
+}
+
+static void definition_optimize(Definition *definition)
+{
+	Inst *code;
+	bool *targets;
+	size_t *moved;
+	size_t i, j;
+	code = definition->code;
+	targets = (bool *) calloc(definition->len + 1, sizeof(bool));
+	moved = (size_t *) malloc(sizeof(size_t) * (definition->len + 1));
+	if (NULL == targets || NULL == moved) {
+		goto done;  // まとめずに実行する
+	}
+	/* 分岐先の命令は、その前の命令とまとめない */
+	for (i = 0; i < definition->len; i += 1 + opcode_operands(code[i].op)) {
+		if (opcode_is_branch(code[i].op)) {
+			targets[i + 1 + code[i + 1].offset] = TRUE;
+		}
+	}
+	/*
+	 * まとめるたびにコードは短くなるので、その場で詰めていく。分岐の被
+	 * 演算子は、いったん元のコードでの分岐先の位置にしておく
+	 */
+	for (i = 0, j = 0; i < definition->len; ) {
+		Opcode op;
+		int operands;
+		size_t next;
+		op = code[i].op;
+		operands = opcode_operands(op);
+		next = i + 1 + operands;
+		moved[i] = j;
+		if (opcode_is_branch(op)) {
+			code[i + 1].offset += i + 1;
+		} else if (next < definition->len && !targets[next]) {
+			Opcode fused;
+			fused = superinstruction_of(op, &code[i + 1], code[next].op);
+			if (OP_COUNT != fused) {
+				code[j++].op = fused;
+				if (0 < operands) {
+					code[j++] = code[i + 1];
+				}
+				i = next + 1;
+				continue;
+			}
+		}
+		for (; i < next; ++i) {
+			code[j++] = code[i];
+		}
+	}
+	moved[definition->len] = j;
+	definition->len = j;
+	for (j = 0; j < definition->len; j += 1 + opcode_operands(code[j].op)) {
+		if (opcode_is_branch(code[j].op)) {
+			code[j + 1].offset = (intptr_t) moved[code[j + 1].offset]
+				- (intptr_t) (j + 1);
+		}
+	}
+done:
+	free(targets);
+	free(moved);
+}
+
+bool definition_finish(Arena *arena, Definition *definition)
+{
+	Inst *code;
+	Inst *threaded;
+	size_t i;
+	if (!definition_emit_op(definition, OP_EXIT)) {
+		return FALSE;
+	}
+	/* 直後に戻る呼び出しは、戻り番地を積まずに飛ぶ (末尾呼び出し) */
+	for (i = 0; i < definition->len;
+		 i += 1 + opcode_operands(definition->code[i].op)) {
+		if (OP_ENTER == definition->code[i].op
+			&& i + 2 < definition->len
+			&& OP_EXIT == definition->code[i + 2].op) {
+			definition->code[i].op = OP_TAIL;
+		}
+	}
+	code = (Inst *) arena_alloc(arena, sizeof(Inst) * definition->len);
+	threaded = vm_thread(arena, definition->code, definition->len, FALSE);
+	if (NULL == code || NULL == threaded) {
+		return FALSE;
+	}
+	memcpy(code, definition->code, sizeof(Inst) * definition->len);
+	free(definition->code);
+	definition->code = code;
+	definition->memlen = definition->len;
+	definition->threaded = threaded;
+	definition->checked = threaded;
+	return TRUE;
+}
+
+bool definition_is_cold(Definition const *definition)
+{
+	return OP_TIER_UP == definition->code[0].op;
+}
+
+bool definition_promote(Arena *arena, Definition *definition)
+{
+	Inst *cold;
+	size_t cold_len;
+	Inst *code;
+	Inst *threaded;
+	Inst *checked;
+	bool known;
+	if (!definition_is_cold(definition)) {
+		return TRUE;
+	}
+	/*
+	 * 先頭の OP_TIER_UP を除いたコードを最適化する。OP_TIER_UP の代わ
+	 * りに OP_CHECK を置く余地を残して確保しておく
+	 */
+	cold = definition->code;
+	cold_len = definition->len;
+	definition->len = cold_len - 2;
+	definition->code = (Inst *) malloc(sizeof(Inst) * cold_len);
+	if (NULL == definition->code) {
+		goto err_malloc;
+	}
+	memcpy(definition->code, &cold[2], sizeof(Inst) * definition->len);
+	effect_infer(&definition->effect, definition->code, definition->len);
+	known = definition->effect.known;
+	definition->effect.known = FALSE;  // 置き換えるまでは検査する
+	definition_optimize(definition);
+	if (known) {
+		memmove(&definition->code[2], definition->code,
+				sizeof(Inst) * definition->len);
+		definition->code[0].op = OP_CHECK;
+		definition->code[1].definition = definition;
+		definition->len += 2;
+	}
+	code = (Inst *) arena_alloc(arena, sizeof(Inst) * definition->len);
+	threaded = vm_thread(arena, definition->code, definition->len, known);
+	checked = known
+		? vm_thread(arena, definition->code, definition->len, FALSE)
+		: threaded;
+	if (NULL == code || NULL == threaded || NULL == checked) {
+		goto err_alloc;
+	}
+	memcpy(code, definition->code, sizeof(Inst) * definition->len);
+	free(definition->code);
+	definition->code = code;
+	definition->memlen = definition->len;
+	definition->threaded = threaded;
+	definition->checked = checked;
+	definition->effect.known = known;
+	return TRUE;
+err_alloc:
+	free(definition->code);
+err_malloc:
+	definition->code = cold;
+	definition->len = cold_len;
+	return FALSE;
+}
+
+void definition_dump(Definition const *definition, Output *out)
+{
+	size_t i;
+	output_format(out, ": %s\n", symbol_name(definition->name));
+	for (i = 0; i < definition->len; ) {
+		Opcode op;
+		Inst const *operand;
+		char buf[1024];
+		op = definition->code[i].op;
+		operand = &definition->code[i + 1];
+		output_format(out, "%4lu  %s", (unsigned long) i, opcode_name(op));
+		switch (op) {
+		case OP_LIT:
+		case OP_LIT_PLUS:
+		case OP_LIT_MINUS:
+		case OP_LIT_STAR:
+		case OP_LIT_SLASH:
+			cell_str(operand->cell, buf, sizeof(buf));
+			output_format(out, " %s", buf);
+			break;
+		case OP_CALL:
+			output_format(out, " %p", (void *) operand->func);
+			break;
+		case OP_ENTER:
+		case OP_TAIL:
+		case OP_TIER_UP:
+			output_format(out, " %s", symbol_name(operand->definition->name));
+			break;
+		case OP_BRANCH:
+		case OP_ZBRANCH:
+		case OP_LOOP:
+			output_format(out, " -> %ld", (long) (i + 1 + operand->offset));
+			break;
+		case OP_CHECK:
+			output_format(out, " ( %lu -- %lu )",
+						  (unsigned long) operand->definition->effect.in,
+						  (unsigned long) operand->definition->effect.out);
+			break;
+		default:
+			break;
+		}
+		output_char(out, '\n');
+		i += 1 + opcode_operands(op);
+	}
+	output_write(out, ";\n", 2);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/** 推論中に扱うスタックの深さの上限 */
+#define INFERENCE_DEPTH 64
+
+/** 推論中に扱うスタックの伸びの上限 */
+#define INFERENCE_PEAK 4096
+
+/**
+ * スタック効果の推論の状態。コードを先頭から一度だけたどり、スタック
+ * の各要素の種類 (整数か、型のわからない値か、実行前からあった要素か)
+ * を追う。
+ */
+typedef struct _Inference Inference;
+struct _Inference {
+	Effect *effect;                     /* 推論中のスタック効果 */
+	signed char stack[INFERENCE_DEPTH];  /* 要素の種類 */
+	size_t len;                         /* 要素の数 */
+	bool ok;                            /* 推論できなくなったら FALSE */
+};
+
+/**
+ * 要素を一つ下ろす。スタックが空であれば、実行前からあった要素を一つ
+ * 必要とする。
+ * \inference 推論の状態
+ */
+static signed char inference_pop(Inference *inference);
+
+/**
+ * 要素を一つ積む。
+ * \inference 推論の状態
+ * \kind 要素の種類
+ */
+static void inference_push(Inference *inference, signed char kind);
+
+/**
+ * 要素が整数でなければならないことを記録する。整数でないことがありう
+ * るなら推論を諦める。
+ * \inference 推論の状態
+ * \kind 要素の種類
+ */
+static void inference_integer(Inference *inference, signed char kind);
+
+/**
+ * 実行中のスタックの伸びを記録する。
+ * \inference 推論の状態
+ * \extra 現在のスタックに加えて伸びる要素の数
+ */
+static void inference_peak(Inference *inference, size_t extra);
+
+/**
+ * コロン定義の呼び出しをスタック効果で置き換える。
+ * \inference 推論の状態
+ * \callee 呼び出す定義のスタック効果
+ */
+static void inference_enter(Inference *inference, Effect const *callee);
+
+static signed char inference_pop(Inference *inference)
+{
+	if (0 < inference->len) {
+		inference->len -= 1;
+		return inference->stack[inference->len];
+	}
+	if (EFFECT_MAX <= inference->effect->in) {
+		inference->ok = FALSE;
+		return EFFECT_ANY;
+	}
+	return (signed char) inference->effect->in++;
+}
+
+static void inference_push(Inference *inference, signed char kind)
+{
+	if (INFERENCE_DEPTH <= inference->len) {
+		inference->ok = FALSE;
+		return;
+	}
+	inference->stack[inference->len++] = kind;
+	inference_peak(inference, 0);
+}
+
+static void inference_integer(Inference *inference, signed char kind)
+{
+	if (EFFECT_ANY == kind) {
+		inference->ok = FALSE;
+	} else if (0 <= kind) {
+		inference->effect->integers |= (uint32_t) 1 << kind;
+	}
+}
+
+static void inference_peak(Inference *inference, size_t extra)
+{
+	Effect *effect;
+	effect = inference->effect;
+	if (effect->in < inference->len + extra
+		&& effect->peak < inference->len + extra - effect->in) {
+		effect->peak = inference->len + extra - effect->in;
+		if (INFERENCE_PEAK < effect->peak) {
+			inference->ok = FALSE;
+		}
+	}
+}
+
+static void inference_enter(Inference *inference, Effect const *callee)
+{
+	signed char args[EFFECT_MAX];
+	size_t i;
+	if (!callee->known) {
+		inference->ok = FALSE;
+		return;
+	}
+	inference_peak(inference, callee->peak);
+	for (i = 0; i < callee->in; ++i) {
+		args[i] = inference_pop(inference);
+		if (callee->integers & ((uint32_t) 1 << i)) {
+			inference_integer(inference, args[i]);
+		}
+	}
+	for (i = 0; i < callee->out; ++i) {
+		signed char kind;
+		kind = callee->kinds[i];
+		inference_push(inference, 0 <= kind ? args[kind] : kind);
+	}
+}
+
+void effect_infer(Effect *effect, Inst const *code, size_t len)
+{
+	Inference inference;
+	size_t i;
+	signed char a, b;
+	memset(effect, 0, sizeof(Effect));
+	inference.effect = effect;
+	inference.len = 0;
+	inference.ok = TRUE;
+	for (i = 0; i < len && inference.ok;
+		 i += 1 + opcode_operands(code[i].op)) {
+		switch (code[i].op) {
+		case OP_LIT:
+			inference_push(&inference, cell_is_integer(code[i + 1].cell)
+						   ? EFFECT_INTEGER : EFFECT_ANY);
+			break;
+		case OP_ENTER:
+		case OP_TAIL:
+			inference_enter(&inference, &code[i + 1].definition->effect);
+			break;
+		case OP_EXIT:
+			if (EFFECT_MAX < inference.len) {
+				return;
+			}
+			effect->out = inference.len;
+			memcpy(effect->kinds, inference.stack, inference.len);
+			effect->known = TRUE;
+			return;
+		case OP_PLUS:
+		case OP_MINUS:
+		case OP_STAR:
+		case OP_SLASH:
+			inference_integer(&inference, inference_pop(&inference));
+			inference_integer(&inference, inference_pop(&inference));
+			inference_push(&inference, EFFECT_INTEGER);
+			break;
+		case OP_DUP:
+			a = inference_pop(&inference);
+			inference_push(&inference, a);
+			inference_push(&inference, a);
+			break;
+		case OP_DROP:
+			inference_pop(&inference);
+			break;
+		case OP_SWAP:
+			a = inference_pop(&inference);
+			b = inference_pop(&inference);
+			inference_push(&inference, a);
+			inference_push(&inference, b);
+			break;
+		case OP_OVER:
+			a = inference_pop(&inference);
+			b = inference_pop(&inference);
+			inference_push(&inference, b);
+			inference_push(&inference, a);
+			inference_push(&inference, b);
+			break;
+		case OP_HERE:
+			inference_push(&inference, EFFECT_INTEGER);
+			break;
+		case OP_ALLOT:
+			inference_integer(&inference, inference_pop(&inference));
+			break;
+		case OP_COMMA:
+			inference_pop(&inference);
+			break;
+		case OP_FETCH:
+			inference_integer(&inference, inference_pop(&inference));
+			inference_push(&inference, EFFECT_ANY);
+			break;
+		case OP_STORE:
+			inference_integer(&inference, inference_pop(&inference));
+			inference_pop(&inference);
+			break;
+		case OP_PLUS_STORE:
+			inference_integer(&inference, inference_pop(&inference));
+			inference_integer(&inference, inference_pop(&inference));
+			break;
+		case OP_CELLS:
+			inference_integer(&inference, inference_pop(&inference));
+			inference_push(&inference, EFFECT_INTEGER);
+			break;
+		case OP_DOT:
+		case OP_EMIT:
+			inference_integer(&inference, inference_pop(&inference));
+			break;
+		case OP_CR:
+			break;
+		case OP_TYPE:
+			inference_integer(&inference, inference_pop(&inference));
+			inference_integer(&inference, inference_pop(&inference));
+			break;
+		default:  // OP_CALL や分岐など
+			return;
+		}
+	}
+}
@@ -6,35 +6,126 @@
 
 #include "forsh.h"
 
+/** 解放された Error を再利用するための自由リストの要素 */
+typedef union _ErrorBlock ErrorBlock;
+union _ErrorBlock {
+	Error error;
+	ErrorBlock *next;
+};
+
+/** 解放された Error の自由リスト。ロックしないようスレッドごとに持つ */
+static THREAD_LOCAL ErrorBlock *free_errors;
+
+/** 自由リストに保持しておく Error の上限 */
+static size_t const FREE_ERRORS_MAX = 64;
+
+/** 自由リストに保持している Error の数 */
+static THREAD_LOCAL size_t free_errors_len;
+
+/**
+ * メッセージを持たないエラー。種別ごとに一つずつ静的に持ち、エラーを
+ * 起こすときに確保しない。例外番号は ANS Forth の THROW 値に合わせる。
+ */
+static Error static_errors[] = {
+	[EmptyStackError] = { EmptyStackError, NULL, -4 },
+	[IllegalTypeError] = { IllegalTypeError, NULL, -12 },
+	[DividedByZeroError] = { DividedByZeroError, NULL, -10 },
+	[IllegalVariableError] = { IllegalVariableError, NULL, -32 },
+	[IllegalDefinitionError] = { IllegalDefinitionError, NULL, -13 },
+	[StackOverflowError] = { StackOverflowError, NULL, -3 },
+	[IllegalAddressError] = { IllegalAddressError, NULL, -9 },
+	[ThrownError] = { ThrownError, NULL, -1 },
+};
+
+/** 静的に持つエラーの数 */
+#define STATIC_ERRORS_LEN (sizeof(static_errors) / sizeof(static_errors[0]))
+
+/**
+ * Error を確保する。自由リストに Error があればそれを再利用する。
+ */
+static Error *error_alloc(void);
+
+static Error *error_alloc(void)
+{
+	ErrorBlock *block;
+	if (NULL != (block = free_errors)) {
+		free_errors = block->next;
+		free_errors_len -= 1;
+		return &block->error;
+	}
+	block = (ErrorBlock *) malloc(sizeof(ErrorBlock));
+	if (NULL == block) {
+		return NULL;
+	}
+	return &block->error;
+}
+
 Error *error_new(ErrorType type, char const *message)
+{
+	return error_new_n(type, message, NULL == message ? 0 : strlen(message));
+}
+
+Error *error_new_n(ErrorType type, char const *message, size_t len)
 {
 	Error *error;
-	error = (Error *) malloc(sizeof(Error));
+	if (NULL == message) {
+		return &static_errors[type];
+	}
+	error = error_alloc();
 	if (NULL == error) {
 		goto err_malloc;
 	}
-	if (NULL == message) {
-		error->message = NULL;
-	} else {
-		error->message = strdup(message);
-		if (NULL == error->message) {
-			goto err_strdup_message;
-		}
+	error->message = strndup(message, len);
+	if (NULL == error->message) {
+		goto err_strdup_message;
 	}
 	error->type = type;
+	error->code = static_errors[type].code;
 	return error;
 err_strdup_message:
-	free(error);
+	error_free(error);
 err_malloc:
 	return NULL;
 }
 
+Error *error_new_code(int code)
+{
+	Error *error;
+	size_t i;
+	for (i = 0; i < STATIC_ERRORS_LEN; ++i) {
+		if (code == static_errors[i].code) {
+			return &static_errors[i];
+		}
+	}
+	error = error_alloc();
+	if (NULL == error) {
+		return &static_errors[ThrownError];
+	}
+	error->type = ThrownError;
+	error->message = NULL;
+	error->code = code;
+	return error;
+}
+
 void error_free(Error *error)
 {
+	ErrorBlock *block;
+	if (&static_errors[0] <= error
+		&& error < &static_errors[STATIC_ERRORS_LEN]) {
+		return;  // 静的なエラーは解放しない
+	}
 	if (NULL != error->message) {
 		free(error->message);
+		error->message = NULL;
+	}
+	if (FREE_ERRORS_MAX <= free_errors_len) {
+		free(error);
+		return;
 	}
-	free(error);
+	block = (ErrorBlock *) error;
+	block->next = free_errors;
+	free_errors = block;
+	free_errors_len += 1;
 }
 
 /** 列挙体を文字列に対応させるための構造体 */
@@ -49,6 +140,10 @@ const static ErrorString error_strings[] = {
 	{ IllegalTypeError, "IllegalTypeError" },
 	{ DividedByZeroError, "DividedByZeroError" },
 	{ IllegalVariableError, "IllegalVariableError" },
+	{ IllegalDefinitionError, "IllegalDefinitionError" },
+	{ StackOverflowError, "StackOverflowError" },
+	{ IllegalAddressError, "IllegalAddressError" },
+	{ ThrownError, "ThrownError" },
 };
 
 char *error_str(Error const *error, char *buffer, size_t size)
@@ -56,6 +151,9 @@ char *error_str(Error const *error, char *buffer, size_t size)
 	if (NULL != error->message) {
 		snprintf(buffer, size, "%s: %s",
 				 error_strings[error->type].str, error->message);
+	} else if (ThrownError == error->type) {
+		snprintf(buffer, size, "%s: %d",
+				 error_strings[error->type].str, error->code);
 	} else {
 		snprintf(buffer, size, "%s",
 				 error_strings[error->type].str);
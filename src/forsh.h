@@ -5,6 +5,11 @@
  */
 
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,46 +26,121 @@
 #define bool int
 #endif
 
+/** スレッドごとに持つ変数 */
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 /** free 関数のシグネチャ */
 typedef void FreeFunc(void *);
 
+/** アリーナを構成する領域の一単位 */
+typedef struct _ArenaChunk ArenaChunk;
+struct _ArenaChunk {
+	ArenaChunk *next;     /* 次の領域 */
+	size_t len;           /* 使用済みの長さ */
+	size_t memlen;        /* 領域の長さ */
+	max_align_t data[];   /* 領域本体 */
+};
+
+/**
+ * アリーナ。小さなオブジェクトを領域から切り出して確保し、個別には解放
+ * せずにアリーナごとまとめて解放する。
+ */
+typedef struct _Arena Arena;
+struct _Arena {
+	ArenaChunk *chunks;  /* 領域のリスト。先頭から切り出す */
+};
+
+/**
+ * スタックに積まれる値 (セル)。機械語一語に値とその型を表す印 (タグ)
+ * を詰め込んだもので、整数は確保を伴わずにそのまま格納される。
+ * 下位 2 ビットがタグで、
+ *   x1: 整数 (残りのビットが値)
+ *   10: シンボル (Symbol へのポインタ)
+ *   00: 配列 (Array へのポインタ)
+ * を表す。
+ */
+typedef intptr_t Cell;
+
+/** セルのタグを取り出すためのマスク */
+#define CELL_TAG_MASK 3
+/** シンボルを表すタグ */
+#define CELL_TAG_SYMBOL 2
+
 /** スタック */
 typedef struct _Stack Stack;
 struct _Stack {
-	void **values;         /* 要素 */
-	size_t len;            /* 長さ */
-	size_t memlen;         /* 確保されているメモリの長さ */
-	FreeFunc *value_free;  /* 要素を解放する際に用いる関数 */
+	/*
+	 * 要素。values[-1] は番兵として読み書きでき、スタックが空でも一番
+	 * 上の位置 values[len - 1] を扱える
+	 */
+	Cell *values;
+	size_t len;     /* 長さ */
+	size_t memlen;  /* 確保されているメモリの長さ */
+	/*
+	 * 両側のガード・ページの要素数。0 でなければ固定長で、memlen は上
+	 * 側のガード・ページを含む。溢れた書き込みはガード・ページで止まる
+	 */
+	size_t guard;
 };
 
-/** 文字列をキーとするペア */
+/**
+ * シンボル。同じ名前に対してはプロセス内で唯一のインスタンスがインター
+ * ン表に登録されるので、名前の比較はポインタの比較で済む。
+ */
+typedef struct _Symbol Symbol;
+struct _Symbol {
+	unsigned int id;    /* 登録順の通し番号 */
+	unsigned int hash;  /* 名前のハッシュ値 */
+	size_t len;         /* 名前の長さ */
+	char name[];        /* 名前 (NUL 終端) */
+};
+
+/** シンボルをキーとするペア */
 typedef struct _Pair Pair;
 struct _Pair {
-	char *key;    /* キー */
-	void *value;  /* 値 */
+	Symbol const *key;  /* キー。NULL は空きスロットを表す */
+	void *value;        /* 値 */
 };
 
-/** 文字列をキーとするマップ */
+/**
+ * シンボルをキーとするマップ。オープン・アドレス法 (線形探索) によるハッ
+ * シュ表で、キーの比較はポインタの比較で行う。
+ */
 typedef struct _Map Map;
 struct _Map {
-	Pair **pairs;          /* 要素 */
+	Pair *pairs;           /* スロット */
 	size_t len;            /* 長さ */
-	size_t memlen;         /* 確保されているメモリの長さ */
+	size_t memlen;         /* スロットの数 (2 の冪) */
 	FreeFunc *value_free;  /* 要素を解放する際に用いる関数 */
 };
 
 /** 型 */
 typedef enum _Type Type;
 enum _Type {
-	TYPE_INTEGER,   /* 整数 */
-	TYPE_FUNCTION,  /* 関数 */
-	TYPE_SYMBOL,    /* シンボル */
+	TYPE_INTEGER,     /* 整数 */
+	TYPE_FUNCTION,    /* 関数 */
+	TYPE_CONSTANT,    /* 定数 (セルを積む) */
+	TYPE_DEFINITION,  /* コロン定義 */
+	TYPE_OPCODE,      /* 内部インタープリターの命令 */
+	TYPE_ARRAY,       /* 整数の配列 (配列のセルを積む) */
+};
+
+/** 語の実行を計測した結果 */
+typedef struct _Profile Profile;
+struct _Profile {
+	uint64_t calls;   /* 呼び出された回数 */
+	uint64_t cycles;  /* 実行に要したサイクル数の累計 */
 };
 
 typedef union _Data Data;
 union _Data {
 	void *p;
 	int i;
+	Cell cell;
 };
 
 /** 値 */
@@ -68,41 +148,401 @@ typedef struct _Value Value;
 struct _Value {
 	Type type;   /* このインスタンスの型 */
 	Data data;  /* データ */
+	Profile profile;  /* 関数の実行の計測結果 */
+};
+
+/** 命令の種別 */
+typedef enum _Opcode Opcode;
+enum _Opcode {
+	OP_LIT,    /* 続くセルを積む */
+	OP_CALL,   /* 続くビルトイン関数を呼び出す */
+	OP_ENTER,  /* 続くコロン定義を実行する */
+	OP_EXIT,   /* コロン定義から戻る */
+	OP_PLUS,   /* + */
+	OP_MINUS,  /* - */
+	OP_STAR,   /* * */
+	OP_SLASH,  /* / */
+	OP_DUP,    /* DUP */
+	OP_DROP,   /* DROP */
+	OP_SWAP,   /* SWAP */
+	OP_OVER,   /* OVER */
+	OP_CATCH,  /* CATCH */
+	OP_THROW,  /* THROW */
+	OP_HERE,        /* HERE */
+	OP_ALLOT,       /* ALLOT */
+	OP_COMMA,       /* , */
+	OP_FETCH,       /* @ */
+	OP_STORE,       /* ! */
+	OP_PLUS_STORE,  /* +! */
+	OP_CELLS,       /* CELLS */
+	OP_DOT,   /* . */
+	OP_EMIT,  /* EMIT */
+	OP_CR,    /* CR */
+	OP_TYPE,  /* TYPE */
+	OP_SPAWN,  /* SPAWN */
+	OP_JOIN,   /* JOIN */
+	OP_PMAP,     /* PMAP */
+	OP_PREDUCE,  /* PREDUCE */
+	/* 以下は分岐。被演算子は被演算子の位置から分岐先までの相対位置 */
+	OP_BRANCH,   /* 分岐する */
+	OP_ZBRANCH,  /* 下ろした値が 0 であれば分岐する */
+	OP_DO,       /* DO。上限と初期値をリターン・スタックに移す */
+	OP_LOOP,     /* LOOP。添字を進め、上限に達していなければ分岐する */
+	OP_I,        /* I */
+	OP_J,        /* J */
+	OP_TAIL,     /* 続くコロン定義へ戻り番地を積まずに飛ぶ (末尾呼び出し) */
+	/* 以下は頻出する二語を一つにまとめた命令 (スーパー命令) */
+	OP_LIT_PLUS,    /* n + */
+	OP_LIT_MINUS,   /* n - */
+	OP_LIT_STAR,    /* n * */
+	OP_LIT_SLASH,   /* n / (n はゼロでない) */
+	OP_DUP_PLUS,    /* DUP + */
+	OP_DUP_STAR,    /* DUP * */
+	OP_OVER_PLUS,   /* OVER + */
+	OP_OVER_MINUS,  /* OVER - */
+	OP_SWAP_MINUS,  /* SWAP - */
+	OP_NIP,         /* SWAP DROP */
+	/* 以下は計測中に ENTER と EXIT の代わりに実行する命令 */
+	OP_PROFILE_ENTER,  /* ENTER に加えて呼び出しを計測する */
+	OP_PROFILE_EXIT,   /* EXIT に加えて実行時間を計測する */
+	/* 最適化する前の定義の先頭に置く命令 */
+	OP_TIER_UP,  /* 呼び出しを数え、閾値に達したら続く定義を最適化する */
+	/* スタック効果を推論できた定義の先頭に置く命令 */
+	OP_CHECK,  /* スタックを一度に検査し、満たさなければ検査する版を実行する */
+	/* CATCH で実行した語から戻る先に置く命令 */
+	OP_UNCATCH,  /* 例外フレームを外し、0 を積んで CATCH の次に戻る */
+	/* 機械語から内部インタープリターに戻る先に置く命令 */
+	OP_OVERFLOW,  /* リターン・スタックが溢れたエラーを起こす */
+	/*
+	 * 以下は OP_CHECK を満たした後に実行する、検査を省いた命令。スレッ
+	 * デッド・コードの中にだけ現れる
+	 */
+	OP_LIT_UNCHECKED,
+	OP_ENTER_UNCHECKED,  /* 呼び出し先の OP_CHECK も省く */
+	OP_TAIL_UNCHECKED,   /* 飛び先の OP_CHECK も省く */
+	OP_PLUS_UNCHECKED,
+	OP_MINUS_UNCHECKED,
+	OP_STAR_UNCHECKED,
+	OP_SLASH_UNCHECKED,  /* ゼロ除算だけは検査する */
+	OP_DUP_UNCHECKED,
+	OP_DROP_UNCHECKED,
+	OP_SWAP_UNCHECKED,
+	OP_OVER_UNCHECKED,
+	OP_LIT_PLUS_UNCHECKED,
+	OP_LIT_MINUS_UNCHECKED,
+	OP_LIT_STAR_UNCHECKED,
+	OP_LIT_SLASH_UNCHECKED,
+	OP_DUP_PLUS_UNCHECKED,
+	OP_DUP_STAR_UNCHECKED,
+	OP_OVER_PLUS_UNCHECKED,
+	OP_OVER_MINUS_UNCHECKED,
+	OP_SWAP_MINUS_UNCHECKED,
+	OP_NIP_UNCHECKED,
+	OP_COUNT,  /* 命令の種類の数 */
+};
+
+typedef struct _Definition Definition;
+typedef struct _Error Error;
+
+/* Forsh の関数 */
+typedef Error *ForshFunc(Stack *stack);
+
+/**
+ * コードの一語。命令の種別か、それに続く被演算子のいずれかを表す。
+ */
+typedef union _Inst Inst;
+union _Inst {
+	Opcode op;               /* 命令の種別 */
+	void const *label;       /* 直接スレッデッド・コードにおける処理の番地 */
+	Cell cell;               /* OP_LIT などの被演算子 */
+	ForshFunc *func;         /* OP_CALL の被演算子 */
+	Definition *definition;  /* OP_ENTER の被演算子 */
+	intptr_t offset;         /* 分岐の被演算子 */
+};
+
+/** スタック効果で扱う要素の数の上限 */
+#define EFFECT_MAX 16
+
+/* スタック効果における要素の種類。0 以上は実行前からあった要素の位置 */
+#define EFFECT_INTEGER (-1)  /* 整数 */
+#define EFFECT_ANY (-2)      /* 型のわからない値 */
+
+/**
+ * コロン定義のスタック効果。実行前のスタックが in 個以上の要素を持ち、
+ * integers で示す要素が整数であれば、エラーにならずに out 個の要素に置
+ * き換わる (ゼロ除算と、データ空間の外を指す番地を除く)。実行前の要
+ * 素の位置は一番上を 0 とする。
+ */
+typedef struct _Effect Effect;
+struct _Effect {
+	bool known;         /* 推論できたなら TRUE */
+	size_t in;          /* 実行前に必要な要素の数 */
+	size_t out;         /* 実行後に残る要素の数 */
+	size_t peak;        /* 実行中に実行前より増える要素の数の最大値 */
+	uint32_t integers;  /* 整数でなければならない要素 (位置のビット) */
+	signed char kinds[EFFECT_MAX];  /* 実行後に残る要素の種類 (底から) */
+};
+
+/**
+ * コロン定義。初めは最適化しない単純なスレッデッド・コード (第 0 層)
+ * として実行し、呼び出し回数が閾値に達したらスーパー命令にまとめて機械
+ * 語に翻訳したもの (第 1 層) に置き換える。
+ */
+struct _Definition {
+	Symbol const *name;  /* 名前 */
+	Inst *code;          /* 命令の種別で表したコード */
+	size_t len;          /* コードの長さ */
+	size_t memlen;       /* コードに確保されているメモリの長さ */
+	Inst *threaded;      /* 内部インタープリターが実行するコード */
+	Inst *checked;       /* 検査を省かないコード。OP_CHECK がなければ threaded */
+	Effect effect;       /* スタック効果 */
+	Profile profile;     /* 実行の計測結果 */
+	Definition *next;    /* 文脈で定義された次の定義 */
+	void const *native;  /* JIT が生成した機械語の入口。なければ NULL */
+	size_t hotness;      /* 第 0 層で呼び出された回数 */
+};
+
+/** JIT が生成した機械語を置く実行可能な領域の一単位 */
+typedef struct _JitChunk JitChunk;
+struct _JitChunk {
+	JitChunk *next;       /* 次の領域 */
+	size_t len;           /* 使用済みの長さ */
+	size_t memlen;        /* 領域の長さ */
+	unsigned char *code;  /* 領域本体 (mmap で確保する) */
+};
+
+/**
+ * JIT コンパイラー。コロン定義を x86-64 の機械語に翻訳する。生成した
+ * 機械語は JIT とともに解放される。
+ */
+typedef struct _Jit Jit;
+struct _Jit {
+	JitChunk *chunks;   /* 領域のリスト。先頭に書き込む */
+	void const *entry;  /* C から機械語を呼び出すための入口 */
+	size_t entry_len;   /* 最も古い領域の先頭で入口が占める長さ */
+};
+
+/**
+ * 字句解析器。バッファを空白や制御文字で区切ってトークンを切り出す。
+ * トークンはバッファ内の位置と長さで表し、複製しない。
+ */
+typedef struct _Lexer Lexer;
+struct _Lexer {
+	char const *p;      /* 次に調べる位置 */
+	char const *end;    /* バッファの末尾 */
+	char const *block;  /* p を含む 64 バイトのブロックの先頭 */
+	uint64_t mask;      /* ブロック内の区切り文字の位置を表すビット */
 };
 
+/** 字句解析器が区切り文字を探す実装 */
+typedef enum _LexerImpl LexerImpl;
+enum _LexerImpl {
+	LEXER_AUTO,    /* CPU に応じて自動的に選ぶ */
+	LEXER_SCALAR,  /* 一バイトずつ調べる */
+	LEXER_SSE2,    /* SSE2 で 16 バイトずつ調べる */
+	LEXER_AVX2,    /* AVX2 で 32 バイトずつ調べる */
+};
+
+/** 配列の要素の先頭のアラインメント (AVX2 のレジスターの大きさ) */
+#define ARRAY_ALIGN 32
+
+/**
+ * 整数の配列。ARRAY で定義し、定義した文脈のアリーナに確保する。要素
+ * は連続していて、先頭は ARRAY_ALIGN バイト境界にある。
+ */
+typedef struct _Array Array;
+struct _Array {
+	Symbol const *name;  /* 名前 */
+	size_t len;          /* 要素の数 */
+	int *values;         /* 要素 */
+};
+
+/** 配列の語が要素をまとめて計算する実装 */
+typedef enum _ArrayImpl ArrayImpl;
+enum _ArrayImpl {
+	ARRAY_AUTO,    /* CPU に応じて自動的に選ぶ */
+	ARRAY_SCALAR,  /* 一要素ずつ計算する */
+	ARRAY_SSE41,   /* SSE4.1 で 4 要素ずつ計算する */
+	ARRAY_AVX2,    /* AVX2 で 8 要素ずつ計算する */
+};
+
+/** 出力バッファの大きさ */
+#define OUTPUT_SIZE (64 * 1024)
+
+/**
+ * 出力。書き込みはバッファに溜め、一杯になるか output_flush で明示さ
+ * れたときにまとめて書き出す。書き込み先が端末であれば改行ごとにも書
+ * き出す。
+ */
+typedef struct _Output Output;
+struct _Output {
+	int fd;                  /* 書き込み先のファイル記述子 */
+	bool line_buffered;      /* 改行ごとに書き出すなら TRUE */
+	size_t len;              /* バッファに溜まっている長さ */
+	char buf[OUTPUT_SIZE];   /* バッファ */
+};
+
+/**
+ * コロン定義を最適化するまでの呼び出し回数の既定値。一度しか呼び出さな
+ * い定義に最適化の手間をかけないようにする。
+ */
+#ifndef FORSH_TIER_THRESHOLD
+#define FORSH_TIER_THRESHOLD 64
+#endif
+
+/**
+ * リターン・スタックに積める要素の数の上限。際限なく再帰した場合に、
+ * メモリーを使い尽くす前に StackOverflowError にする。スタックは倍々
+ * に拡大するので、2 の冪にする。
+ */
+#ifndef FORSH_RSTACK_MAX
+#define FORSH_RSTACK_MAX (1024 * 1024)
+#endif
+
 /** 文脈 */
 typedef struct _Context Context;
 struct _Context {
-	Stack *stack;  /* スタック */
-	Map *map;      /* シンボル・テーブル */
-	bool defining_variable;  /* 変数宣言待ちか */
+	Stack *stack;   /* スタック */
+	Stack *rstack;  /* リターン・スタック */
+	Map *map;       /* 文脈で定義した語のシンボル・テーブル */
+	Arena *arena;   /* シンボル・テーブルの値や定義を確保するアリーナ */
+	Stack *data;    /* データ空間。番地はその先頭からのバイト数で表す */
+	Output *output; /* ., EMIT, CR, TYPE などの出力先 */
+	unsigned int base;      /* 数値を読み書きする基数 */
+	Symbol const *parsing;  /* 次のトークンを名前として待っている語 */
+	Definition *compiling;  /* コンパイル中の定義 */
+	Stack *control;         /* コンパイル中に開いている制御構造の位置と種類 */
+	Definition *definitions;  /* 定義したすべての定義 (再定義されたものも含む) */
+	bool profiling;         /* 語の実行を計測しているなら TRUE */
+	Jit *jit;               /* JIT コンパイラー。使えなければ NULL */
+	size_t tier_threshold;  /* コロン定義を最適化するまでの呼び出し回数 */
+	bool guarded;           /* ガード・ページで溢れを捕まえるなら TRUE */
+	size_t handler;         /* 一番内側の例外フレームの位置。なければ NO_HANDLER */
+	Context *parent;        /* タスクの文脈であれば、SPAWN した文脈 */
+	Stack *tasks;           /* JOIN していないタスク。ハンドルはその位置 */
+	size_t running;         /* 終わっていないタスクの数 (アトミックに読み書きする) */
+	size_t threads;         /* PMAP と PREDUCE が使うスレッドの数。0 ならすべて */
 };
 
+/** 文脈のプール。構造は pool.c に隠す */
+typedef struct _ContextPool ContextPool;
+
+/** 例外フレームがないことを表す Context.handler の値 */
+#define NO_HANDLER SIZE_MAX
+
 /** エラー種別 */
 typedef enum _ErrorType ErrorType;
 enum _ErrorType {
-	EmptyStackError,       /* スタックが空である */
-	IllegalTypeError,      /* 型が不正である */
-	DividedByZeroError,    /* ゼロによる割り算 */
-	IllegalVariableError,  /* 変数定義のエラー */
+	EmptyStackError,         /* スタックが空である */
+	IllegalTypeError,        /* 型が不正である */
+	DividedByZeroError,      /* ゼロによる割り算 */
+	IllegalVariableError,    /* 変数定義のエラー */
+	IllegalDefinitionError,  /* コロン定義のエラー */
+	StackOverflowError,      /* スタックが溢れた */
+	IllegalAddressError,     /* データ空間の外か、セルの境界にない番地 */
+	ThrownError,             /* THROW で投げられた */
 };
 
-/** エラー */
-typedef struct _Error Error;
+/**
+ * エラー。メッセージを持たないエラーは種別ごとに静的に用意されたもの
+ * を共有するので、起こすときに確保しない。
+ */
 struct _Error {
 	ErrorType type;  /* エラー種別 */
 	char *message;   /* メッセージ */
+	int code;        /* CATCH に積まれる例外番号 (ANS Forth の THROW 値) */
 };
 
-/* Forsh の関数 */
-typedef Error *ForshFunc(Stack *stack);
+/**
+ * ガード・ページへのアクセスを捕まえる範囲。guard_begin の後に
+ * sigsetjmp(env, 0) し、ガード・ページにアクセスすると fault にエラー
+ * の種別を設定して env に戻る。
+ */
+typedef struct _Guard Guard;
+struct _Guard {
+	sigjmp_buf env;       /* ガード・ページにアクセスしたときに戻る先 */
+	Stack const *stack;   /* 見張るスタック */
+	Stack const *rstack;  /* 見張るリターン・スタック */
+	ErrorType fault;      /* 捕まえたエラーの種別 */
+	Guard *prev;          /* 外側の範囲 */
+};
+
+/* cell */
+/** 整数からセルを作る */
+static inline Cell cell_from_integer(int i)
+{
+	return (Cell) (((uintptr_t) (intptr_t) i << 1) | 1);
+}
+
+/** セルが整数であれば TRUE を返す */
+static inline bool cell_is_integer(Cell cell)
+{
+	return 0 != (cell & 1);
+}
+
+/** 整数のセルから値を取り出す */
+static inline int cell_integer(Cell cell)
+{
+	return (int) (cell >> 1);
+}
+
+/** シンボルからセルを作る */
+static inline Cell cell_from_symbol(Symbol const *symbol)
+{
+	return (Cell) symbol | CELL_TAG_SYMBOL;
+}
+
+/** セルがシンボルであれば TRUE を返す */
+static inline bool cell_is_symbol(Cell cell)
+{
+	return CELL_TAG_SYMBOL == (cell & CELL_TAG_MASK);
+}
+
+/** シンボルのセルからシンボルを取り出す */
+static inline Symbol const *cell_symbol(Cell cell)
+{
+	return (Symbol const *) (cell & ~(Cell) CELL_TAG_MASK);
+}
+
+/** 配列からセルを作る */
+static inline Cell cell_from_array(Array *array)
+{
+	return (Cell) array;
+}
+
+/** セルが配列であれば TRUE を返す */
+static inline bool cell_is_array(Cell cell)
+{
+	return 0 == (cell & CELL_TAG_MASK) && 0 != cell;
+}
+
+/** 配列のセルから配列を取り出す */
+static inline Array *cell_array(Cell cell)
+{
+	return (Array *) cell;
+}
+
+/**
+ * 整数を割る (0 で割らないこと)。INT_MIN / -1 は例外になるので、他の
+ * 演算と同じく回り込ませる。
+ */
+static inline int integer_divide(int a, int b)
+{
+	return -1 == b ? (int) (0U - (unsigned int) a) : a / b;
+}
 
 /* stack.c */
 /**
  * Stack の新しいインスタンスを生成する。
- * \free_func 要素を解放する際に用いるべき関数
  */
-Stack *stack_new(void (*free_func)(void *));
+Stack *stack_new(void);
+
+/**
+ * 前後をアクセスできないガード・ページで挟んだ固定長の Stack を生成す
+ * る。溢れた場合は guard_begin で捕まえる。
+ * \memlen 格納できる要素の数
+ */
+Stack *stack_new_guarded(size_t memlen);
 
 /**
  * Stack を解放する。
@@ -115,21 +555,105 @@ void stack_free(Stack *stack);
  * \stack スタック
  * \func 実行する関数
  */
-void stack_each(Stack *stack, void (*func)(void*));
+void stack_each(Stack *stack, void (*func)(Cell));
 
 /**
  * スタックに要素を追加する。
  * \stack スタック
  * \value 追加する要素
  */
-bool stack_push(Stack *stack, void *value);
+bool stack_push(Stack *stack, Cell value);
+
+/**
+ * スタックが少なくとも len 個の要素を格納できるようにメモリを確保する。
+ * \stack スタック
+ * \len 要素の数
+ */
+bool stack_reserve(Stack *stack, size_t len);
 
 /**
- * スタックから要素を取り出す。返された値は呼び出し側で適切に解放されね
- * ばならない。
+ * スタックから要素を取り出す。スタックが空の場合は FALSE を返す。
  * \stack スタック
+ * \value 取り出した要素の書き込み先
  */
-void *stack_pop(Stack *stack);
+bool stack_pop(Stack *stack, Cell *value);
+
+/* arena.c */
+/**
+ * Arena の新しいインスタンスを生成する。
+ */
+Arena *arena_new(void);
+
+/**
+ * Arena を、そこから確保したすべてのオブジェクトとともに解放する。
+ * \arena アリーナ
+ */
+void arena_free(Arena *arena);
+
+/**
+ * Arena から確保したすべてのオブジェクトを解放し、標準の大きさの領域
+ * を一つだけ残して再利用できる状態にする。
+ * \arena アリーナ
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * Arena からオブジェクトを確保する。確保に失敗した場合は NULL を返す。
+ * \arena アリーナ
+ * \size 確保する大きさ
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * 何もしない。アリーナから確保した要素を持つ Map や Stack に解放用の
+ * 関数として渡す。
+ * \p アリーナから確保したオブジェクト
+ */
+void arena_nofree(void *p);
+
+/* symbol.c */
+/**
+ * 文字列のハッシュ値 (FNV-1a) を計算する。
+ * \str 文字列
+ * \len 文字列の長さ
+ */
+unsigned int str_hash(char const *str, size_t len);
+
+/**
+ * 名前に対応するシンボルを返す。初めての名前であれば登録する。返され
+ * たシンボルはプロセスの終了まで有効で、解放してはならない。登録に失
+ * 敗した場合は NULL を返す。
+ * \name 名前
+ */
+Symbol const *symbol_intern(char const *name);
+
+/**
+ * symbol_intern と同様だが、NUL 終端されていない名前を受け付ける。
+ * \name 名前
+ * \len 名前の長さ
+ */
+Symbol const *symbol_intern_n(char const *name, size_t len);
+
+/**
+ * 登録済みの名前に対応するシンボルを返す。symbol_intern と違って登録
+ * しないので、語を引くときに使い、未定義の名前でインターン表を太らせ
+ * ない。登録されていなければ NULL を返す。
+ * \name 名前
+ */
+Symbol const *symbol_lookup(char const *name);
+
+/**
+ * symbol_lookup と同様だが、NUL 終端されていない名前を受け付ける。
+ * \name 名前
+ * \len 名前の長さ
+ */
+Symbol const *symbol_lookup_n(char const *name, size_t len);
+
+/**
+ * シンボルの名前を取得する。
+ * \symbol シンボル
+ */
+char const *symbol_name(Symbol const *symbol);
 
 /* map.c */
 /**
@@ -150,6 +674,13 @@ FreeFunc *map_value_free(Map const *map);
  */
 void map_free(Map *map);
 
+/**
+ * マップの要素をすべて取り除く。値は解放するが、スロットは解放せずに
+ * 再利用する。
+ * \map マップ
+ */
+void map_clear(Map *map);
+
 /**
  * マップに要素を加える。指定したキーに結びついた値がある場合は上書きさ
  * れる。成功した場合は TRUE、失敗した場合は FALSE を返す。
@@ -158,6 +689,13 @@ void map_free(Map *map);
  */
 bool map_put(Map *map, char const *key, void *value);
 
+/**
+ * map_put と同様だが、インターン済みのシンボルをキーとする。
+ * \key キー
+ * \value 値
+ */
+bool map_put_symbol(Map *map, Symbol const *key, void *value);
+
 /**
  * マップからキーに対応する値を返す。返された値を呼び出し側で解放しては
  * ならない。
@@ -166,24 +704,31 @@ bool map_put(Map *map, char const *key, void *value);
  */
 void *map_get(Map const *map, char const *key);
 
-/* value.c */
 /**
- * Value の新しいインスタンスを整数として生成する。
- * \i 整数
+ * map_get と同様だが、インターン済みのシンボルをキーとする。
+ * \map マップ
+ * \key キー
  */
-Value *value_new_integer(int i);
+void *map_get_symbol(Map const *map, Symbol const *key);
 
 /**
- * Value の新しいインスタンスを整数として生成する。
- * \str 整数の文字列表現
+ * マップのそれぞれの要素に対して関数を実行する。順序は不定である。
+ * \map マップ
+ * \func 実行する関数。キーと値と data が渡される
+ * \data 関数に渡すデータ
  */
-Value *value_new_integer_str(char const *str);
+void map_each(Map const *map,
+			  void (*func)(Symbol const *key, void *value, void *data),
+			  void *data);
 
+/* value.c */
 /**
- * Value を解放する。
- * \value 解放する値
+ * Value の新しいインスタンスを整数として生成する。Value はアリーナか
+ * ら確保され、アリーナとともに解放される。
+ * \arena アリーナ
+ * \i 整数
  */
-void value_free(Value *value);
+Value *value_new_integer(Arena *arena, int i);
 
 /**
  * Value の整数としての値を取得する。
@@ -198,11 +743,20 @@ int value_integer_value(Value *integer);
  */
 void value_str(Value const *value, char *buf, size_t size);
 
+/**
+ * セルの文字列表現を取得する。
+ * \cell セル
+ * \buf 文字列の書き込み先
+ * \size 書き込み文字数の制限値
+ */
+void cell_str(Cell cell, char *buf, size_t size);
+
 /**
  * Value の新しいインスタンスを関数として生成する。
+ * \arena アリーナ
  * \func 関数
  */
-Value *value_new_function(ForshFunc *func);
+Value *value_new_function(Arena *arena, ForshFunc *func);
 
 /**
  * Value の関数としての値を取得する
@@ -211,17 +765,66 @@ Value *value_new_function(ForshFunc *func);
 ForshFunc *value_function(Value const *value);
 
 /**
- * Value の新しいインスタンスをシンボルとして生成する。生成に失敗した場
- * 合は NULL が返される。
- * \name シンボルの名前
+ * Value の新しいインスタンスを定数として生成する。生成に失敗した場合
+ * は NULL が返される。
+ * \arena アリーナ
+ * \cell 定数が積むセル
+ */
+Value *value_new_constant(Arena *arena, Cell cell);
+
+/**
+ * Value の新しいインスタンスを内部インタープリターの命令として生成す
+ * る。文脈を扱う語 (データ空間など) をこれで表す。
+ * \arena アリーナ
+ * \op 命令の種別 (被演算子を持たないもの)
+ */
+Value *value_new_opcode(Arena *arena, Opcode op);
+
+/**
+ * Value の新しいインスタンスをコロン定義として生成する。
+ * \arena アリーナ
+ * \definition コロン定義
+ */
+Value *value_new_definition(Arena *arena, Definition *definition);
+
+/**
+ * コロン定義として生成された Value の定義を取得する。
+ * \value コロン定義として作られた Value のインスタンス
+ */
+Definition *value_definition(Value const *value);
+
+/**
+ * 定数として生成された Value のセルを取得する。
+ * \value 定数
  */
-Value *value_new_symbol(char const *name);
+Cell value_constant(Value const *value);
 
 /**
- * シンボルとして生成された Value の名前を取得する。
- * \value シンボル
+ * 命令として生成された Value の命令の種別を取得する。
+ * \value 命令
  */
-char const *value_symbol_name(Value const *value);
+Opcode value_opcode(Value const *value);
+
+/**
+ * Value の新しいインスタンスを配列として生成する。実行すると配列のセ
+ * ルを積む。
+ * \arena アリーナ
+ * \array 配列
+ */
+Value *value_new_array(Arena *arena, Array *array);
+
+/**
+ * 配列として生成された Value の配列を取得する。
+ * \value 配列
+ */
+Array *value_array(Value const *value);
+
+/**
+ * 名前がシンボル (変数名) として有効であれば TRUE を返す。
+ * \name 名前
+ * \len 名前の長さ
+ */
+bool value_is_valid_symbol(char const *name, size_t len);
 
 /* builtin.c */
 /** '+' を実装する */
@@ -232,6 +835,501 @@ Error *forsh_minus(Stack *stack);
 Error *forsh_star(Stack *stack);
 /** '/' を実装する */
 Error *forsh_slash(Stack *stack);
+/** 'DUP' を実装する */
+Error *forsh_dup(Stack *stack);
+/** 'DROP' を実装する */
+Error *forsh_drop(Stack *stack);
+/** 'SWAP' を実装する */
+Error *forsh_swap(Stack *stack);
+/** 'OVER' を実装する */
+Error *forsh_over(Stack *stack);
+/** 'THROW' を実装する */
+Error *forsh_throw(Stack *stack);
+/** 'CELLS' を実装する */
+Error *forsh_cells(Stack *stack);
+
+/* array.c */
+/**
+ * 要素がすべて 0 の配列をアリーナに確保する。確保できなければ NULL
+ * を返す。
+ * \arena アリーナ
+ * \name 名前
+ * \len 要素の数
+ */
+Array *array_new(Arena *arena, Symbol const *name, size_t len);
+
+/**
+ * 配列の語が要素をまとめて計算する実装を選ぶ。CPU が対応していない実
+ * 装であれば FALSE を返す。通常は最初の array_new で自動的に選ばれる。
+ * \impl 実装
+ */
+bool array_select(ArrayImpl impl);
+
+/** 'A@' ( i a -- x ) を実装する */
+Error *forsh_array_fetch(Stack *stack);
+/** 'A!' ( x i a -- ) を実装する */
+Error *forsh_array_store(Stack *stack);
+/** 'ALEN' ( a -- n ) を実装する */
+Error *forsh_array_length(Stack *stack);
+/** 'A+' ( a b c -- ) を実装する。c の各要素を a と b の和にする */
+Error *forsh_array_plus(Stack *stack);
+/** 'A-' ( a b c -- ) を実装する */
+Error *forsh_array_minus(Stack *stack);
+/** 'A*' ( a b c -- ) を実装する */
+Error *forsh_array_star(Stack *stack);
+/** 'A/' ( a b c -- ) を実装する。b に 0 があれば c を変えずにエラーとする */
+Error *forsh_array_slash(Stack *stack);
+/** 'ASUM' ( a -- n ) を実装する */
+Error *forsh_array_sum(Stack *stack);
+/** 'AMAX' ( a -- n ) を実装する。空の配列はエラーとする */
+Error *forsh_array_max(Stack *stack);
+/** 'ADOT' ( a b -- n ) を実装する。内積を求める */
+Error *forsh_array_dot(Stack *stack);
+
+/* lexer.c */
+/**
+ * 文字がトークンの区切り (空白または制御文字) であれば TRUE を返す。
+ * \c 文字
+ */
+bool lexer_is_delimiter(char c);
+
+/**
+ * 字句解析器が区切り文字を探す実装を選ぶ。CPU が対応していない実装で
+ * あれば FALSE を返す。通常は最初の lexer_init で自動的に選ばれる。
+ * \impl 実装
+ */
+bool lexer_select(LexerImpl impl);
+
+/**
+ * 字句解析器を初期化する。
+ * \lexer 字句解析器
+ * \buf 解析するバッファ
+ * \len バッファの長さ
+ */
+void lexer_init(Lexer *lexer, char const *buf, size_t len);
+
+/**
+ * 次のトークンを切り出す。トークンがなければ FALSE を返す。
+ * \lexer 字句解析器
+ * \token トークンの先頭の書き込み先
+ * \len トークンの長さの書き込み先
+ */
+bool lexer_next(Lexer *lexer, char const **token, size_t *len);
+
+/**
+ * トークンを base 進数の整数として読む。先頭に '-' があれば負の数とす
+ * る。整数として読めれば値を書き込んで TRUE を返し、数字でない文字を含
+ * む場合や int に収まらない場合は FALSE を返す。判別と変換は一度の走査
+ * で行う。
+ * \str トークン
+ * \len トークンの長さ
+ * \base 基数 (2 以上 36 以下)
+ * \value 値の書き込み先
+ */
+bool lexer_integer(char const *str, size_t len, unsigned int base, int *value);
+
+/* definition.c */
+/**
+ * Definition の新しいインスタンスを生成する。Definition はアリーナか
+ * ら確保され、コンパイルが完了した後はアリーナとともに解放される。
+ * \arena アリーナ
+ * \name 定義する語の名前
+ */
+Definition *definition_new(Arena *arena, Symbol const *name);
+
+/**
+ * コンパイル中の Definition を破棄する。
+ * \definition コロン定義
+ */
+void definition_free(Definition *definition);
+
+/**
+ * 命令の被演算子の数を返す。
+ * \op 命令の種別
+ */
+int opcode_operands(Opcode op);
+
+/**
+ * 命令の名前を返す。
+ * \op 命令の種別
+ */
+char const *opcode_name(Opcode op);
+
+/**
+ * 命令が分岐 (被演算子が相対位置であるもの) であれば TRUE を返す。
+ * \op 命令の種別
+ */
+bool opcode_is_branch(Opcode op);
+
+/**
+ * ビルトイン関数に対応する命令の種別を返す。内部インタープリターが直接
+ * 実装していない関数であれば OP_CALL を返す。
+ * \func ビルトイン関数
+ */
+Opcode opcode_of_function(ForshFunc *func);
+
+/**
+ * コロン定義の末尾にコードを一語加える。
+ * \definition コロン定義
+ * \inst 加えるコード
+ */
+bool definition_emit(Definition *definition, Inst inst);
+
+/**
+ * コロン定義の末尾に命令を加える。
+ * \definition コロン定義
+ * \op 命令の種別
+ */
+bool definition_emit_op(Definition *definition, Opcode op);
+
+/**
+ * コロン定義の末尾に分岐を加える。分岐先がまだ決まっていなければ、
+ * 後で definition_resolve で埋める。
+ * \definition コロン定義
+ * \op 分岐の種別
+ * \target 分岐先の位置
+ */
+bool definition_emit_branch(Definition *definition, Opcode op, size_t target);
+
+/**
+ * 加えておいた分岐の分岐先を、コロン定義の現在の末尾にする。
+ * \definition コロン定義
+ * \operand 分岐の被演算子の位置
+ */
+void definition_resolve(Definition *definition, size_t operand);
+
+/**
+ * コロン定義のコンパイルを完了し、第 0 層のコードとして実行できる状態
+ * にする。コードはアリーナに移される。
+ * \arena アリーナ
+ * \definition コロン定義
+ */
+bool definition_finish(Arena *arena, Definition *definition);
+
+/**
+ * 第 0 層のコロン定義を最適化したコードに置き換える。頻出する命令の組
+ * はスーパー命令にまとめられる。置き換える前のコードは、実行中の呼び
+ * 出しから戻れるようにアリーナに残す。
+ * \arena アリーナ
+ * \definition コロン定義
+ */
+bool definition_promote(Arena *arena, Definition *definition);
+
+/**
+ * コロン定義が第 0 層であれば TRUE を返す。
+ * \definition コロン定義
+ */
+bool definition_is_cold(Definition const *definition);
+
+/**
+ * コロン定義のコードを逆アセンブルして表示する。
+ * \definition コロン定義
+ * \out 出力先
+ */
+void definition_dump(Definition const *definition, Output *out);
+
+/* data.c */
+/**
+ * データ空間の次に確保する位置の番地 (HERE) を返す。
+ * \data データ空間
+ */
+int data_here(Stack const *data);
+
+/**
+ * データ空間を確保する (ALLOT)。セルの境界を保つよう、バイト数はセル
+ * の大きさの倍数に切り上げる。確保した領域は 0 で埋める。負であれば
+ * 解放する。
+ * \data データ空間
+ * \bytes 確保するバイト数
+ */
+bool data_allot(Stack *data, int bytes);
+
+/**
+ * 番地が指すデータ空間のセルを返す。データ空間の外か、セルの境界にな
+ * い番地であれば NULL を返す。
+ * \data データ空間
+ * \address 番地 (整数のセル)
+ */
+static inline Cell *data_cell(Stack const *data, Cell address)
+{
+	uintptr_t offset;
+	offset = (uintptr_t) (intptr_t) cell_integer(address);
+	if (0 != offset % sizeof(Cell) || data->len * sizeof(Cell) <= offset) {
+		return NULL;
+	}
+	return &data->values[offset / sizeof(Cell)];
+}
+
+/* output.c */
+/**
+ * 出力を生成する。書き込み先が端末であれば改行ごとに書き出す。
+ * \fd 書き込み先のファイル記述子
+ */
+Output *output_new(int fd);
+
+/**
+ * 溜まっている出力を書き出してから、書き込み先を変える。
+ * \output 出力
+ * \fd 書き込み先のファイル記述子
+ */
+void output_redirect(Output *output, int fd);
+
+/**
+ * 溜まっている出力を書き出してから、出力を解放する。
+ * \output 出力
+ */
+void output_free(Output *output);
+
+/**
+ * 溜まっている出力を書き出す。書き込みに失敗すれば FALSE を返す。
+ * \output 出力
+ */
+bool output_flush(Output *output);
+
+/**
+ * 文字列を出力する。
+ * \output 出力
+ * \str 文字列
+ * \len 文字列の長さ
+ */
+void output_write(Output *output, char const *str, size_t len);
+
+/**
+ * 一文字を出力する。
+ * \output 出力
+ * \c 文字
+ */
+void output_char(Output *output, char c);
+
+/**
+ * 整数を base 進数で出力する。
+ * \output 出力
+ * \n 整数
+ * \base 基数 (2 以上 36 以下)
+ */
+void output_integer(Output *output, int n, unsigned int base);
+
+/**
+ * セルを出力する。整数は base 進数で出力する。
+ * \output 出力
+ * \cell セル
+ * \base 基数 (2 以上 36 以下)
+ */
+void output_cell(Output *output, Cell cell, unsigned int base);
+
+/**
+ * printf と同じ書式で出力する。1023 バイトを超える分は切り捨てる。
+ * \output 出力
+ * \format 書式
+ */
+void output_format(Output *output, char const *format, ...);
+
+/* guard.c */
+/**
+ * ガード・ページへのアクセスを捕まえる範囲を開始する。初めて呼び出し
+ * たときに SIGSEGV のハンドラーを設定する。範囲はスレッドごとに入れ子
+ * にできる。
+ * \guard 範囲
+ * \stack 見張るスタック
+ * \rstack 見張るリターン・スタック
+ */
+void guard_begin(Guard *guard, Stack const *stack, Stack const *rstack);
+
+/**
+ * guard_begin で開始した範囲を終了する。
+ * \guard 範囲
+ */
+void guard_end(Guard *guard);
+
+/* effect.c */
+/**
+ * 最適化する前のコードのスタック効果を推論する。OP_CALL や推論できて
+ * いない定義の呼び出しを含む場合、実行するとエラーになることがわかっ
+ * ている場合は known を FALSE にする。
+ * \effect 推論したスタック効果の書き込み先
+ * \code コード
+ * \len コードの長さ
+ */
+void effect_infer(Effect *effect, Inst const *code, size_t len);
+
+/* vm.c */
+/**
+ * 命令の種別で表されたコードを内部インタープリターが実行する形式に変
+ * 換する。変換後のコードはアリーナから確保される。
+ * \arena アリーナ
+ * \code コード
+ * \len コードの長さ
+ * \unchecked 検査を省いた命令があればそれに置き換えるなら TRUE
+ */
+Inst *vm_thread(Arena *arena, Inst const *code, size_t len, bool unchecked);
+
+/**
+ * コロン定義を実行する。
+ * \context 文脈
+ * \definition 実行するコロン定義
+ */
+Error *vm_execute(Context *context, Definition const *definition);
+
+/**
+ * 被演算子を持たない命令を一つ実行する。
+ * \context 文脈
+ * \op 命令の種別
+ */
+Error *vm_execute_op(Context *context, Opcode op);
+
+/**
+ * 第 0 層のコロン定義を、そこから呼び出す定義とともに最適化し、JIT が
+ * 使えれば機械語に翻訳する。
+ * \context 文脈
+ * \definition コロン定義
+ */
+void vm_promote(Context *context, Definition *definition);
+
+/**
+ * コロン定義の ENTER と EXIT を、計測する命令 (enable が TRUE の場合)
+ * または元の命令に置き換える。計測しないときの命令ループには手を加え
+ * ないので、計測していなければ余分な負荷はかからない。
+ * \definition コロン定義
+ * \enable 計測するなら TRUE
+ */
+void vm_profile(Definition *definition, bool enable);
+
+/**
+ * リターン・スタックに n 個の要素を積む余地を確保する。FORSH_RSTACK_MAX
+ * を超えるか、確保できなければ FALSE を返す。
+ * \rstack リターン・スタック
+ * \n 積む要素の数
+ */
+bool vm_reserve_rstack(Stack *rstack, size_t n);
+
+/**
+ * リターン・スタックが溢れたエラーを起こす命令の番地を返す。翻訳され
+ * た機械語が戻り番地を積めなかった場合に、内部インタープリターをそこ
+ * から再開する。
+ */
+Inst const *vm_overflow(void);
+
+/* jit.c */
+/**
+ * Jit の新しいインスタンスを生成する。この環境で JIT が使えない場合は
+ * NULL を返す。
+ */
+Jit *jit_new(void);
+
+/**
+ * Jit を、生成した機械語とともに解放する。
+ * \jit JIT コンパイラー
+ */
+void jit_free(Jit *jit);
+
+/**
+ * 翻訳した機械語を入口を除いてすべて捨てる。最も古い領域は解放せずに
+ * 再利用する。翻訳したコロン定義を実行しなくなってから呼び出す。
+ * \jit JIT コンパイラー
+ */
+void jit_reset(Jit *jit);
+
+/**
+ * コンパイルを完了したコロン定義を機械語に翻訳し、definition->native
+ * に設定する。翻訳できない命令や、翻訳されていない定義の呼び出しを含む
+ * 場合は FALSE を返し、定義は内部インタープリターで実行される。
+ * \jit JIT コンパイラー
+ * \definition コロン定義
+ */
+bool jit_compile(Jit *jit, Definition *definition);
+
+/**
+ * 翻訳されたコロン定義を実行する。最後まで実行できれば NULL を返す。
+ * エラーになりうる命令に達した場合は、その命令以降を内部インタープリター
+ * で実行できるように、スタックとリターン・スタックを整えてその命令の番
+ * 地を返す。
+ * \context 文脈
+ * \definition 翻訳されたコロン定義
+ */
+Inst const *jit_execute(Context *context, Definition const *definition);
+
+/* task.c */
+/**
+ * SPAWN ( x1 .. xn n xt -- task )。スタックの上の n 個を種にした子の
+ * スタックで xt をスレッド・プールで実行するタスクを作り、そのハンド
+ * ルを積む。
+ * \context 文脈
+ */
+Error *task_spawn(Context *context);
+
+/**
+ * JOIN ( task -- y1 .. ym )。タスクの終わりを待ち、子のスタックの内容
+ * を積む。待つ間は他のタスクを実行する。タスクでエラーが起きていれば、
+ * そのエラーを返す。
+ * \context 文脈
+ */
+Error *task_join(Context *context);
+
+/**
+ * PMAP ( a b xt -- )。b の各要素を、a の同じ位置の要素に xt ( x -- y )
+ * を実行した結果にする。a を塊に分けて THREADS で設定した数までのス
+ * レッドで計算する。a と b は同じ配列でもよい。
+ * \context 文脈
+ */
+Error *task_map(Context *context);
+
+/**
+ * PREDUCE ( a x xt -- y )。x と a の要素を xt ( acc x -- acc ) で順に
+ * 畳み込む。a の塊ごとに並列に畳み込んでから、その結果を x から順に
+ * 畳み込むので、xt が結合的であれば逐次に畳み込んだ結果と一致する。
+ * \context 文脈
+ */
+Error *task_reduce(Context *context);
+
+/**
+ * 文脈が SPAWN したタスクがすべて終わるまで待つ。タスクが共有してい
+ * る定義やシンボル・テーブルを書き換える前に呼び出す。
+ * \context 文脈
+ */
+void task_quiesce(Context *context);
+
+/**
+ * 文脈が SPAWN して JOIN していないタスクの終わりを待ち、結果を捨て
+ * て解放する。
+ * \context 文脈
+ */
+void task_discard(Context *context);
+
+/**
+ * 文脈が SPAWN したタスクのうち終わっていないものの数を返す。
+ * \context 文脈
+ */
+static inline size_t task_running(Context const *context)
+{
+	return __atomic_load_n(&context->running, __ATOMIC_ACQUIRE);
+}
+
+/* profile.c */
+/**
+ * 計測に用いる時刻を返す。x86 ではタイム・スタンプ・カウンターのサイ
+ * クル数、それ以外ではナノ秒を単位とする。
+ */
+uint64_t profile_clock(void);
+
+/**
+ * 文脈での語の実行の計測を開始または終了する。
+ * \context 文脈
+ * \enable 計測を開始するなら TRUE
+ */
+void profile_enable(Context *context, bool enable);
+
+/**
+ * 文脈のすべての語の計測結果を消去する。
+ * \context 文脈
+ */
+void profile_reset(Context *context);
+
+/**
+ * 計測結果を、実行に要したサイクル数の多い語から順に表示する。
+ * \context 文脈
+ * \out 出力先
+ */
+void profile_report(Context const *context, Output *out);
 
 /* context.c */
 /**
@@ -239,12 +1337,60 @@ Error *forsh_slash(Stack *stack);
  */
 Context *context_new(void);
 
+/**
+ * スタックとリターン・スタックをガード・ページで挟んだ固定長にした
+ * Context を生成する。溢れた場合はエラーとなり、ABORT と同じく両方の
+ * スタックが空になる。
+ * \memlen スタックに格納できる要素の数
+ */
+Context *context_new_guarded(size_t memlen);
+
+/**
+ * タスクを実行するための子の文脈を生成する。スタックとリターン・スタッ
+ * クだけを持ち、シンボル・テーブル、データ空間、JIT は親と共有する。
+ * 共有しているものは書き換えない。
+ * \parent 親の文脈
+ */
+Context *context_new_task(Context *parent);
+
+/**
+ * 語を実行する。
+ * \context 文脈
+ * \value 語 (関数、命令、コロン定義または定数)
+ */
+Error *context_execute(Context *context, Value *value);
+
+/**
+ * 語を引く。文脈で定義した語を、すべての文脈が共有するビルトインの語
+ * より優先する。見つからなければ NULL を返す。
+ * \context 文脈
+ * \key 語の名前
+ */
+Value *context_resolve(Context const *context, Symbol const *key);
+
+/**
+ * 共有しているビルトインの語の値を文脈のシンボル・テーブルに複製する。
+ * 値を書き換える (計測結果を記録する) 前に呼び出し、共有している値を
+ * 書き換えないようにする。再定義された語は複製しない。
+ * \context 文脈
+ */
+void context_own_builtins(Context *context);
+
 /**
  * Context を解放する。
  * \context 解放する Context
  */
 void context_free(Context *context);
 
+/**
+ * Context を生成した直後の状態に戻す。スタック、データ空間、定義した
+ * 語と翻訳した機械語を捨て、基数や出力先などの設定を既定値に戻す。確
+ * 保したメモリーは解放せずに次の解釈で再利用する。タスクの文脈には使
+ * えない。
+ * \context 文脈
+ */
+void context_reset(Context *context);
+
 /**
  * Context の内容を表示する。
  * \context 表示する Context
@@ -258,6 +1404,45 @@ void context_describe(Context const *context);
  */
 Error *context_interpret(Context *context, const char *str);
 
+/**
+ * context_interpret と同様だが、NUL 終端されていないトークンを受け付
+ * ける。トークンは複製されないので、読み込んだバッファの一部をそのまま
+ * 渡すことができる。
+ * \context 文脈
+ * \str 解釈するトークン文字列
+ * \len トークン文字列の長さ
+ */
+Error *context_interpret_n(Context *context, const char *str, size_t len);
+
+/* pool.c */
+/**
+ * 文脈のプールを生成する。size 個の文脈をあらかじめ生成しておく。
+ * \size あらかじめ生成し、空いたままにしておく文脈の数
+ */
+ContextPool *context_pool_new(size_t size);
+
+/**
+ * プールを、空いている文脈とともに解放する。貸し出し中の文脈はすべて
+ * 返されていなければならない。
+ * \pool プール
+ */
+void context_pool_free(ContextPool *pool);
+
+/**
+ * プールから文脈を借りる。空いている文脈がなければ新しく生成する。複
+ * 数のスレッドから呼び出してよい。失敗した場合は NULL を返す。
+ * \pool プール
+ */
+Context *context_pool_acquire(ContextPool *pool);
+
+/**
+ * 借りた文脈を context_reset してプールに返す。空いている文脈が上限に
+ * 達していれば解放する。複数のスレッドから呼び出してよい。
+ * \pool プール
+ * \context 借りた文脈
+ */
+void context_pool_release(ContextPool *pool, Context *context);
+
 /* error.c */
 /**
  * Error の新しいインスタンスを初期化する
@@ -266,6 +1451,21 @@ Error *context_interpret(Context *context, const char *str);
  */
 Error *error_new(ErrorType type, char const *message);
 
+/**
+ * error_new と同様だが、NUL 終端されていないメッセージを受け付ける。
+ * \type エラー種別
+ * \message エラーメッセージ
+ * \len エラーメッセージの長さ
+ */
+Error *error_new_n(ErrorType type, char const *message, size_t len);
+
+/**
+ * 例外番号に対応する Error を取得する。番号に対応する種別がなければ
+ * ThrownError とする。
+ * \code 例外番号 (0 以外)
+ */
+Error *error_new_code(int code);
+
 /**
  * Error を解放する。
  * \error エラー
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+#include <signal.h>
+
+/*
+ * ガード・ページで挟んだスタックでは、溢れた読み書きが SIGSEGV になる。
+ * ハンドラーはそれが見張っているスタックのガード・ページへのアクセス
+ * であれば、guard_begin した場所へ siglongjmp で戻す。ハンドラーから
+ * 戻らないので、SA_NODEFER で SIGSEGV をブロックしないようにしておく。
+ */
+
+/** 実行中のスレッドで最も内側の範囲 */
+static THREAD_LOCAL Guard *guard_current;
+
+/** SIGSEGV のハンドラーを一度だけ設定するための制御変数 */
+static pthread_once_t guard_once = PTHREAD_ONCE_INIT;
+
+/** ガード・ページ以外へのアクセスのために、元のハンドラーを残しておく */
+static struct sigaction guard_default;
+
+/**
+ * 番地がスタックのガード・ページにあれば、そのエラーの種別を返す。な
+ * ければ -1 を返す。
+ * \stack スタック
+ * \addr 番地
+ */
+static int guard_fault(Stack const *stack, Cell const *addr);
+
+/**
+ * SIGSEGV のハンドラー。
+ * \sig シグナル
+ * \info シグナルの情報
+ * \ucontext シグナルを受けたときの文脈
+ */
+static void guard_handler(int sig, siginfo_t *info, void *ucontext);
+
+/**
+ * ガード・ページ以外へのアクセスを元のハンドラーに渡す。元のハンドラー
+ * が回復すれば、ガードのハンドラーはそのまま残る。
+ * \sig シグナル
+ * \info シグナルの情報
+ * \ucontext シグナルを受けたときの文脈
+ */
+static void guard_chain(int sig, siginfo_t *info, void *ucontext);
+
+/**
+ * SIGSEGV のハンドラーを設定する。pthread_once で一度だけ呼び出す。
+ */
+static void guard_install(void);
+
+static int guard_fault(Stack const *stack, Cell const *addr)
+{
+	Cell const *bottom;
+	Cell const *top;
+	if (0 == stack->guard) {
+		return -1;
+	}
+	bottom = stack->values - 1;
+	top = stack->values + stack->memlen - stack->guard;
+	if (bottom - stack->guard <= addr && addr < bottom) {
+		return EmptyStackError;
+	}
+	if (top <= addr && addr < top + stack->guard) {
+		return StackOverflowError;
+	}
+	return -1;
+}
+
+static void guard_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	Guard *guard;
+	int fault = -1;
+	guard = guard_current;
+	if (NULL != guard) {
+		fault = guard_fault(guard->stack, (Cell const *) info->si_addr);
+		if (fault < 0) {
+			fault = guard_fault(guard->rstack, (Cell const *) info->si_addr);
+		}
+	}
+	if (fault < 0) {  // スタックとは関係のない不正なアクセス
+		guard_chain(sig, info, ucontext);
+		return;
+	}
+	guard->fault = (ErrorType) fault;
+	guard_current = guard->prev;
+	siglongjmp(guard->env, 1);
+}
+
+static void guard_chain(int sig, siginfo_t *info, void *ucontext)
+{
+	if (0 != (guard_default.sa_flags & SA_SIGINFO)) {
+		guard_default.sa_sigaction(sig, info, ucontext);
+	} else if (SIG_DFL == guard_default.sa_handler
+			   || SIG_IGN == guard_default.sa_handler) {
+		/*
+		 * 既定の動作は終了なので、既定に戻して同じ命令を再び実行する。
+		 * 不正なアクセスの SIGSEGV は無視できない
+		 */
+		signal(SIGSEGV, SIG_DFL);
+	} else {
+		guard_default.sa_handler(sig);
+	}
+}
+
+static void guard_install(void)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = guard_handler;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, &guard_default);
+}
+
+void guard_begin(Guard *guard, Stack const *stack, Stack const *rstack)
+{
+	pthread_once(&guard_once, guard_install);
+	guard->stack = stack;
+	guard->rstack = rstack;
+	guard->prev = guard_current;
+	guard_current = guard;
+}
+
+void guard_end(Guard *guard)
+{
+	guard_current = guard->prev;
+}
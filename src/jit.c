@@ -0,0 +1,831 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/*
+ * コロン定義を x86-64 の機械語に翻訳する JIT。命令ごとに決まった機械
+ * 語の断片 (テンプレート) をつなげる。
+ *
+ * 翻訳した機械語は次のレジスターを用いる。
+ *   rbx: スタック (Stack *)
+ *   rbp: リターン・スタック (Stack *)
+ *   r12: スタックの次に積む位置 (Cell *)
+ *   r13: スタックの確保済みの末尾 (Cell *)
+ *   r14: スタックの底 (Cell *)
+ *   r15: スタックの一番上の値 (キャッシュしている場合)
+ * スタックの一番上はなるべく r15 に置いたままにし、メモリには書き出さ
+ * ない。r15 に置いている間も、メモリにはそれを書き出す余地を残しておく。
+ *
+ * 算術命令は整数であることを確かめて直接計算し、他の定義は機械語どう
+ * しで直接呼び出す。スタックが足りない、型が違う、ゼロで割るといった
+ * エラーになりうる場合は、その命令の直前の状態にスタックを戻して命令の
+ * 番地を返し、以降は内部インタープリターが実行する (脱最適化)。エラー
+ * の種別やスタックの状態は内部インタープリターと同じになる。
+ *
+ * スタック効果を推論できた定義は、先頭の OP_CHECK でスタックを一度に
+ * 検査し、以降の命令では深さと型と積む余地を検査しない。
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(FORSH_NO_JIT)
+#define FORSH_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef FORSH_JIT
+
+/** 実行可能な領域を確保する単位 */
+static size_t const JIT_CHUNK_SIZE = 64 * 1024;
+
+/** 機械語の外への飛び先の種類 */
+typedef enum _JitStubKind JitStubKind;
+enum _JitStubKind {
+	STUB_BAIL,   /* 内部インタープリターに戻る */
+	STUB_GROW,   /* スタックを拡大して戻ってくる */
+	STUB_FRAME,  /* 呼び出し先から戻ったら自分の戻り番地を積んで戻る */
+};
+
+/** 本体の後ろに置く、めったに通らない処理 */
+typedef struct _JitStub JitStub;
+struct _JitStub {
+	JitStubKind kind;  /* 種類 */
+	size_t patch;      /* 飛び先の相対番地を書き込む位置 */
+	size_t index;      /* 対応する命令の位置 */
+	bool cached;       /* 飛んだ時点でスタックの一番上が r15 にあるか */
+	size_t back;       /* STUB_GROW から戻る位置 */
+};
+
+/** 翻訳中の状態 */
+typedef struct _JitCompiler JitCompiler;
+struct _JitCompiler {
+	unsigned char *code;  /* 生成中の機械語 */
+	size_t len;           /* 機械語の長さ */
+	size_t memlen;        /* 機械語に確保されているメモリの長さ */
+	JitStub *stubs;       /* 本体の後ろに置く処理 */
+	size_t nstubs;        /* その数 */
+	size_t stubs_memlen;  /* 確保されている数 */
+	bool ok;              /* メモリの確保に失敗したら FALSE */
+	bool cached;          /* スタックの一番上を r15 に置いているか */
+	bool safe;            /* OP_CHECK を通り、命令ごとの検査を省けるか */
+	size_t index;         /* 翻訳中の命令の位置 */
+	Definition const *definition;  /* 翻訳中の定義 */
+};
+
+/** 機械語のバイト列を加える */
+#define EMIT(jc, bytes) jit_emit((jc), (bytes), sizeof(bytes) - 1)
+
+/** Stack のメンバーの位置 */
+#define STACK_VALUES ((char) offsetof(Stack, values))
+#define STACK_LEN ((char) offsetof(Stack, len))
+#define STACK_MEMLEN ((char) offsetof(Stack, memlen))
+
+/* 条件分岐の種類 (0F 8x の x) */
+#define CC_B 0x82
+#define CC_AE 0x83
+#define CC_Z 0x84
+#define CC_NZ 0x85
+#define CC_A 0x87
+
+/**
+ * 機械語を加える。
+ * \jc 翻訳中の状態
+ * \bytes バイト列
+ * \n バイト数
+ */
+static void jit_emit(JitCompiler *jc, char const *bytes, size_t n);
+
+/**
+ * 32 ビットの値を加える。
+ * \jc 翻訳中の状態
+ * \v 値
+ */
+static void jit_emit32(JitCompiler *jc, uint32_t v);
+
+/**
+ * 64 ビットの値を加える。
+ * \jc 翻訳中の状態
+ * \v 値
+ */
+static void jit_emit64(JitCompiler *jc, uint64_t v);
+
+/**
+ * 本体の後ろに置く処理への条件分岐を加える。
+ * \jc 翻訳中の状態
+ * \cc 条件
+ * \kind 飛び先の種類
+ */
+static void jit_branch(JitCompiler *jc, int cc, JitStubKind kind);
+
+/**
+ * スタックのメモリ上の要素が depth 個以上なければ内部インタープリター
+ * に戻る分岐を加える。
+ * \jc 翻訳中の状態
+ * \depth 要素の数
+ */
+static void jit_need(JitCompiler *jc, int depth);
+
+/**
+ * スタックの一番上を r15 に読み込む。
+ * \jc 翻訳中の状態
+ */
+static void jit_fill(JitCompiler *jc);
+
+/**
+ * r15 に置いているスタックの一番上をメモリに書き出す。
+ * \jc 翻訳中の状態
+ */
+static void jit_spill(JitCompiler *jc);
+
+/**
+ * スタックに一つ積む余地がなければ拡大する。
+ * \jc 翻訳中の状態
+ */
+static void jit_reserve(JitCompiler *jc);
+
+/**
+ * 命令を一つ翻訳する。翻訳できない命令であれば FALSE を返す。
+ * \jc 翻訳中の状態
+ * \op 命令の種別
+ * \operand 被演算子
+ */
+static bool jit_inst(JitCompiler *jc, Opcode op, Inst const *operand);
+
+/**
+ * 本体の後ろに置く処理を加え、そこへの分岐の番地を埋める。
+ * \jc 翻訳中の状態
+ */
+static void jit_stubs(JitCompiler *jc);
+
+/**
+ * 実行可能な領域に機械語を置く。失敗した場合は NULL を返す。
+ * \jit JIT コンパイラー
+ * \code 機械語
+ * \len 機械語の長さ
+ */
+static void const *jit_install(Jit *jit, unsigned char const *code,
+							   size_t len);
+
+/**
+ * スタックに一つ積む余地を確保する。機械語から呼び出す。
+ * \stack スタック
+ */
+static bool jit_grow(Stack *stack);
+
+/**
+ * 呼び出し先が内部インタープリターに戻る場合に、呼び出し元の戻り番地
+ * をリターン・スタックに積む。機械語から呼び出す。積めなければ、溢れ
+ * たエラーを起こす命令から再開させる。
+ * \rstack リターン・スタック
+ * \resume 内部インタープリターが再開する番地
+ * \continuation 呼び出し元の戻り番地
+ */
+static Inst const *jit_push_frame(Stack *rstack, Inst const *resume,
+								  Inst const *continuation);
+
+static void jit_emit(JitCompiler *jc, char const *bytes, size_t n)
+{
+	if (jc->memlen < jc->len + n) {
+		unsigned char *code;
+		size_t memlen;
+		memlen = jc->memlen * 2 + n;
+		code = (unsigned char *) realloc(jc->code, memlen);
+		if (NULL == code) {
+			jc->ok = FALSE;
+			return;
+		}
+		jc->code = code;
+		jc->memlen = memlen;
+	}
+	memcpy(&jc->code[jc->len], bytes, n);
+	jc->len += n;
+}
+
+static void jit_emit32(JitCompiler *jc, uint32_t v)
+{
+	jit_emit(jc, (char const *) &v, sizeof(v));
+}
+
+static void jit_emit64(JitCompiler *jc, uint64_t v)
+{
+	jit_emit(jc, (char const *) &v, sizeof(v));
+}
+
+static void jit_branch(JitCompiler *jc, int cc, JitStubKind kind)
+{
+	JitStub *stub;
+	char bytes[2];
+	if (jc->stubs_memlen <= jc->nstubs) {
+		JitStub *stubs;
+		size_t memlen;
+		memlen = jc->stubs_memlen * 2 + 16;
+		stubs = (JitStub *) realloc(jc->stubs, sizeof(JitStub) * memlen);
+		if (NULL == stubs) {
+			jc->ok = FALSE;
+			return;
+		}
+		jc->stubs = stubs;
+		jc->stubs_memlen = memlen;
+	}
+	bytes[0] = 0x0f;
+	bytes[1] = (char) cc;
+	jit_emit(jc, bytes, 2);
+	stub = &jc->stubs[jc->nstubs++];
+	stub->kind = kind;
+	stub->patch = jc->len;
+	stub->index = jc->index;
+	stub->cached = jc->cached;
+	jit_emit32(jc, 0);
+	stub->back = jc->len;
+}
+
+static void jit_need(JitCompiler *jc, int depth)
+{
+	char disp;
+	if (depth <= 0 || jc->safe) {
+		return;
+	}
+	disp = (char) (-8 * depth);
+	EMIT(jc, "\x49\x8d\x44\x24");  // lea rax, [r12 - 8 * depth]
+	jit_emit(jc, &disp, 1);
+	EMIT(jc, "\x4c\x39\xf0");      // cmp rax, r14
+	jit_branch(jc, CC_B, STUB_BAIL);
+}
+
+static void jit_fill(JitCompiler *jc)
+{
+	if (jc->cached) {
+		return;
+	}
+	jit_need(jc, 1);
+	EMIT(jc, "\x49\x83\xec\x08");  // sub r12, 8
+	EMIT(jc, "\x4d\x8b\x3c\x24");  // mov r15, [r12]
+	jc->cached = TRUE;
+}
+
+static void jit_spill(JitCompiler *jc)
+{
+	if (!jc->cached) {
+		return;
+	}
+	EMIT(jc, "\x4d\x89\x3c\x24");  // mov [r12], r15
+	EMIT(jc, "\x49\x83\xc4\x08");  // add r12, 8
+	jc->cached = FALSE;
+}
+
+static void jit_reserve(JitCompiler *jc)
+{
+	if (jc->safe) {
+		return;
+	}
+	EMIT(jc, "\x4d\x39\xec");      // cmp r12, r13
+	jit_branch(jc, CC_AE, STUB_GROW);
+}
+
+/** 一番上と二番目がともに整数でなければ内部インタープリターに戻る */
+static void jit_check_two(JitCompiler *jc)
+{
+	if (jc->safe) {
+		return;
+	}
+	EMIT(jc, "\x49\x8b\x44\x24\xf8");  // mov rax, [r12 - 8]
+	EMIT(jc, "\x4c\x21\xf8");          // and rax, r15
+	EMIT(jc, "\xa8\x01");              // test al, 1
+	jit_branch(jc, CC_Z, STUB_BAIL);
+}
+
+/** 一番上が整数でなければ内部インタープリターに戻る */
+static void jit_check_top(JitCompiler *jc)
+{
+	if (jc->safe) {
+		return;
+	}
+	EMIT(jc, "\x41\xf6\xc7\x01");  // test r15b, 1
+	jit_branch(jc, CC_Z, STUB_BAIL);
+}
+
+/** eax に一番上の整数を、ecx に二番目の整数を読む */
+static void jit_load_top_second(JitCompiler *jc)
+{
+	EMIT(jc, "\x4c\x89\xf8");          // mov rax, r15
+	EMIT(jc, "\x48\xd1\xf8");          // sar rax, 1
+	EMIT(jc, "\x49\x8b\x4c\x24\xf8");  // mov rcx, [r12 - 8]
+	EMIT(jc, "\x48\xd1\xf9");          // sar rcx, 1
+}
+
+/** eax に二番目の整数を、ecx に一番上の整数を読む */
+static void jit_load_second_top(JitCompiler *jc)
+{
+	EMIT(jc, "\x49\x8b\x44\x24\xf8");  // mov rax, [r12 - 8]
+	EMIT(jc, "\x48\xd1\xf8");          // sar rax, 1
+	EMIT(jc, "\x4c\x89\xf9");          // mov rcx, r15
+	EMIT(jc, "\x48\xd1\xf9");          // sar rcx, 1
+}
+
+/** eax に一番上の整数を、ecx に整数 n を読む */
+static void jit_load_top_literal(JitCompiler *jc, Cell n)
+{
+	EMIT(jc, "\x4c\x89\xf8");  // mov rax, r15
+	EMIT(jc, "\x48\xd1\xf8");  // sar rax, 1
+	EMIT(jc, "\xb9");          // mov ecx, n
+	jit_emit32(jc, (uint32_t) cell_integer(n));
+}
+
+/**
+ * eax と ecx を演算して eax に置く。int の演算と同じく 32 ビットで桁
+ * あふれする。
+ */
+static void jit_arith(JitCompiler *jc, Opcode op)
+{
+	switch (op) {
+	case OP_PLUS:
+		EMIT(jc, "\x01\xc8");      // add eax, ecx
+		break;
+	case OP_MINUS:
+		EMIT(jc, "\x29\xc8");      // sub eax, ecx
+		break;
+	case OP_STAR:
+		EMIT(jc, "\x0f\xaf\xc1");  // imul eax, ecx
+		break;
+	default:
+		/* INT_MIN / -1 は例外になるので、-1 で割るときは符号を反転する */
+		EMIT(jc, "\x83\xf9\xff");  // cmp ecx, -1
+		EMIT(jc, "\x75\x04");      // jne .div
+		EMIT(jc, "\xf7\xd8");      // neg eax
+		EMIT(jc, "\xeb\x03");      // jmp .done
+		EMIT(jc, "\x99");          // .div: cdq
+		EMIT(jc, "\xf7\xf9");      // idiv ecx
+		break;                     // .done:
+	}
+}
+
+/** eax の整数をセルにして r15 に置く */
+static void jit_tag(JitCompiler *jc)
+{
+	EMIT(jc, "\x48\x63\xc0");          // movsxd rax, eax
+	EMIT(jc, "\x4c\x8d\x7c\x00\x01");  // lea r15, [rax + rax + 1]
+}
+
+/**
+ * スタックがスタック効果の前提を満たさなければ内部インタープリターに戻
+ * る分岐を加える。内部インタープリターの OP_CHECK が、検査する版のコー
+ * ドに切り替えるか、伸びる分のメモリを確保する。
+ */
+static void jit_check_effect(JitCompiler *jc, Effect const *effect)
+{
+	size_t i;
+	jit_need(jc, (int) effect->in);
+	for (i = 0; i < effect->in; ++i) {
+		if (effect->integers & ((uint32_t) 1 << i)) {
+			char disp;
+			disp = (char) (-8 * (int) (i + 1));
+			EMIT(jc, "\x41\xf6\x44\x24");  // test byte [r12 - 8 * (i + 1)], 1
+			jit_emit(jc, &disp, 1);
+			EMIT(jc, "\x01");
+			jit_branch(jc, CC_Z, STUB_BAIL);
+		}
+	}
+	EMIT(jc, "\x49\x8d\x84\x24");      // lea rax, [r12 + 8 * peak]
+	jit_emit32(jc, (uint32_t) (8 * effect->peak));
+	EMIT(jc, "\x4c\x39\xe8");          // cmp rax, r13
+	jit_branch(jc, CC_A, STUB_BAIL);
+	jc->safe = TRUE;
+}
+
+static bool jit_inst(JitCompiler *jc, Opcode op, Inst const *operand)
+{
+	switch (op) {
+	case OP_CHECK:
+		jit_check_effect(jc, &operand->definition->effect);
+		break;
+	case OP_LIT:
+		jit_spill(jc);
+		jit_reserve(jc);
+		EMIT(jc, "\x49\xbf");  // mov r15, cell
+		jit_emit64(jc, (uint64_t) operand->cell);
+		jc->cached = TRUE;
+		break;
+	case OP_ENTER:
+		if (NULL == operand->definition->native) {
+			return FALSE;
+		}
+		jit_spill(jc);
+		EMIT(jc, "\x48\xb8");      // mov rax, native
+		jit_emit64(jc, (uint64_t) (uintptr_t) operand->definition->native);
+		EMIT(jc, "\xff\xd0");      // call rax
+		EMIT(jc, "\x48\x85\xc0");  // test rax, rax
+		jit_branch(jc, CC_NZ, STUB_FRAME);
+		break;
+	case OP_TAIL:
+		if (NULL == operand->definition->native) {
+			return FALSE;
+		}
+		/* 自分の枠を外して飛べば、呼び出し先が自分の呼び出し元に戻る */
+		jit_spill(jc);
+		EMIT(jc, "\x48\x83\xc4\x08");  // add rsp, 8
+		EMIT(jc, "\x48\xb8");          // mov rax, native
+		jit_emit64(jc, (uint64_t) (uintptr_t) operand->definition->native);
+		EMIT(jc, "\xff\xe0");          // jmp rax
+		break;
+	case OP_EXIT:
+		jit_spill(jc);
+		EMIT(jc, "\x31\xc0");          // xor eax, eax
+		EMIT(jc, "\x48\x83\xc4\x08");  // add rsp, 8
+		EMIT(jc, "\xc3");              // ret
+		break;
+	case OP_PLUS:
+	case OP_MINUS:
+	case OP_STAR:
+	case OP_SLASH:
+		jit_fill(jc);
+		jit_need(jc, 1);
+		jit_check_two(jc);
+		jit_load_second_top(jc);
+		if (OP_SLASH == op) {
+			EMIT(jc, "\x85\xc9");  // test ecx, ecx
+			jit_branch(jc, CC_Z, STUB_BAIL);
+		}
+		jit_arith(jc, op);
+		jit_tag(jc);
+		EMIT(jc, "\x49\x83\xec\x08");  // sub r12, 8
+		break;
+	case OP_DUP:
+		jit_fill(jc);
+		jit_spill(jc);
+		jit_reserve(jc);
+		jc->cached = TRUE;  // r15 には同じ値が残っている
+		break;
+	case OP_DROP:
+		if (jc->cached) {
+			jc->cached = FALSE;
+		} else {
+			jit_need(jc, 1);
+			EMIT(jc, "\x49\x83\xec\x08");  // sub r12, 8
+		}
+		break;
+	case OP_SWAP:
+		jit_fill(jc);
+		jit_need(jc, 1);
+		EMIT(jc, "\x49\x8b\x44\x24\xf8");  // mov rax, [r12 - 8]
+		EMIT(jc, "\x4d\x89\x7c\x24\xf8");  // mov [r12 - 8], r15
+		EMIT(jc, "\x49\x89\xc7");          // mov r15, rax
+		break;
+	case OP_OVER:
+		jit_fill(jc);
+		jit_need(jc, 1);
+		jit_spill(jc);
+		jit_reserve(jc);
+		EMIT(jc, "\x4d\x8b\x7c\x24\xf0");  // mov r15, [r12 - 16]
+		jc->cached = TRUE;
+		break;
+	case OP_LIT_PLUS:
+	case OP_LIT_MINUS:
+	case OP_LIT_STAR:
+	case OP_LIT_SLASH:
+		jit_fill(jc);
+		jit_check_top(jc);
+		jit_load_top_literal(jc, operand->cell);
+		jit_arith(jc, OP_LIT_PLUS == op ? OP_PLUS
+				  : OP_LIT_MINUS == op ? OP_MINUS
+				  : OP_LIT_STAR == op ? OP_STAR : OP_SLASH);
+		jit_tag(jc);
+		break;
+	case OP_DUP_PLUS:
+	case OP_DUP_STAR:
+		jit_fill(jc);
+		jit_check_top(jc);
+		EMIT(jc, "\x4c\x89\xf8");  // mov rax, r15
+		EMIT(jc, "\x48\xd1\xf8");  // sar rax, 1
+		EMIT(jc, "\x89\xc1");      // mov ecx, eax
+		jit_arith(jc, OP_DUP_PLUS == op ? OP_PLUS : OP_STAR);
+		jit_tag(jc);
+		break;
+	case OP_OVER_PLUS:
+	case OP_OVER_MINUS:
+	case OP_SWAP_MINUS:
+		jit_fill(jc);
+		jit_need(jc, 1);
+		jit_check_two(jc);
+		jit_load_top_second(jc);
+		jit_arith(jc, OP_OVER_PLUS == op ? OP_PLUS : OP_MINUS);
+		jit_tag(jc);
+		if (OP_SWAP_MINUS == op) {
+			EMIT(jc, "\x49\x83\xec\x08");  // sub r12, 8
+		}
+		break;
+	case OP_NIP:
+		jit_fill(jc);
+		jit_need(jc, 1);
+		EMIT(jc, "\x49\x83\xec\x08");  // sub r12, 8
+		break;
+	default:  // OP_CALL など
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/** 計算したスタックの長さを Stack に書き戻す */
+static void jit_store_len(JitCompiler *jc)
+{
+	EMIT(jc, "\x4c\x89\xe1");      // mov rcx, r12
+	EMIT(jc, "\x4c\x29\xf1");      // sub rcx, r14
+	EMIT(jc, "\x48\xc1\xf9\x03");  // sar rcx, 3
+	EMIT(jc, "\x48\x89\x4b");      // mov [rbx + len], rcx
+	jit_emit(jc, (char const[]) { STACK_LEN }, 1);
+}
+
+/** Stack からスタックの位置をレジスターに読み込む */
+static void jit_load_stack(JitCompiler *jc)
+{
+	EMIT(jc, "\x4c\x8b\x73");      // mov r14, [rbx + values]
+	jit_emit(jc, (char const[]) { STACK_VALUES }, 1);
+	EMIT(jc, "\x4c\x8b\x63");      // mov r12, [rbx + len]
+	jit_emit(jc, (char const[]) { STACK_LEN }, 1);
+	EMIT(jc, "\x4f\x8d\x24\xe6");  // lea r12, [r14 + r12 * 8]
+	EMIT(jc, "\x4c\x8b\x6b");      // mov r13, [rbx + memlen]
+	jit_emit(jc, (char const[]) { STACK_MEMLEN }, 1);
+	EMIT(jc, "\x4f\x8d\x2c\xee");  // lea r13, [r14 + r13 * 8]
+}
+
+/** 内部インタープリターが index の命令から再開するよう戻る */
+static void jit_bail(JitCompiler *jc, size_t index, bool cached)
+{
+	if (cached) {
+		EMIT(jc, "\x4d\x89\x3c\x24");  // mov [r12], r15
+		EMIT(jc, "\x49\x83\xc4\x08");  // add r12, 8
+	}
+	jit_store_len(jc);
+	EMIT(jc, "\x48\xb8");              // mov rax, ip
+	jit_emit64(jc, (uint64_t) (uintptr_t) &jc->definition->threaded[index]);
+	EMIT(jc, "\x48\x83\xc4\x08");      // add rsp, 8
+	EMIT(jc, "\xc3");                  // ret
+}
+
+/** 分岐の相対番地を埋める */
+static void jit_patch(JitCompiler *jc, size_t patch, size_t target)
+{
+	int32_t rel;
+	rel = (int32_t) (target - (patch + 4));
+	memcpy(&jc->code[patch], &rel, sizeof(rel));
+}
+
+static void jit_stubs(JitCompiler *jc)
+{
+	size_t i;
+	for (i = 0; i < jc->nstubs && jc->ok; ++i) {
+		JitStub const *stub;
+		stub = &jc->stubs[i];
+		jit_patch(jc, stub->patch, jc->len);
+		switch (stub->kind) {
+		case STUB_BAIL:
+			jit_bail(jc, stub->index, stub->cached);
+			break;
+		case STUB_GROW:
+			/* 拡大に失敗したら、積む命令から内部インタープリターで実行する */
+			jit_store_len(jc);
+			EMIT(jc, "\x48\x89\xdf");  // mov rdi, rbx
+			EMIT(jc, "\x48\xb8");      // mov rax, jit_grow
+			jit_emit64(jc, (uint64_t) (uintptr_t) jit_grow);
+			EMIT(jc, "\xff\xd0");      // call rax
+			jit_load_stack(jc);
+			EMIT(jc, "\x85\xc0");      // test eax, eax
+			EMIT(jc, "\x0f\x84\x05\x00\x00\x00");  // jz +5
+			EMIT(jc, "\xe9");          // jmp back
+			jit_emit32(jc, (uint32_t) (stub->back - (jc->len + 4)));
+			jit_bail(jc, stub->index, stub->cached);
+			break;
+		case STUB_FRAME:
+			/* 呼び出し先はスタックを書き戻しているので、戻り番地だけ積む */
+			EMIT(jc, "\x48\x89\xef");  // mov rdi, rbp
+			EMIT(jc, "\x48\x89\xc6");  // mov rsi, rax
+			EMIT(jc, "\x48\xba");      // mov rdx, continuation
+			jit_emit64(jc, (uint64_t) (uintptr_t)
+					   &jc->definition->threaded[stub->index + 2]);
+			EMIT(jc, "\x48\xb8");      // mov rax, jit_push_frame
+			jit_emit64(jc, (uint64_t) (uintptr_t) jit_push_frame);
+			EMIT(jc, "\xff\xd0");      // call rax
+			EMIT(jc, "\x48\x83\xc4\x08");  // add rsp, 8
+			EMIT(jc, "\xc3");              // ret
+			break;
+		}
+	}
+}
+
+static void const *jit_install(Jit *jit, unsigned char const *code,
+							   size_t len)
+{
+	JitChunk *chunk;
+	size_t offset;
+	chunk = jit->chunks;
+	offset = NULL == chunk ? 0 : (chunk->len + 15) & ~(size_t) 15;
+	if (NULL == chunk || chunk->memlen < offset + len) {
+		size_t memlen;
+		void *p;
+		memlen = JIT_CHUNK_SIZE;
+		while (memlen < len) {
+			memlen *= 2;
+		}
+		chunk = (JitChunk *) malloc(sizeof(JitChunk));
+		if (NULL == chunk) {
+			return NULL;
+		}
+		p = mmap(NULL, memlen, PROT_READ | PROT_EXEC,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == p) {
+			free(chunk);
+			return NULL;
+		}
+		chunk->code = (unsigned char *) p;
+		chunk->len = 0;
+		chunk->memlen = memlen;
+		chunk->next = jit->chunks;
+		jit->chunks = chunk;
+		offset = 0;
+	}
+	/* 書き込む間だけ書き込み可能にし、実行可能かつ書き込み可能にはしない */
+	if (0 != mprotect(chunk->code, chunk->memlen, PROT_READ | PROT_WRITE)) {
+		return NULL;
+	}
+	memcpy(&chunk->code[offset], code, len);
+	if (0 != mprotect(chunk->code, chunk->memlen, PROT_READ | PROT_EXEC)) {
+		return NULL;
+	}
+	chunk->len = offset + len;
+	return &chunk->code[offset];
+}
+
+static bool jit_grow(Stack *stack)
+{
+	return stack_reserve(stack, stack->len + 1);
+}
+
+static Inst const *jit_push_frame(Stack *rstack, Inst const *resume,
+								  Inst const *continuation)
+{
+	/* 内側で溢れていれば、外側の戻り番地は捨てられるので積まない */
+	if (vm_overflow() == resume || !vm_reserve_rstack(rstack, 1)) {
+		return vm_overflow();
+	}
+	stack_push(rstack, (Cell) continuation);
+	return resume;
+}
+
+Jit *jit_new(void)
+{
+	/*
+	 * C から呼び出す入口。
+	 *   Inst const *entry(Stack *stack, Stack *rstack, void const *native)
+	 * レジスターを退避してスタックの位置を読み込み、翻訳された定義を呼
+	 * び出した後、スタックの長さを書き戻す。
+	 */
+	JitCompiler jc;
+	Jit *jit;
+	jit = (Jit *) malloc(sizeof(Jit));
+	if (NULL == jit) {
+		goto err_malloc;
+	}
+	jit->chunks = NULL;
+	memset(&jc, 0, sizeof(jc));
+	jc.ok = TRUE;
+	EMIT(&jc, "\x55");              // push rbp
+	EMIT(&jc, "\x53");              // push rbx
+	EMIT(&jc, "\x41\x54");          // push r12
+	EMIT(&jc, "\x41\x55");          // push r13
+	EMIT(&jc, "\x41\x56");          // push r14
+	EMIT(&jc, "\x41\x57");          // push r15
+	EMIT(&jc, "\x48\x83\xec\x08");  // sub rsp, 8
+	EMIT(&jc, "\x48\x89\xfb");      // mov rbx, rdi
+	EMIT(&jc, "\x48\x89\xf5");      // mov rbp, rsi
+	jit_load_stack(&jc);
+	EMIT(&jc, "\xff\xd2");          // call rdx
+	jit_store_len(&jc);
+	EMIT(&jc, "\x48\x83\xc4\x08");  // add rsp, 8
+	EMIT(&jc, "\x41\x5f");          // pop r15
+	EMIT(&jc, "\x41\x5e");          // pop r14
+	EMIT(&jc, "\x41\x5d");          // pop r13
+	EMIT(&jc, "\x41\x5c");          // pop r12
+	EMIT(&jc, "\x5b");              // pop rbx
+	EMIT(&jc, "\x5d");              // pop rbp
+	EMIT(&jc, "\xc3");              // ret
+	if (!jc.ok) {
+		goto err_emit;
+	}
+	jit->entry = jit_install(jit, jc.code, jc.len);
+	if (NULL == jit->entry) {
+		goto err_install;
+	}
+	jit->entry_len = jc.len;
+	free(jc.code);
+	return jit;
+err_install:
+	jit_free(jit);
+	jit = NULL;
+err_emit:
+	free(jc.code);
+	free(jit);
+err_malloc:
+	return NULL;
+}
+
+void jit_free(Jit *jit)
+{
+	JitChunk *chunk, *next;
+	for (chunk = jit->chunks; NULL != chunk; chunk = next) {
+		next = chunk->next;
+		munmap(chunk->code, chunk->memlen);
+		free(chunk);
+	}
+	free(jit);
+}
+
+void jit_reset(Jit *jit)
+{
+	JitChunk *chunk;
+	/* 入口のある最も古い領域だけを残す */
+	while (NULL != jit->chunks->next) {
+		chunk = jit->chunks;
+		jit->chunks = chunk->next;
+		munmap(chunk->code, chunk->memlen);
+		free(chunk);
+	}
+	jit->chunks->len = jit->entry_len;
+}
+
+bool jit_compile(Jit *jit, Definition *definition)
+{
+	JitCompiler jc;
+	size_t i;
+	bool ok = TRUE;
+	memset(&jc, 0, sizeof(jc));
+	jc.ok = TRUE;
+	jc.definition = definition;
+	EMIT(&jc, "\x48\x83\xec\x08");  // sub rsp, 8
+	for (i = 0; i < definition->len && ok;
+		 i += 1 + opcode_operands(definition->code[i].op)) {
+		jc.index = i;
+		ok = jit_inst(&jc, definition->code[i].op, &definition->code[i + 1]);
+	}
+	jit_stubs(&jc);
+	if (ok && jc.ok) {
+		definition->native = jit_install(jit, jc.code, jc.len);
+	}
+	free(jc.code);
+	free(jc.stubs);
+	return NULL != definition->native;
+}
+
+Inst const *jit_execute(Context *context, Definition const *definition)
+{
+	typedef Inst const *Entry(Stack *, Stack *, void const *);
+	Entry *entry;
+	Inst const *ip;
+	Stack *rstack;
+	size_t rbase;
+	rstack = context->rstack;
+	rbase = rstack->len;
+	entry = (Entry *) (uintptr_t) context->jit->entry;
+	ip = entry(context->stack, rstack, definition->native);
+	if (NULL != ip) {
+		/*
+		 * 戻り番地は内側の呼び出しから順に積まれているので、内部インター
+		 * プリターが外側から戻れるよう並べ替える
+		 */
+		size_t i, j;
+		for (i = rbase, j = rstack->len; i + 1 < j; ++i, --j) {
+			Cell a;
+			a = rstack->values[i];
+			rstack->values[i] = rstack->values[j - 1];
+			rstack->values[j - 1] = a;
+		}
+	}
+	return ip;
+}
+
+#else
+
+Jit *jit_new(void)
+{
+	return NULL;
+}
+
+void jit_free(Jit *jit)
+{
+}
+
+void jit_reset(Jit *jit)
+{
+}
+
+bool jit_compile(Jit *jit, Definition *definition)
+{
+	return FALSE;
+}
+
+Inst const *jit_execute(Context *context, Definition const *definition)
+{
+	return definition->threaded;
+}
+
+#endif
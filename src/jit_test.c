@@ -0,0 +1,245 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/**
+ * 空白で区切られたソースを文脈に解釈させる。最後に起きたエラーの種別
+ * を返し、エラーがなければ -1 を返す。
+ * \context 文脈
+ * \source ソース
+ */
+static int interpret(Context *context, char const *source)
+{
+	Lexer lexer;
+	char const *token;
+	size_t len;
+	int error_type = -1;
+	lexer_init(&lexer, source, strlen(source));
+	while (lexer_next(&lexer, &token, &len)) {
+		Error *error;
+		error = context_interpret_n(context, token, len);
+		if (NULL != error) {
+			error_type = error->type;
+			error_free(error);
+		}
+	}
+	return error_type;
+}
+
+/**
+ * スタックの内容を空白区切りの文字列にする。
+ * \stack スタック
+ * \buf 文字列の書き込み先
+ * \size 書き込み文字数の制限値
+ */
+static void stack_str(Stack *stack, char *buf, size_t size)
+{
+	size_t i;
+	size_t len = 0;
+	buf[0] = '\0';
+	for (i = 0; i < stack->len && len < size; ++i) {
+		cell_str(stack->values[i], &buf[len], size - len);
+		len += strlen(&buf[len]);
+		len += snprintf(&buf[len], size - len, " ");
+	}
+}
+
+/**
+ * JIT を使わない文脈を生成する。
+ */
+static Context *context_new_interpreted(void)
+{
+	Context *context;
+	context = context_new();
+	if (NULL != context->jit) {
+		jit_free(context->jit);
+		context->jit = NULL;
+	}
+	return context;
+}
+
+/**
+ * 二つの文脈のスタックとエラーが一致することを確かめる。
+ * \source ソース
+ * \expected 期待する文脈
+ * \expected_error 期待する文脈で最後に起きたエラー
+ * \received 確かめる文脈
+ * \received_error 確かめる文脈で最後に起きたエラー
+ */
+static bool expect_context(char const *source,
+						   Context *expected, int expected_error,
+						   Context *received, int received_error)
+{
+	char expected_str[4096], received_str[4096];
+	bool ok = TRUE;
+	stack_str(expected->stack, expected_str, sizeof(expected_str));
+	stack_str(received->stack, received_str, sizeof(received_str));
+	if (0 != strcmp(expected_str, received_str)
+		|| expected_error != received_error) {
+		printf("[[%s]] expected: [[%s]] (%d), received: [[%s]] (%d)\n",
+			   source, expected_str, expected_error, received_str,
+			   received_error);
+		ok = FALSE;
+	}
+	if (0 != received->rstack->len) {
+		printf("[[%s]] return stack is not empty\n", source);
+		ok = FALSE;
+	}
+	return ok;
+}
+
+/**
+ * ソースを最適化しない文脈と、最適化して JIT を使う文脈および使わない
+ * 文脈で解釈し、スタックとエラーが一致することを確かめる。
+ * \threshold コロン定義を最適化するまでの呼び出し回数
+ * \source ソース
+ * \word JIT で翻訳されているべき語。なければ NULL
+ */
+static bool expect_tiered(size_t threshold, char const *source,
+						  char const *word)
+{
+	Context *cold, *jitted, *interpreted;
+	int cold_error, jitted_error, interpreted_error;
+	bool ok = TRUE;
+	cold = context_new_interpreted();
+	jitted = context_new();
+	interpreted = context_new_interpreted();
+	cold->tier_threshold = SIZE_MAX;
+	jitted->tier_threshold = threshold;
+	interpreted->tier_threshold = threshold;
+	cold_error = interpret(cold, source);
+	jitted_error = interpret(jitted, source);
+	interpreted_error = interpret(interpreted, source);
+	ok &= expect_context(source, cold, cold_error,
+						 interpreted, interpreted_error);
+	ok &= expect_context(source, cold, cold_error, jitted, jitted_error);
+	if (NULL != word && NULL != jitted->jit) {
+		Value *value;
+		value = (Value *) map_get(jitted->map, word);
+		if (NULL == value || TYPE_DEFINITION != value->type
+			|| NULL == value_definition(value)->native) {
+			printf("[[%s]] %s is not compiled\n", source, word);
+			ok = FALSE;
+		}
+	}
+	context_free(cold);
+	context_free(jitted);
+	context_free(interpreted);
+	return ok;
+}
+
+/**
+ * 定義した時点で最適化して expect_tiered を行う。
+ * \source ソース
+ * \word JIT で翻訳されているべき語。なければ NULL
+ */
+static bool expect_same(char const *source, char const *word)
+{
+	return expect_tiered(0, source, word);
+}
+
+/**
+ * ランダムな語からなる定義を呼び出し、結果が一致することを確かめる。
+ * \threshold コロン定義を最適化するまでの呼び出し回数
+ */
+static bool test_random(size_t threshold)
+{
+	static char const *const words[] = {
+		"DUP", "DROP", "SWAP", "OVER", "+", "-", "*", "/",
+		"0", "1", "2", "3", "7", "-5", "' x",
+	};
+	char source[4096];
+	bool ok = TRUE;
+	int n;
+	srand(12345);
+	for (n = 0; n < 2000; ++n) {
+		size_t len = 0;
+		int w, i;
+		len += snprintf(&source[len], sizeof(source) - len, "VARIABLE x ");
+		for (w = 0; w < 3; ++w) {
+			int count;
+			len += snprintf(&source[len], sizeof(source) - len, ": w%d ", w);
+			count = 1 + rand() % 8;
+			for (i = 0; i < count; ++i) {
+				char const *word;
+				if (0 < w && 0 == rand() % 4) {
+					len += snprintf(&source[len], sizeof(source) - len,
+									"w%d ", rand() % w);
+					continue;
+				}
+				word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+				len += snprintf(&source[len], sizeof(source) - len,
+								"%s ", word);
+			}
+			len += snprintf(&source[len], sizeof(source) - len, "; ");
+		}
+		/* 初期のスタックは空の場合も変数を含む場合もある */
+		for (i = rand() % 4; 0 < i; --i) {
+			len += snprintf(&source[len], sizeof(source) - len, "%s ",
+							0 == rand() % 5 ? "' x" : "4");
+		}
+		for (i = 0; i < 3; ++i) {
+			len += snprintf(&source[len], sizeof(source) - len, "w%d ",
+							rand() % 3);
+		}
+		ok &= expect_tiered(threshold, source, NULL);
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	bool ok = TRUE;
+	ok &= expect_same(": f 1 2 + 3 * ; f f +", "f");
+	ok &= expect_same(": sq DUP * ; : f DUP sq SWAP 3 * + 1 + ; 5 f", "f");
+	ok &= expect_same(": f 7 - 2 / 3 * 4 + ; 100 f -9 f", "f");
+	ok &= expect_same(": f SWAP - OVER + OVER - SWAP DROP ; 3 10 f", "f");
+	ok &= expect_same(": f SWAP DROP ; 1 2 f", "f");
+	/* 桁あふれは内部インタープリターと同じく 32 ビットで回り込む */
+	ok &= expect_same(": f DUP * ; 65536 f 2147483647 1 +", "f");
+	ok &= expect_same(": f 1 + ; 2147483647 f", "f");
+	/* エラーになる命令から内部インタープリターが実行を引き継ぐ */
+	ok &= expect_same(": f + ; 1 f", "f");
+	ok &= expect_same(": f 0 / ; 5 f 6", "f");
+	ok &= expect_same(": f 1 0 / 2 ; 3 f", "f");
+	ok &= expect_same("VARIABLE x : f DUP * ; ' x f", "f");
+	ok &= expect_same("VARIABLE x : f ' x + ; 1 f", "f");
+	ok &= expect_same(": g 1 + ; : f 2 g g 0 / 3 ; f 4", "f");
+	ok &= expect_same(": h DROP DROP ; : g 1 h 2 ; : f g g 3 ; 10 f 4", "f");
+	ok &= expect_same(": h + ; : g 1 h 2 h ; : f 3 g 4 g ; VARIABLE x ' x f", "f");
+	/* スタック効果を満たさない呼び出しは検査する版のコードで実行する */
+	ok &= expect_same(": g SWAP ; : f g + ; VARIABLE x 1 ' x f", "f");
+	ok &= expect_same(": g OVER OVER ; : f g * g - ; 3 f 4 5 f", "f");
+	ok &= expect_same(": f DUP DROP 1 + ; VARIABLE x 2 ' x f", "f");
+	/* スタックの拡大 */
+	ok &= expect_same(": f 1 2 3 4 5 6 7 8 ; : g f f f f f f ; g g g", "g");
+	ok &= expect_same(": f DUP DUP DUP DUP OVER OVER ; : g f f f f ; 1 g g",
+					  "g");
+	/* 呼び出し回数が閾値に達した定義は、実行の途中で翻訳される */
+	ok &= expect_tiered(3, ": f 1 + ; 0 f f f f f", "f");
+	ok &= expect_tiered(3, ": g 2 * ; : f g 1 + ; 1 f f f f", "g");
+	ok &= expect_tiered(2, ": g 0 / ; : f 1 g 2 ; f f f", "f");
+	/* データ空間や例外を扱う定義は内部インタープリターで実行する */
+	ok &= expect_same("VARIABLE x : f x +! x @ ; : g 1 f 2 f ; g g", NULL);
+	ok &= expect_same("VARIABLE x : f x @ * ; 3 x ! 5 f ' x x ! 6 f", NULL);
+	ok &= expect_same(": g 0 / ; : f 1 2 ' g CATCH 3 ; f f", NULL);
+	ok &= expect_same(": g 5 THROW ; : f 1 ' g CATCH g ; f 4", NULL);
+	/* 末尾呼び出しは翻訳されたコードへの分岐になる */
+	ok &= expect_same(": g 1 + ; : f 2 * g ; 3 f", "f");
+	ok &= expect_same(": g 1 + ; : f 2 * g ; VARIABLE x ' x f 5", "f");
+	/* 分岐を含む定義は内部インタープリターで実行する */
+	ok &= expect_same(": f DUP IF 1 + ELSE DROP 7 THEN 2 * ; 0 f 3 f", NULL);
+	ok &= expect_same(": f 0 SWAP 0 DO I + LOOP ; : g 10 f 1 + ; g", NULL);
+	ok &= expect_tiered(2, ": f DUP IF 1 - RECURSE THEN ; 5 f 5 f 5 f", NULL);
+	ok &= expect_tiered(3, ": f 2 0 DO I LOOP + ; f f f f +", NULL);
+	ok &= test_random(0);
+	ok &= test_random(2);
+	if (ok) {
+		puts("OK");
+	}
+	return ok ? 0 : 1;
+}
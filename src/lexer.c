@@ -0,0 +1,356 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/*
+ * 区切り文字は空白と制御文字 (0x20 以下のバイト) とする。タブや CRLF
+ * の CR も区切りになる。この判定は符号なしの比較一回で済むので、バッ
+ * ファを 64 バイトのブロックごとに SIMD 命令でまとめて判定し、区切り
+ * 文字の位置を 64 ビットのマスクにしておく。トークンの境界はマスクの
+ * ビットを数えるだけで求まる。x86-64 では SSE2 を、実行時に使えると分
+ * かれば AVX2 を用いる。
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LEXER_SIMD
+#include <immintrin.h>
+#endif
+
+/** 一つのマスクが表すブロックの大きさ */
+#define LEXER_BLOCK_SIZE 64
+
+/** 64 バイトのブロックの区切り文字の位置をマスクにする関数 */
+typedef uint64_t BlockMaskFunc(char const *p);
+
+/**
+ * ブロックの区切り文字の位置をマスクにする。SIMD 命令を使わず、一語
+ * (8 バイト) の中の各バイトを同時に判定する (SWAR)。
+ * \p ブロックの先頭
+ */
+static uint64_t block_mask_scalar(char const *p);
+
+#ifdef LEXER_SIMD
+/** block_mask_scalar の SSE2 版 */
+static uint64_t block_mask_sse2(char const *p);
+/** block_mask_scalar の AVX2 版 */
+static uint64_t block_mask_avx2(char const *p);
+#endif
+
+/**
+ * 現在のブロックのマスクを求める。末尾の半端なブロックでは、バッファ
+ * の外は区切り文字として扱う。
+ * \lexer 字句解析器
+ */
+static void lexer_load(Lexer *lexer);
+
+/**
+ * 現在の位置から、区切り文字 (delimiter が TRUE の場合) またはそれ以
+ * 外の文字を探してその位置に進む。見つからなければ末尾に進む。
+ * \lexer 字句解析器
+ * \delimiter 区切り文字を探すなら TRUE
+ */
+static char const *lexer_scan(Lexer *lexer, bool delimiter);
+
+/** 選択されている実装 */
+static LexerImpl lexer_impl = LEXER_AUTO;
+static BlockMaskFunc *block_mask = block_mask_scalar;
+
+/** 実装を一度だけ自動的に選ぶための制御変数 */
+static pthread_once_t lexer_once = PTHREAD_ONCE_INIT;
+
+/**
+ * 実装がまだ選ばれていなければ CPU に応じて選ぶ。pthread_once で一度
+ * だけ呼び出す。
+ */
+static void lexer_select_auto(void);
+
+bool lexer_is_delimiter(char c)
+{
+	return (unsigned char) c <= ' ';
+}
+
+/**
+ * 8 バイトのうち区切り文字であるバイトの位置をマスクにする。
+ * \p 調べる位置
+ */
+static inline uint64_t delimiter_mask_swar(char const *p)
+{
+	uint64_t v, t;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);  /* 先頭のバイトを最下位に置く */
+#endif
+	/*
+	 * 下位 7 ビットに 0x5f を足すと、0x21 以上のときだけ最上位ビット
+	 * が立つ (隣のバイトへは桁上がりしない)。元の最上位ビットも立っ
+	 * ていなければ区切り文字である
+	 */
+	t = (v & 0x7f7f7f7f7f7f7f7f) + 0x5f5f5f5f5f5f5f5f;
+	t = ~(t | v) & 0x8080808080808080;
+	/* 各バイトの最上位ビットを最上位バイトに集める */
+	return (t * 0x0002040810204081) >> 56;
+}
+
+static uint64_t block_mask_scalar(char const *p)
+{
+	uint64_t mask = 0;
+	int i;
+	for (i = 0; i < LEXER_BLOCK_SIZE; i += 8) {
+		mask |= delimiter_mask_swar(p + i) << i;
+	}
+	return mask;
+}
+
+#ifdef LEXER_SIMD
+/**
+ * 16 バイトのうち区切り文字であるバイトの位置をマスクにする。
+ * \p 調べる位置
+ */
+static inline uint64_t delimiter_mask_sse2(char const *p)
+{
+	__m128i x;
+	x = _mm_loadu_si128((__m128i const *) p);
+	/* min(x, ' ') == x であれば x <= ' ' (符号なし) */
+	return (uint16_t) _mm_movemask_epi8(
+		_mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(' ')), x));
+}
+
+static uint64_t block_mask_sse2(char const *p)
+{
+	return delimiter_mask_sse2(p)
+		| delimiter_mask_sse2(p + 16) << 16
+		| delimiter_mask_sse2(p + 32) << 32
+		| delimiter_mask_sse2(p + 48) << 48;
+}
+
+/**
+ * 32 バイトのうち区切り文字であるバイトの位置をマスクにする。
+ * \p 調べる位置
+ */
+__attribute__((target("avx2")))
+static inline uint64_t delimiter_mask_avx2(char const *p)
+{
+	__m256i x;
+	x = _mm256_loadu_si256((__m256i const *) p);
+	return (uint32_t) _mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(' ')), x));
+}
+
+__attribute__((target("avx2")))
+static uint64_t block_mask_avx2(char const *p)
+{
+	return delimiter_mask_avx2(p) | delimiter_mask_avx2(p + 32) << 32;
+}
+#endif
+
+bool lexer_select(LexerImpl impl)
+{
+	if (LEXER_AUTO == impl) {
+#ifdef LEXER_SIMD
+		__builtin_cpu_init();
+		impl = __builtin_cpu_supports("avx2") ? LEXER_AVX2 : LEXER_SSE2;
+#else
+		impl = LEXER_SCALAR;
+#endif
+	}
+	switch (impl) {
+	case LEXER_SCALAR:
+		block_mask = block_mask_scalar;
+		break;
+#ifdef LEXER_SIMD
+	case LEXER_SSE2:
+		block_mask = block_mask_sse2;
+		break;
+	case LEXER_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2")) {
+			return FALSE;
+		}
+		block_mask = block_mask_avx2;
+		break;
+#endif
+	default:
+		return FALSE;
+	}
+	lexer_impl = impl;
+	return TRUE;
+}
+
+static void lexer_load(Lexer *lexer)
+{
+	size_t rest;
+	rest = lexer->end - lexer->block;
+	if (LEXER_BLOCK_SIZE <= rest) {
+		lexer->mask = block_mask(lexer->block);
+	} else {
+		size_t i;
+		lexer->mask = ~(uint64_t) 0;
+		for (i = 0; i < rest; ++i) {
+			if (!lexer_is_delimiter(lexer->block[i])) {
+				lexer->mask &= ~((uint64_t) 1 << i);
+			}
+		}
+	}
+}
+
+static char const *lexer_scan(Lexer *lexer, bool delimiter)
+{
+	while (TRUE) {
+		size_t offset;
+		offset = lexer->p - lexer->block;
+		if (offset < LEXER_BLOCK_SIZE) {
+			uint64_t bits;
+			bits = (delimiter ? lexer->mask : ~lexer->mask)
+				& (~(uint64_t) 0 << offset);
+			if (0 != bits) {
+				lexer->p = lexer->block + __builtin_ctzll(bits);
+				if (lexer->end < lexer->p) {
+					lexer->p = lexer->end;
+				}
+				return lexer->p;
+			}
+		}
+		/* 次のブロックに進む */
+		lexer->block += LEXER_BLOCK_SIZE;
+		if (lexer->end <= lexer->block) {
+			lexer->block = lexer->end;
+			lexer->p = lexer->end;
+			return lexer->p;
+		}
+		lexer->p = lexer->block;
+		lexer_load(lexer);
+	}
+}
+
+static void lexer_select_auto(void)
+{
+	if (LEXER_AUTO == lexer_impl) {
+		lexer_select(LEXER_AUTO);
+	}
+}
+
+void lexer_init(Lexer *lexer, char const *buf, size_t len)
+{
+	pthread_once(&lexer_once, lexer_select_auto);
+	lexer->p = buf;
+	lexer->end = buf + len;
+	lexer->block = buf;
+	lexer_load(lexer);
+}
+
+bool lexer_next(Lexer *lexer, char const **token, size_t *len)
+{
+	char const *start;
+	start = lexer_scan(lexer, FALSE);
+	if (lexer->end <= start) {
+		return FALSE;
+	}
+	*token = start;
+	*len = lexer_scan(lexer, TRUE) - start;
+	return TRUE;
+}
+
+/**
+ * 文字が base 進数の数字であればその値を、そうでなければ base 以上の値
+ * を返す。英字は大文字と小文字のどちらも 10 以上の数字とみなす。
+ * \c 文字
+ */
+static inline unsigned int digit_value(char c)
+{
+	unsigned int d;
+	d = (unsigned char) c - '0';
+	if (d < 10) {
+		return d;
+	}
+	d = ((unsigned char) c | 0x20) - 'a';  /* 小文字にそろえる */
+	return d < 26 ? d + 10 : 36;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/** 8 桁ずつまとめて十進数を読む */
+#define LEXER_SWAR
+/**
+ * 一語に詰めた 8 バイトがすべて十進数の数字であれば TRUE を返し、そ
+ * の値を書き込む。一語の中で 8 桁を同時に処理する (SWAR)。
+ * \v 8 バイト (先頭のバイトが最上位の桁)
+ * \value 値の書き込み先
+ */
+static inline bool eight_digits(uint64_t v, uint64_t *value)
+{
+	/* 各バイトが 0x30 以上 0x39 以下であることを確かめる */
+	if (0 != (((v & 0xf0f0f0f0f0f0f0f0)
+			   | (((v + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4))
+			  ^ 0x3333333333333333)) {
+		return FALSE;
+	}
+	v -= 0x3030303030303030;
+	/* 隣り合う桁を 2 桁、4 桁、8 桁の順にまとめる */
+	v = v * 10 + (v >> 8);
+	v = ((v & 0x000000ff000000ff) * (100 + (1000000ULL << 32))
+		 + ((v >> 16) & 0x000000ff000000ff) * (1 + (10000ULL << 32))) >> 32;
+	*value = v;
+	return TRUE;
+}
+#endif
+
+bool lexer_integer(char const *str, size_t len, unsigned int base, int *value)
+{
+	char const *p, *end;
+	uint64_t n = 0;
+	uint64_t limit;
+	bool negative;
+	p = str;
+	end = str + len;
+	negative = (p < end && '-' == *p);
+	if (negative) {
+		++p;
+	}
+	if (p == end || base < 2 || 36 < base) {
+		return FALSE;
+	}
+	limit = negative ? (uint64_t) INT_MAX + 1 : (uint64_t) INT_MAX;
+#ifdef LEXER_SWAR
+	if (10 == base) {
+		/*
+		 * 桁数を 8 の倍数にそろえるため、端数の桁を '0' で埋めた一語に
+		 * 写して最初に読む。短い数も分岐なしに一度で読める。
+		 */
+		uint64_t v = 0x3030303030303030;
+		uint64_t chunk;
+		size_t head;
+		head = ((end - p) - 1) % 8 + 1;
+		memcpy((char *) &v + 8 - head, p, head);
+		if (!eight_digits(v, &n)) {
+			return FALSE;
+		}
+		for (p += head; p < end; p += 8) {
+			memcpy(&v, p, sizeof(v));
+			if (!eight_digits(v, &chunk) || limit < n) {
+				return FALSE;
+			}
+			n = n * 100000000 + chunk;
+		}
+		if (limit < n) {  // 溢れる
+			return FALSE;
+		}
+		*value = negative ? (int) -(int64_t) n : (int) n;
+		return TRUE;
+	}
+#endif
+	for (; p < end; ++p) {
+		unsigned int d;
+		d = digit_value(*p);
+		if (base <= d) {  // 数字でない
+			return FALSE;
+		}
+		n = n * base + d;
+		if (limit < n) {  // 溢れる
+			return FALSE;
+		}
+	}
+	*value = negative ? (int) -(int64_t) n : (int) n;
+	return TRUE;
+}
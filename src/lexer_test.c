@@ -0,0 +1,237 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/** 区切り文字を多く含む、でたらめな文字を返す */
+static char random_char(void)
+{
+	static char const chars[] = "  \t\n\r\r\nabc+-*/0123456789;:\x01\x7f\xff";
+	return chars[rand() % (sizeof(chars) - 1)];
+}
+
+/**
+ * 実装を選んでバッファを解析し、トークンの位置と長さを書き込む。トー
+ * クンの数を返す。
+ */
+static size_t tokenize(LexerImpl impl, char const *buf, size_t len,
+					   char const **tokens, size_t *lens)
+{
+	Lexer lexer;
+	size_t n = 0;
+	lexer_select(impl);
+	lexer_init(&lexer, buf, len);
+	while (lexer_next(&lexer, &tokens[n], &lens[n])) {
+		++n;
+	}
+	return n;
+}
+
+/**
+ * 一バイトずつ調べてバッファを解析する。実装の結果と比べるための基準。
+ */
+static size_t tokenize_bytes(char const *buf, size_t len,
+							 char const **tokens, size_t *lens)
+{
+	size_t n = 0;
+	size_t i = 0;
+	while (i < len) {
+		size_t start;
+		for (; i < len && lexer_is_delimiter(buf[i]); ++i) {
+		}
+		if (len <= i) {
+			break;
+		}
+		for (start = i; i < len && !lexer_is_delimiter(buf[i]); ++i) {
+		}
+		tokens[n] = &buf[start];
+		lens[n] = i - start;
+		++n;
+	}
+	return n;
+}
+
+/**
+ * すべての実装の結果が一バイトずつ調べた結果と一致することを確かめる。
+ * \buf バッファ
+ * \len バッファの長さ
+ * \tokens, \lens 作業領域 (len 個以上)
+ * \expected_tokens, \expected_lens 作業領域 (len 個以上)
+ */
+static bool expect_agree(char const *buf, size_t len,
+						 char const **tokens, size_t *lens,
+						 char const **expected_tokens, size_t *expected_lens)
+{
+	static LexerImpl const impls[] = { LEXER_SCALAR, LEXER_SSE2, LEXER_AVX2 };
+	size_t expected_n;
+	size_t i, k;
+	bool ok = TRUE;
+	expected_n = tokenize_bytes(buf, len, expected_tokens, expected_lens);
+	for (k = 0; k < sizeof(impls) / sizeof(impls[0]); ++k) {
+		size_t n;
+		if (!lexer_select(impls[k])) {  /* CPU が対応していない */
+			continue;
+		}
+		n = tokenize(impls[k], buf, len, tokens, lens);
+		if (n != expected_n) {
+			printf("impl %d: expected: %lu tokens, received: %lu\n",
+				   impls[k], expected_n, n);
+			ok = FALSE;
+			continue;
+		}
+		for (i = 0; i < n; ++i) {
+			if (tokens[i] != expected_tokens[i]
+				|| lens[i] != expected_lens[i]) {
+				printf("impl %d: token %lu differs\n", impls[k], i);
+				ok = FALSE;
+				break;
+			}
+		}
+	}
+	return ok;
+}
+
+/** 実装ごとの結果が一バイトずつ調べた結果と一致することを確かめる */
+static bool test_impls_agree(void)
+{
+	static size_t const N = 4096;
+	char *buf;
+	char const **expected_tokens, **tokens;
+	size_t *expected_lens, *lens;
+	size_t i;
+	int round;
+	int c;
+	bool ok = TRUE;
+	buf = (char *) malloc(N);
+	expected_tokens = (char const **) malloc(sizeof(char *) * N);
+	tokens = (char const **) malloc(sizeof(char *) * N);
+	expected_lens = (size_t *) malloc(sizeof(size_t) * N);
+	lens = (size_t *) malloc(sizeof(size_t) * N);
+	for (round = 0; round < 200 && ok; ++round) {
+		size_t len;
+		len = rand() % N;
+		for (i = 0; i < len; ++i) {
+			/* 長いトークンや長い空白の並びも作る */
+			buf[i] = (round % 3 == 0 && 0 < i && rand() % 8) ? buf[i - 1]
+				: random_char();
+		}
+		ok &= expect_agree(buf, len, tokens, lens,
+						   expected_tokens, expected_lens);
+	}
+	/* すべてのバイトの値を、ブロックのすべての位置で試す */
+	for (c = 0; c < 256 && ok; ++c) {
+		for (i = 0; i < 64 && ok; ++i) {
+			memset(buf, 'a', 128);
+			buf[i] = (char) c;
+			ok &= expect_agree(buf, 128, tokens, lens,
+							   expected_tokens, expected_lens);
+		}
+	}
+	free(buf);
+	free(expected_tokens);
+	free(tokens);
+	free(expected_lens);
+	free(lens);
+	lexer_select(LEXER_AUTO);
+	return ok;
+}
+
+/** タブや CRLF も区切りとして扱う */
+static bool test_whitespace(void)
+{
+	static char const source[] = "\t1 2\r\n+\t\tDUP\r\n\r\n";
+	static char const *const expected[] = { "1", "2", "+", "DUP" };
+	char const *tokens[8];
+	size_t lens[8];
+	size_t n, i;
+	bool ok = TRUE;
+	n = tokenize(LEXER_AUTO, source, sizeof(source) - 1, tokens, lens);
+	if (4 != n) {
+		printf("expected: 4 tokens, received: %lu\n", n);
+		return FALSE;
+	}
+	for (i = 0; i < n; ++i) {
+		if (strlen(expected[i]) != lens[i]
+			|| 0 != memcmp(expected[i], tokens[i], lens[i])) {
+			printf("expected: [[%s]], received: [[%.*s]]\n",
+				   expected[i], (int) lens[i], tokens[i]);
+			ok = FALSE;
+		}
+	}
+	return ok;
+}
+
+/**
+ * トークンを整数として読んだ結果を確かめる。
+ * \str トークン
+ * \base 基数
+ * \expected_ok 整数として読めるべきなら TRUE
+ * \expected 期待する値
+ */
+static bool expect_integer(char const *str, unsigned int base,
+						   bool expected_ok, int expected)
+{
+	int n = 0;
+	bool ok;
+	ok = lexer_integer(str, strlen(str), base, &n);
+	if (ok != expected_ok || (ok && n != expected)) {
+		printf("[[%s]] base %u expected: %d (%d), received: %d (%d)\n",
+			   str, base, expected, expected_ok, n, ok);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/** 整数の読み取り */
+static bool test_integer(void)
+{
+	char buf[32];
+	int i;
+	bool ok = TRUE;
+	ok &= expect_integer("0", 10, TRUE, 0);
+	ok &= expect_integer("42", 10, TRUE, 42);
+	ok &= expect_integer("-42", 10, TRUE, -42);
+	ok &= expect_integer("12345678", 10, TRUE, 12345678);
+	ok &= expect_integer("0000000012345678", 10, TRUE, 12345678);
+	ok &= expect_integer("2147483647", 10, TRUE, INT_MAX);
+	ok &= expect_integer("-2147483648", 10, TRUE, INT_MIN);
+	ok &= expect_integer("2147483648", 10, FALSE, 0);
+	ok &= expect_integer("-2147483649", 10, FALSE, 0);
+	ok &= expect_integer("99999999999999999999", 10, FALSE, 0);
+	ok &= expect_integer("1234567x", 10, FALSE, 0);
+	ok &= expect_integer("12345678x", 10, FALSE, 0);
+	ok &= expect_integer("1234:678", 10, FALSE, 0);
+	ok &= expect_integer("-", 10, FALSE, 0);
+	ok &= expect_integer("", 10, FALSE, 0);
+	ok &= expect_integer("--1", 10, FALSE, 0);
+	ok &= expect_integer("ff", 10, FALSE, 0);
+	ok &= expect_integer("ff", 16, TRUE, 255);
+	ok &= expect_integer("-7FFFFFFF", 16, TRUE, -INT_MAX);
+	ok &= expect_integer("80000000", 16, FALSE, 0);
+	ok &= expect_integer("1010", 2, TRUE, 10);
+	ok &= expect_integer("102", 2, FALSE, 0);
+	ok &= expect_integer("zz", 36, TRUE, 36 * 35 + 35);
+	/* 8 桁ずつの処理と一桁ずつの処理が同じ値を返す */
+	for (i = 0; i < 100000; ++i) {
+		int n;
+		n = rand() - RAND_MAX / 2;
+		snprintf(buf, sizeof(buf), "%d", n);
+		ok &= expect_integer(buf, 10, TRUE, n);
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	bool ok = TRUE;
+	ok &= test_whitespace();
+	ok &= test_integer();
+	ok &= test_impls_agree();
+	if (ok) {
+		puts("OK");
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+#include "libforsh.h"
+
+/*
+ * 公開 API。内部の関数を薄く包み、エラーは Error の代わりに例外番号で
+ * 返す。
+ */
+
+/**
+ * エラーの例外番号を取り出して、エラーを解放する。
+ * \error エラー
+ */
+static int forsh_error_code(Error *error);
+
+static int forsh_error_code(Error *error)
+{
+	int code;
+	code = error->code;
+	error_free(error);
+	return code;
+}
+
+ForshContext *forsh_new(void)
+{
+	return context_new();
+}
+
+void forsh_free(ForshContext *context)
+{
+	context_free(context);
+}
+
+void forsh_reset(ForshContext *context)
+{
+	context_reset(context);
+}
+
+int forsh_eval(ForshContext *context, char const *source)
+{
+	return forsh_eval_n(context, source, strlen(source));
+}
+
+int forsh_eval_n(ForshContext *context, char const *buf, size_t len)
+{
+	Lexer lexer;
+	char const *token;
+	size_t token_len;
+	lexer_init(&lexer, buf, len);
+	while (lexer_next(&lexer, &token, &token_len)) {
+		Error *error;
+		error = context_interpret_n(context, token, token_len);
+		if (NULL != error) {
+			return forsh_error_code(error);
+		}
+	}
+	return 0;
+}
+
+char *forsh_error_str(int code, char *buffer, size_t size)
+{
+	Error *error;
+	error = error_new_code(code);
+	error_str(error, buffer, size);
+	error_free(error);
+	return buffer;
+}
+
+size_t forsh_depth(ForshContext const *context)
+{
+	return context->stack->len;
+}
+
+int forsh_push(ForshContext *context, int value)
+{
+	if (!stack_push(context->stack, cell_from_integer(value))) {
+		return forsh_error_code(error_new(StackOverflowError, NULL));
+	}
+	return 0;
+}
+
+int forsh_pop(ForshContext *context, int *value)
+{
+	Cell cell;
+	if (0 == context->stack->len) {
+		return forsh_error_code(error_new(EmptyStackError, NULL));
+	}
+	cell = context->stack->values[context->stack->len - 1];
+	if (!cell_is_integer(cell)) {
+		return forsh_error_code(error_new(IllegalTypeError, NULL));
+	}
+	context->stack->len -= 1;
+	*value = cell_integer(cell);
+	return 0;
+}
+
+void forsh_set_output(ForshContext *context, int fd)
+{
+	output_redirect(context->output, fd);
+}
+
+int forsh_flush(ForshContext *context)
+{
+	return output_flush(context->output) ? 0 : -1;
+}
+
+ForshPool *forsh_pool_new(size_t size)
+{
+	return context_pool_new(size);
+}
+
+void forsh_pool_free(ForshPool *pool)
+{
+	context_pool_free(pool);
+}
+
+ForshContext *forsh_pool_acquire(ForshPool *pool)
+{
+	return context_pool_acquire(pool);
+}
+
+void forsh_pool_release(ForshPool *pool, ForshContext *context)
+{
+	context_pool_release(pool, context);
+}
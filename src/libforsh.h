@@ -0,0 +1,148 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * forsh を組み込むための公開ヘッダー。libforsh.a か libforsh.so とと
+ * もに使う。内部の構造は forsh.h にあり、ここには含めない。
+ *
+ * 文脈は一つのスレッドだけが使う。要求ごとに文脈を使い捨てる場合は、
+ * forsh_new と forsh_free の代わりに、forsh_pool_acquire で借りて
+ * forsh_pool_release で返すと、確保したメモリーを再利用できる。
+ */
+
+#ifndef LIBFORSH_H
+#define LIBFORSH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** ライブラリーの外に公開する関数 */
+#if defined(__GNUC__)
+#define FORSH_API __attribute__((visibility("default")))
+#else
+#define FORSH_API
+#endif
+
+/** 文脈 (インタープリターの状態) */
+typedef struct _Context ForshContext;
+
+/** あらかじめ生成した文脈のプール */
+typedef struct _ContextPool ForshPool;
+
+/**
+ * 文脈を生成する。失敗した場合は NULL を返す。
+ */
+FORSH_API ForshContext *forsh_new(void);
+
+/**
+ * 文脈を解放する。
+ * \context 文脈
+ */
+FORSH_API void forsh_free(ForshContext *context);
+
+/**
+ * 文脈を生成した直後の状態に戻す。スタック、データ空間、定義した語を
+ * 捨て、出力先を標準出力に戻す。確保したメモリーは解放しない。
+ * \context 文脈
+ */
+FORSH_API void forsh_reset(ForshContext *context);
+
+/**
+ * NUL 終端された文字列を解釈する。成功すれば 0 を、エラーが起きれば
+ * そこで解釈をやめて例外番号 (ANS Forth の THROW 値、負の数) を返す。
+ * エラーの後もスタックと定義は残る。
+ * \context 文脈
+ * \source 解釈する文字列
+ */
+FORSH_API int forsh_eval(ForshContext *context, char const *source);
+
+/**
+ * forsh_eval と同様だが、NUL 終端されていないバッファを受け付ける。
+ * \context 文脈
+ * \buf 解釈するバッファ
+ * \len バッファの長さ
+ */
+FORSH_API int forsh_eval_n(ForshContext *context, char const *buf,
+						   size_t len);
+
+/**
+ * 例外番号の文字列表現を取得する。
+ * \code forsh_eval が返した例外番号
+ * \buffer 文字列の書き込み先
+ * \size 書き込み文字数の制限値
+ */
+FORSH_API char *forsh_error_str(int code, char *buffer, size_t size);
+
+/**
+ * スタックに積まれている要素の数を返す。
+ * \context 文脈
+ */
+FORSH_API size_t forsh_depth(ForshContext const *context);
+
+/**
+ * スタックに整数を積む。成功すれば 0 を、失敗すれば例外番号を返す。
+ * \context 文脈
+ * \value 整数
+ */
+FORSH_API int forsh_push(ForshContext *context, int value);
+
+/**
+ * スタックから整数を取り出す。成功すれば 0 を、スタックが空であるか
+ * 先頭が整数でなければ例外番号を返し、スタックは変えない。
+ * \context 文脈
+ * \value 整数の書き込み先
+ */
+FORSH_API int forsh_pop(ForshContext *context, int *value);
+
+/**
+ * 溜まっている出力を書き出してから、出力先を変える。
+ * \context 文脈
+ * \fd 書き込み先のファイル記述子
+ */
+FORSH_API void forsh_set_output(ForshContext *context, int fd);
+
+/**
+ * 溜まっている出力を書き出す。成功すれば 0 を、失敗すれば -1 を返す。
+ * \context 文脈
+ */
+FORSH_API int forsh_flush(ForshContext *context);
+
+/**
+ * 文脈のプールを生成する。size 個の文脈をあらかじめ生成しておく。失
+ * 敗した場合は NULL を返す。
+ * \size あらかじめ生成し、空いたままにしておく文脈の数
+ */
+FORSH_API ForshPool *forsh_pool_new(size_t size);
+
+/**
+ * プールを解放する。借りた文脈はすべて返しておく。
+ * \pool プール
+ */
+FORSH_API void forsh_pool_free(ForshPool *pool);
+
+/**
+ * プールから文脈を借りる。空いていなければ新しく生成する。複数のスレッ
+ * ドから呼び出してよい。失敗した場合は NULL を返す。
+ * \pool プール
+ */
+FORSH_API ForshContext *forsh_pool_acquire(ForshPool *pool);
+
+/**
+ * 借りた文脈をリセットしてプールに返す。複数のスレッドから呼び出して
+ * よい。
+ * \pool プール
+ * \context 借りた文脈
+ */
+FORSH_API void forsh_pool_release(ForshPool *pool, ForshContext *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBFORSH_H */
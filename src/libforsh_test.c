@@ -0,0 +1,204 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/* 公開ヘッダーだけで組み込めることを確かめるので、forsh.h は使わない */
+#include "libforsh.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/** プールを共有するスレッドの数 */
+#define THREADS 8
+
+/** 一つのスレッドが処理する要求の数 */
+#define REQUESTS 200
+
+/** スレッドに渡す引数と結果 */
+typedef struct _Worker Worker;
+struct _Worker {
+	pthread_t thread;  /* スレッド */
+	ForshPool *pool;   /* 共有するプール */
+	int id;            /* 通し番号 */
+	int ok;            /* 結果 */
+};
+
+/**
+ * ソースを解釈し、返り値とスタックの一番上を確かめる。スタックは空に
+ * する。
+ * \context 文脈
+ * \source ソース
+ * \expected_code 期待する返り値
+ * \expected 期待するスタックの一番上
+ */
+static int expect(ForshContext *context, char const *source,
+				  int expected_code, int expected)
+{
+	int code;
+	int value = 0;
+	int ok = 1;
+	code = forsh_eval(context, source);
+	if (expected_code != code) {
+		printf("[[%s]] expected code: %d, received: %d\n",
+			   source, expected_code, code);
+		ok = 0;
+	}
+	if (0 != forsh_pop(context, &value) || expected != value) {
+		printf("[[%s]] expected: %d, received: %d\n",
+			   source, expected, value);
+		ok = 0;
+	}
+	while (0 < forsh_depth(context)) {
+		forsh_pop(context, &value);
+	}
+	return ok;
+}
+
+/** 評価、スタックの操作、エラー */
+static int test_eval(void)
+{
+	ForshContext *context;
+	char buf[256];
+	int value;
+	int ok = 1;
+	context = forsh_new();
+	ok &= expect(context, ": sq DUP * ; 3 sq", 0, 9);
+	ok &= expect(context, "8 +\n7", -4, 8);  // 空のスタック
+	ok &= expect(context, "5 1 0 / 6", -10, 0);  // エラーで止まる
+	ok &= expect(context, "VARIABLE x 41 x ! 1 x +! x @", 0, 42);
+	ok &= expect(context, "7 : f 42 THROW ; f", 42, 7);
+	ok &= expect(context, "1 2 frobnicate +", -13, 2);  // 未定義の語
+	/* NUL 終端されていないバッファは長さの分だけ解釈する */
+	if (0 != forsh_eval_n(context, "1 2 + 999", 5)
+		|| 1 != forsh_depth(context)) {
+		printf("forsh_eval_n read past the buffer\n");
+		ok = 0;
+	}
+	forsh_pop(context, &value);
+	forsh_push(context, 6);
+	forsh_push(context, 7);
+	ok &= expect(context, "*", 0, 42);
+	if (-4 != forsh_pop(context, &value)) {
+		printf("forsh_pop on an empty stack\n");
+		ok = 0;
+	}
+	forsh_eval(context, "' DUP");
+	if (-12 != forsh_pop(context, &value) || 1 != forsh_depth(context)) {
+		printf("forsh_pop of a non-integer\n");
+		ok = 0;
+	}
+	if (0 != strcmp("DividedByZeroError",
+					forsh_error_str(-10, buf, sizeof(buf)))) {
+		printf("forsh_error_str(-10): %s\n", buf);
+		ok = 0;
+	}
+	forsh_free(context);
+	return ok;
+}
+
+/**
+ * SEE も出力先に書く。リセットすると定義とスタックが消え、出力先が戻
+ * る。
+ */
+static int test_reset(void)
+{
+	ForshContext *context;
+	char buf[256];
+	int fds[2];
+	ssize_t n;
+	int ok = 1;
+	if (0 != pipe(fds)) {
+		return 0;
+	}
+	context = forsh_new();
+	forsh_set_output(context, fds[1]);
+	forsh_eval(context, ": hi 72 EMIT 73 EMIT ; hi SEE hi 1 2 3 HEX");
+	forsh_reset(context);
+	close(fds[1]);
+	n = read(fds[0], buf, sizeof(buf) - 1);
+	close(fds[0]);
+	buf[0 < n ? n : 0] = '\0';
+	if (0 != strncmp("HI: hi\n", buf, 7) || NULL == strstr(buf, ";\n")) {
+		printf("reset did not flush the output: [[%s]]\n", buf);
+		ok = 0;
+	}
+	if (0 != forsh_depth(context)) {
+		printf("reset left the stack\n");
+		ok = 0;
+	}
+	ok &= expect(context, "10 ' hi", -13, 10);
+	forsh_free(context);
+	return ok;
+}
+
+/**
+ * プールから文脈を借りては返す。前の要求の定義が見えないことを確か
+ * める。
+ * \arg Worker
+ */
+static void *run(void *arg)
+{
+	Worker *worker = (Worker *) arg;
+	char source[128];
+	int i;
+	worker->ok = 1;
+	for (i = 0; i < REQUESTS; ++i) {
+		ForshContext *context;
+		int n;
+		context = forsh_pool_acquire(worker->pool);
+		if (NULL == context) {
+			worker->ok = 0;
+			break;
+		}
+		n = worker->id * REQUESTS + i;
+		snprintf(source, sizeof(source),
+				 "VARIABLE v %d v ! : f v @ DUP * ; f", n % 1000);
+		worker->ok &= expect(context, "1 ' v", -13, 1)
+			&& expect(context, source, 0, (n % 1000) * (n % 1000));
+		forsh_pool_release(worker->pool, context);
+	}
+	return NULL;
+}
+
+/** 複数のスレッドが一つのプールを共有する */
+static int test_pool(void)
+{
+	ForshPool *pool;
+	Worker workers[THREADS];
+	int ok = 1;
+	int i;
+	pool = forsh_pool_new(THREADS / 2);  // 足りない分は生成して解放する
+	if (NULL == pool) {
+		return 0;
+	}
+	for (i = 0; i < THREADS; ++i) {
+		workers[i].pool = pool;
+		workers[i].id = i;
+		pthread_create(&workers[i].thread, NULL, run, &workers[i]);
+	}
+	for (i = 0; i < THREADS; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		if (!workers[i].ok) {
+			printf("pool: worker %d failed\n", i);
+			ok = 0;
+		}
+	}
+	forsh_pool_free(pool);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int ok = 1;
+	ok &= test_eval();
+	ok &= test_reset();
+	ok &= test_pool();
+	if (ok) {
+		puts("OK");
+	}
+	return ok ? 0 : 1;
+}
@@ -6,43 +6,238 @@
 
 #include "forsh.h"
 
-static void start_interpreter()
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** パイプなどから読み込むバッファの初期の大きさ */
+static size_t const BUFFER_SIZE = 64 * 1024;
+
+/** 文脈の内容を表示しないなら TRUE (-q)。バッチ処理で使う */
+static bool quiet = FALSE;
+
+/**
+ * バッファ内のトークンをすべて解釈する。
+ * \context 文脈
+ * \buf バッファ
+ * \len バッファの長さ
+ */
+static void interpret_buffer(Context *context, char const *buf, size_t len);
+
+/**
+ * バッファ内のトークンを一行ずつ解釈し、行ごとに文脈の内容を表示する。
+ * \context 文脈
+ * \buf バッファ
+ * \len バッファの長さ
+ */
+static void interpret_lines(Context *context, char const *buf, size_t len);
+
+/**
+ * バッファの中で、解釈してよい末尾の位置を返す。行ごとに解釈する場合
+ * は最後の改行の直後、そうでなければ最後の区切り文字の直後である。見
+ * つからなければ 0 を返す。
+ * \buf バッファ
+ * \len バッファの長さ
+ * \by_line 行ごとに解釈するなら TRUE
+ */
+static size_t complete_length(char const *buf, size_t len, bool by_line);
+
+/**
+ * ファイル記述子から読み込みながら解釈する。一つのバッファを使い回し、
+ * 読み込みの境界をまたぐトークンは次に読み込む分とつなげてから解釈す
+ * る。読み込みに失敗した場合は FALSE を返す。
+ * \context 文脈
+ * \fd ファイル記述子
+ * \by_line 行ごとに文脈の内容を表示するなら TRUE
+ */
+static bool interpret_stream(Context *context, int fd, bool by_line);
+
+/**
+ * スクリプト・ファイルを解釈する。通常のファイルはメモリにマップして、
+ * 複製せずにその場でトークンに区切る。失敗した場合は FALSE を返す。
+ * \context 文脈
+ * \path ファイルのパス
+ */
+static bool interpret_file(Context *context, char const *path);
+
+/**
+ * トークンを解釈し、エラーがあれば表示する。
+ * \context 文脈
+ * \token トークン
+ * \len トークンの長さ
+ */
+static void interpret_token(Context *context, char const *token, size_t len);
+
+static void interpret_token(Context *context, char const *token, size_t len)
 {
-	static size_t const BUFFER_SIZE = 1024;
-	char *buffer;
-	Context *context;
 	Error *error;
-	context = context_new();
-	while (TRUE) {
-		char *tofree;
-		char *token;
-		tofree = buffer = (char *) malloc(BUFFER_SIZE);
-		if (NULL == buffer) { 
-			break;
-		}
-		if (NULL == fgets(buffer, BUFFER_SIZE, stdin)) {  /* eof */
-			free(tofree);
-			break;
-		}
-		while (NULL != (token = strsep((char **) &buffer, " \n"))) {
-			if ('\0' == *token) {
-				break;
-			}
-			error = context_interpret(context, token);
-			if (NULL != error) {
-				char buf[1024];
-				fprintf(stderr, "%s\n", error_str(error, buf, sizeof(buf)));
-				error_free(error);
-			}
+	error = context_interpret_n(context, token, len);
+	if (NULL != error) {
+		char buf[1024];
+		output_flush(context->output);  /* 出力とエラーの順序を保つ */
+		fprintf(stderr, "%s\n", error_str(error, buf, sizeof(buf)));
+		error_free(error);
+	}
+}
+
+static void interpret_buffer(Context *context, char const *buf, size_t len)
+{
+	Lexer lexer;
+	char const *token;
+	size_t token_len;
+	lexer_init(&lexer, buf, len);
+	while (lexer_next(&lexer, &token, &token_len)) {
+		interpret_token(context, token, token_len);
+	}
+}
+
+static void interpret_lines(Context *context, char const *buf, size_t len)
+{
+	char const *end;
+	end = buf + len;
+	while (buf < end) {
+		char const *newline;
+		newline = memchr(buf, '\n', end - buf);
+		if (NULL == newline) {
+			newline = end;
 		}
+		interpret_buffer(context, buf, newline - buf);
 		context_describe(context);  /* debug */
-		free(tofree);
+		buf = newline + 1;
 	}
-	context_free(context);
 }
 
-int main()
+static size_t complete_length(char const *buf, size_t len, bool by_line)
 {
-	start_interpreter();
+	while (0 < len) {
+		char c;
+		c = buf[len - 1];
+		if ('\n' == c || (!by_line && lexer_is_delimiter(c))) {
+			return len;
+		}
+		--len;
+	}
 	return 0;
 }
+
+static bool interpret_stream(Context *context, int fd, bool by_line)
+{
+	char *buffer;
+	size_t memlen;
+	size_t len;
+	bool eof;
+	memlen = BUFFER_SIZE;
+	buffer = (char *) malloc(memlen);
+	if (NULL == buffer) {
+		return FALSE;
+	}
+	len = 0;
+	eof = FALSE;
+	while (!eof) {
+		ssize_t n;
+		size_t complete;
+		output_flush(context->output);  /* 入力を待つ前に出力を見せる */
+		n = read(fd, buffer + len, memlen - len);
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			free(buffer);
+			return FALSE;
+		}
+		eof = (0 == n);
+		len += n;
+		complete = eof ? len : complete_length(buffer, len, by_line);
+		if (0 == complete) {
+			if (memlen <= len) {  /* 一つの行 (トークン) がバッファより長い */
+				char *larger;
+				larger = (char *) realloc(buffer, memlen * 2);
+				if (NULL == larger) {
+					free(buffer);
+					return FALSE;
+				}
+				buffer = larger;
+				memlen *= 2;
+			}
+			continue;
+		}
+		if (by_line) {
+			interpret_lines(context, buffer, complete);
+		} else {
+			interpret_buffer(context, buffer, complete);
+		}
+		memmove(buffer, buffer + complete, len - complete);
+		len -= complete;
+	}
+	free(buffer);
+	return TRUE;
+}
+
+static bool interpret_file(Context *context, char const *path)
+{
+	int fd;
+	struct stat st;
+	bool ok;
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return FALSE;
+	}
+	if (0 != fstat(fd, &st)) {
+		close(fd);
+		return FALSE;
+	}
+	if (S_ISREG(st.st_mode) && 0 < st.st_size) {
+		void *map;
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED != map) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			interpret_buffer(context, (char const *) map, st.st_size);
+			munmap(map, st.st_size);
+			close(fd);
+			return TRUE;
+		}
+	}
+	/* マップできないファイル (パイプなど) は読み込みながら解釈する */
+	ok = interpret_stream(context, fd, FALSE);
+	close(fd);
+	return ok;
+}
+
+static void start_interpreter(Context *context)
+{
+	/* 行ごとに表示しないなら、行に区切らずに解釈する */
+	interpret_stream(context, STDIN_FILENO, !quiet);
+}
+
+int main(int argc, char **argv)
+{
+	Context *context;
+	int status = 0;
+	int i = 1;
+	if (i < argc && 0 == strcmp(argv[i], "-q")) {
+		quiet = TRUE;
+		i += 1;
+	}
+	context = context_new();
+	if (NULL == context) {
+		return 1;
+	}
+	if (argc <= i) {
+		start_interpreter(context);
+	} else {
+		for (; i < argc; ++i) {
+			if (!interpret_file(context, argv[i])) {
+				perror(argv[i]);
+				status = 1;
+				break;
+			}
+		}
+		if (!quiet) {
+			context_describe(context);  /* debug */
+		}
+	}
+	context_free(context);
+	return status;
+}
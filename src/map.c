@@ -7,37 +7,31 @@
 #include "forsh.h"
 
 /**
- * Pair の新しいインスタンスを生成する。
+ * キーに対応するスロットを探す。キーが存在しない場合は、キーを格納す
+ * べき空きスロットを返す。
+ * \map マップ
  * \key キー
- * \value 値
- */
-static Pair *pair_new(const char *key, void *value);
-
-/**
- * Pair を解放する
- * \pair ペア
  */
-static void pair_free(Pair *pair);
+static Pair *map_find(Map const *map, Symbol const *key);
 
 /**
- * Map のメモリの長さを拡大する。
+ * Map のスロットの数を倍に拡大し、要素を再配置する。
  * \map マップ
  */
 static bool map_realloc(Map *map);
 
-static Pair *pair_new(const char *key, void *value)
-{
-	Pair *pair;
-	pair = (Pair *) malloc(sizeof(Pair));
-	pair->key = strdup(key);
-	pair->value = value;
-	return pair;
-}
-
-static void pair_free(Pair *pair)
+static Pair *map_find(Map const *map, Symbol const *key)
 {
-	free(pair->key);
-	free(pair);
+	size_t mask;
+	size_t i;
+	mask = map->memlen - 1;
+	for (i = key->hash & mask; ; i = (i + 1) & mask) {
+		Pair *pair;
+		pair = &map->pairs[i];
+		if (NULL == pair->key || key == pair->key) {
+			return pair;
+		}
+	}
 }
 
 Map *map_new(void (*value_free)(void *))
@@ -48,7 +42,7 @@ Map *map_new(void (*value_free)(void *))
 		goto err_malloc;
 	}
 	map->memlen = 16;
-	map->pairs = (Pair **) malloc(sizeof(Pair *) * map->memlen);
+	map->pairs = (Pair *) calloc(map->memlen, sizeof(Pair));
 	if (NULL == map->pairs) {
 		goto err_malloc_pairs;
 	}
@@ -77,54 +71,110 @@ void map_free(Map *map)
 	size_t i;
 	FreeFunc *value_free;
 	value_free = map_value_free(map);
-	for (i = 0; i < map->len; ++i) {
-		value_free(map->pairs[i]->value);
-		pair_free(map->pairs[i]);
+	for (i = 0; i < map->memlen; ++i) {
+		if (NULL != map->pairs[i].key) {
+			value_free(map->pairs[i].value);
+		}
 	}
+	free(map->pairs);
 	free(map);
 }
 
+void map_clear(Map *map)
+{
+	size_t i;
+	FreeFunc *value_free;
+	value_free = map_value_free(map);
+	for (i = 0; i < map->memlen; ++i) {
+		if (NULL != map->pairs[i].key) {
+			value_free(map->pairs[i].value);
+		}
+	}
+	memset(map->pairs, 0, map->memlen * sizeof(Pair));
+	map->len = 0;
+}
+
 static bool map_realloc(Map *map)
 {
-	map->memlen *= 2;
-	return NULL != realloc(map->pairs, sizeof(Pair *) * map->memlen);
+	Pair *old_pairs;
+	size_t old_memlen;
+	size_t i;
+	old_pairs = map->pairs;
+	old_memlen = map->memlen;
+	map->pairs = (Pair *) calloc(old_memlen * 2, sizeof(Pair));
+	if (NULL == map->pairs) {
+		map->pairs = old_pairs;
+		return FALSE;
+	}
+	map->memlen = old_memlen * 2;
+	for (i = 0; i < old_memlen; ++i) {
+		if (NULL != old_pairs[i].key) {
+			/* キーは互いに異なるので、空きスロットが見つかる */
+			*map_find(map, old_pairs[i].key) = old_pairs[i];
+		}
+	}
+	free(old_pairs);
+	return TRUE;
 }
 
 bool map_put(Map *map, char const *key, void *value)
 {
-	size_t i;
+	Symbol const *symbol;
+	symbol = symbol_intern(key);
+	if (NULL == symbol) {
+		return FALSE;
+	}
+	return map_put_symbol(map, symbol, value);
+}
+
+bool map_put_symbol(Map *map, Symbol const *key, void *value)
+{
+	Pair *pair;
 	FreeFunc *value_free;
+	pair = map_find(map, key);
 	/* すでにキーが存在する場合は上書きする */
-	for (i = 0; i < map->len; ++i) {
-		Pair *pair;
-		pair = map->pairs[i];
-		if (0 == strcmp(pair->key, key)) {
-			value_free = map_value_free(map);
-			value_free(pair->value);
-			pair->value = value;
-			return TRUE;
-		}
+	if (NULL != pair->key) {
+		value_free = map_value_free(map);
+		value_free(pair->value);
+		pair->value = value;
+		return TRUE;
 	}
-	/* キーが見つからなかった場合は追加する */
-	if (map->memlen <= map->len) {
+	/* キーが見つからなかった場合は追加する。負荷率は 3/4 までに抑える */
+	if (map->memlen * 3 <= (map->len + 1) * 4) {
 		if (!map_realloc(map)) {
 			return FALSE;
 		}
+		pair = map_find(map, key);
 	}
-	map->pairs[map->len] = pair_new(key, value);
+	pair->key = key;
+	pair->value = value;
 	map->len += 1;
 	return TRUE;
 }
 
 void *map_get(Map const *map, char const *key)
+{
+	Symbol const *symbol;
+	symbol = symbol_lookup(key);
+	if (NULL == symbol) {
+		return NULL;
+	}
+	return map_get_symbol(map, symbol);
+}
+
+void *map_get_symbol(Map const *map, Symbol const *key)
+{
+	return map_find(map, key)->value;
+}
+
+void map_each(Map const *map,
+			  void (*func)(Symbol const *key, void *value, void *data),
+			  void *data)
 {
 	size_t i;
-	for (i = 0; i < map->len; ++i) {
-		Pair *pair;
-		pair = map->pairs[i];
-		if (0 == strcmp(pair->key, key)) {
-			return pair->value;
+	for (i = 0; i < map->memlen; ++i) {
+		if (NULL != map->pairs[i].key) {
+			func(map->pairs[i].key, map->pairs[i].value, data);
 		}
 	}
-	return NULL;
 }
@@ -14,6 +14,63 @@ static void free_remember(void *p)
 	free(p);
 }
 
+/** ハッシュ表の拡大を何度も挟むだけのキーを格納して確かめる */
+static bool test_many_keys(void)
+{
+	static int const N = 5000;
+	Map *map;
+	char key[32];
+	int i;
+	bool ok = TRUE;
+	map = map_new(free);
+	for (i = 0; i < N; ++i) {
+		int *value;
+		value = (int *) malloc(sizeof(int));
+		*value = i;
+		snprintf(key, sizeof(key), "key%d", i);
+		map_put(map, key, value);
+	}
+	if (N != map->len) {
+		printf("expected: %d, received: %lu\n", N, map->len);
+		ok = FALSE;
+	}
+	/* 上書きしても要素数は増えない */
+	for (i = 0; i < N; i += 2) {
+		int *value;
+		value = (int *) malloc(sizeof(int));
+		*value = -i;
+		snprintf(key, sizeof(key), "key%d", i);
+		map_put(map, key, value);
+	}
+	if (N != map->len) {
+		printf("expected: %d, received: %lu\n", N, map->len);
+		ok = FALSE;
+	}
+	for (i = 0; i < N; ++i) {
+		int *value;
+		int expected;
+		expected = (0 == i % 2) ? -i : i;
+		snprintf(key, sizeof(key), "key%d", i);
+		value = (int *) map_get(map, key);
+		if (NULL == value) {
+			printf("expected: %d, received: NULL\n", expected);
+			ok = FALSE;
+		} else if (expected != *value) {
+			printf("expected: %d, received: %d\n", expected, *value);
+			ok = FALSE;
+		}
+	}
+	for (i = N; i < N * 2; ++i) {
+		snprintf(key, sizeof(key), "key%d", i);
+		if (NULL != map_get(map, key)) {
+			printf("expected: NULL, received: [[%s]]\n", key);
+			ok = FALSE;
+		}
+	}
+	map_free(map);
+	return ok;
+}
+
 int main(int argc, char **argv)
 {
 	Map *map;
@@ -47,10 +104,26 @@ int main(int argc, char **argv)
 		printf("expected: [[NEKO]], received: [[%s]]\n", value);
 		ok = FALSE;
 	}
+	free(lastly_freed);
+	/* 空にしても確保したスロットは残り、そのまま使える */
+	map_clear(map);
+	if (0 != map->len || 16 != map->memlen || NULL != map_get(map, "dog")) {
+		printf("map_clear: len %lu, memlen %lu\n", map->len, map->memlen);
+		ok = FALSE;
+	}
+	map_put(map, "dog", strdup("INU"));
+	value = (char *) map_get(map, "dog");
+	if (NULL == value || 0 != strcmp("INU", value)) {
+		printf("expected: [[INU]] after map_clear\n");
+		ok = FALSE;
+	}
+	map_free(map);
+	if (!test_many_keys()) {
+		ok = FALSE;
+	}
 	if (ok) {
 		puts("OK");
 	}
-	free(lastly_freed);
-	map_free(map);
+	return ok ? 0 : 1;
 }
 
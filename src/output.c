@@ -0,0 +1,147 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/** 整数を書き出すのに使う数字 */
+static char const DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+Output *output_new(int fd)
+{
+	Output *output;
+	output = (Output *) malloc(sizeof(Output));
+	if (NULL == output) {
+		return NULL;
+	}
+	output->fd = fd;
+	output->line_buffered = isatty(fd);
+	output->len = 0;
+	return output;
+}
+
+void output_redirect(Output *output, int fd)
+{
+	output_flush(output);
+	output->fd = fd;
+	output->line_buffered = isatty(fd);
+}
+
+void output_free(Output *output)
+{
+	output_flush(output);
+	free(output);
+}
+
+bool output_flush(Output *output)
+{
+	size_t written = 0;
+	while (written < output->len) {
+		ssize_t n;
+		n = write(output->fd, output->buf + written, output->len - written);
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			/* 書き出せなかった分は捨てる。溜め続けても書き出せない */
+			output->len = 0;
+			return FALSE;
+		}
+		written += n;
+	}
+	output->len = 0;
+	return TRUE;
+}
+
+void output_write(Output *output, char const *str, size_t len)
+{
+	if (OUTPUT_SIZE - output->len < len) {
+		output_flush(output);
+		if (OUTPUT_SIZE < len) {  // バッファより長ければ直接書き出す
+			ssize_t n;
+			while (0 < len) {
+				n = write(output->fd, str, len);
+				if (n < 0 && EINTR == errno) {
+					continue;
+				} else if (n < 0) {
+					return;
+				}
+				str += n;
+				len -= n;
+			}
+			return;
+		}
+	}
+	memcpy(output->buf + output->len, str, len);
+	output->len += len;
+	if (output->line_buffered && NULL != memchr(str, '\n', len)) {
+		output_flush(output);
+	}
+}
+
+void output_char(Output *output, char c)
+{
+	if (OUTPUT_SIZE <= output->len) {
+		output_flush(output);
+	}
+	output->buf[output->len++] = c;
+	if (output->line_buffered && '\n' == c) {
+		output_flush(output);
+	}
+}
+
+void output_integer(Output *output, int n, unsigned int base)
+{
+	char buf[sizeof(int) * CHAR_BIT + 1];
+	char *p;
+	unsigned int u;
+	p = buf + sizeof(buf);
+	u = n < 0 ? 0u - (unsigned int) n : (unsigned int) n;
+	/* 十進数は定数での割り算にして、乗算に置き換えさせる */
+	if (10 == base) {
+		do {
+			*--p = DIGITS[u % 10];
+			u /= 10;
+		} while (0 != u);
+	} else {
+		do {
+			*--p = DIGITS[u % base];
+			u /= base;
+		} while (0 != u);
+	}
+	if (n < 0) {
+		*--p = '-';
+	}
+	output_write(output, p, buf + sizeof(buf) - p);
+}
+
+void output_cell(Output *output, Cell cell, unsigned int base)
+{
+	if (cell_is_integer(cell)) {
+		output_integer(output, cell_integer(cell), base);
+	} else {
+		char buf[1024];
+		cell_str(cell, buf, sizeof(buf));
+		output_write(output, buf, strlen(buf));
+	}
+}
+
+void output_format(Output *output, char const *format, ...)
+{
+	char buf[1024];
+	va_list ap;
+	int n;
+	va_start(ap, format);
+	n = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	if (0 < n) {
+		output_write(output, buf, (size_t) n < sizeof(buf) ? (size_t) n
+					 : sizeof(buf) - 1);
+	}
+}
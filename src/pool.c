@@ -0,0 +1,99 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/*
+ * 文脈のプール。要求ごとに文脈を生成して解放する代わりに、あらかじめ
+ * 生成しておいた文脈を貸し出し、返されたら context_reset して次の貸し
+ * 出しに使う。最後に返された文脈から貸し出すので、キャッシュに残って
+ * いるものが使われやすい。
+ */
+
+/** 文脈のプール */
+struct _ContextPool {
+	Context **contexts;    /* 空いている文脈 */
+	size_t len;            /* 空いている文脈の数 */
+	size_t memlen;         /* 空いたままにしておく文脈の数の上限 */
+	pthread_mutex_t lock;  /* contexts と len を守るロック */
+};
+
+ContextPool *context_pool_new(size_t size)
+{
+	ContextPool *pool;
+	pool = (ContextPool *) malloc(sizeof(ContextPool));
+	if (NULL == pool) {
+		goto err_malloc;
+	}
+	pool->contexts = (Context **) malloc(sizeof(Context *) * (size + 1));
+	if (NULL == pool->contexts) {
+		goto err_malloc_contexts;
+	}
+	pool->len = 0;
+	pool->memlen = size;
+	if (0 != pthread_mutex_init(&pool->lock, NULL)) {
+		goto err_mutex;
+	}
+	for (; pool->len < size; ++pool->len) {
+		pool->contexts[pool->len] = context_new();
+		if (NULL == pool->contexts[pool->len]) {
+			goto err_context;
+		}
+	}
+	return pool;
+err_context:
+	while (0 < pool->len) {
+		context_free(pool->contexts[--pool->len]);
+	}
+	pthread_mutex_destroy(&pool->lock);
+err_mutex:
+	free(pool->contexts);
+err_malloc_contexts:
+	free(pool);
+err_malloc:
+	return NULL;
+}
+
+void context_pool_free(ContextPool *pool)
+{
+	while (0 < pool->len) {
+		context_free(pool->contexts[--pool->len]);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->contexts);
+	free(pool);
+}
+
+Context *context_pool_acquire(ContextPool *pool)
+{
+	Context *context = NULL;
+	pthread_mutex_lock(&pool->lock);
+	if (0 < pool->len) {
+		context = pool->contexts[--pool->len];
+	}
+	pthread_mutex_unlock(&pool->lock);
+	/* 空いている文脈がなければ、ロックの外で生成する */
+	if (NULL == context) {
+		context = context_new();
+	}
+	return context;
+}
+
+void context_pool_release(ContextPool *pool, Context *context)
+{
+	/* リセットはロックの外で済ませ、ロックは出し入れだけに使う */
+	context_reset(context);
+	pthread_mutex_lock(&pool->lock);
+	if (pool->len < pool->memlen) {
+		pool->contexts[pool->len++] = context;
+		context = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	/* 上限を超えて貸し出した分は解放する */
+	if (NULL != context) {
+		context_free(context);
+	}
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+#include <time.h>
+
+/** 計測結果の一件 */
+typedef struct _ProfileEntry ProfileEntry;
+struct _ProfileEntry {
+	char const *name;        /* 語の名前 */
+	Profile const *profile;  /* 計測結果 */
+};
+
+/** 計測結果を集める先 */
+typedef struct _ProfileEntries ProfileEntries;
+struct _ProfileEntries {
+	ProfileEntry *entries;  /* 計測結果 */
+	size_t len;             /* 長さ */
+	size_t memlen;          /* 確保されている長さ */
+};
+
+/**
+ * 一度でも呼び出された語の計測結果を加える。
+ * \entries 計測結果を集める先
+ * \name 語の名前
+ * \profile 計測結果
+ */
+static void profile_add(ProfileEntries *entries, char const *name,
+						Profile const *profile);
+
+/**
+ * シンボル・テーブルのビルトイン関数の計測結果を加える。map_each に
+ * 渡す。
+ * \key 語の名前
+ * \value 値
+ * \data 計測結果を集める先
+ */
+static void profile_add_function(Symbol const *key, void *value, void *data);
+
+/**
+ * シンボル・テーブルのビルトイン関数の計測結果を消去する。map_each に
+ * 渡す。
+ * \key 語の名前
+ * \value 値
+ * \data 使わない
+ */
+static void profile_reset_function(Symbol const *key, void *value,
+								   void *data);
+
+/**
+ * 計測結果をサイクル数の多い順に並べるための比較関数。
+ * \a 計測結果
+ * \b 計測結果
+ */
+static int profile_compare(void const *a, void const *b);
+
+uint64_t profile_clock(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void profile_enable(Context *context, bool enable)
+{
+	Definition *definition;
+	if (context->profiling == enable) {
+		return;
+	}
+	task_quiesce(context);  // タスクが実行しているコードを書き換える
+	if (enable) {  // 共有しているビルトインの計測結果を書き換えない
+		context_own_builtins(context);
+	}
+	for (definition = context->definitions; NULL != definition;
+		 definition = definition->next) {
+		vm_profile(definition, enable);
+	}
+	context->profiling = enable;
+}
+
+static void profile_reset_function(Symbol const *key, void *value,
+								   void *data)
+{
+	Value *function;
+	(void) key;
+	(void) data;
+	function = (Value *) value;
+	function->profile.calls = 0;
+	function->profile.cycles = 0;
+}
+
+void profile_reset(Context *context)
+{
+	Definition *definition;
+	for (definition = context->definitions; NULL != definition;
+		 definition = definition->next) {
+		definition->profile.calls = 0;
+		definition->profile.cycles = 0;
+	}
+	map_each(context->map, profile_reset_function, NULL);
+}
+
+static void profile_add(ProfileEntries *entries, char const *name,
+						Profile const *profile)
+{
+	if (0 == profile->calls) {
+		return;
+	}
+	if (entries->memlen <= entries->len) {
+		ProfileEntry *p;
+		size_t memlen;
+		memlen = 0 == entries->memlen ? 16 : entries->memlen * 2;
+		p = (ProfileEntry *) realloc(entries->entries,
+									 sizeof(ProfileEntry) * memlen);
+		if (NULL == p) {
+			return;
+		}
+		entries->entries = p;
+		entries->memlen = memlen;
+	}
+	entries->entries[entries->len].name = name;
+	entries->entries[entries->len].profile = profile;
+	entries->len += 1;
+}
+
+static void profile_add_function(Symbol const *key, void *value, void *data)
+{
+	Value const *function;
+	function = (Value const *) value;
+	if (TYPE_FUNCTION == function->type || TYPE_OPCODE == function->type) {
+		profile_add((ProfileEntries *) data, symbol_name(key),
+					&function->profile);
+	}
+}
+
+static int profile_compare(void const *a, void const *b)
+{
+	uint64_t x, y;
+	x = ((ProfileEntry const *) a)->profile->cycles;
+	y = ((ProfileEntry const *) b)->profile->cycles;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void profile_report(Context const *context, Output *out)
+{
+	ProfileEntries entries = { NULL, 0, 0 };
+	Definition const *definition;
+	size_t i;
+	for (definition = context->definitions; NULL != definition;
+		 definition = definition->next) {
+		profile_add(&entries, symbol_name(definition->name),
+					&definition->profile);
+	}
+	map_each(context->map, profile_add_function, &entries);
+	qsort(entries.entries, entries.len, sizeof(ProfileEntry),
+		  profile_compare);
+	output_format(out, "%12s %16s %12s  %s\n",
+				  "calls", "cycles", "cycles/call", "word");
+	for (i = 0; i < entries.len; ++i) {
+		Profile const *profile;
+		profile = entries.entries[i].profile;
+		output_format(out, "%12llu %16llu %12llu  %s\n",
+					  (unsigned long long) profile->calls,
+					  (unsigned long long) profile->cycles,
+					  (unsigned long long) (profile->cycles / profile->calls),
+					  entries.entries[i].name);
+	}
+	free(entries.entries);
+}
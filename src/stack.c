@@ -6,26 +6,31 @@
 
 #include "forsh.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 /**
  * スタックのメモリの長さを拡大する。
  * \stack スタック
  */
 static bool stack_realloc(Stack *stack);
 
-Stack *stack_new(FreeFunc *value_free)
+Stack *stack_new(void)
 {
 	Stack *stack;
 	stack = (Stack *) malloc(sizeof(Stack));
 	if (NULL == stack) {
 		goto err_malloc;
 	}
+	/* 底の一つ下に番兵を置く */
 	stack->memlen = 16;
-	stack->values = (void **) malloc(sizeof(void *) * stack->memlen);
+	stack->values = (Cell *) malloc(sizeof(Cell) * (stack->memlen + 1));
 	if (NULL == stack->values) {
 		goto err_malloc_values;
 	}
+	stack->values += 1;
 	stack->len = 0;
-	stack->value_free = value_free;
+	stack->guard = 0;
 	return stack;
 err_malloc_values:
 	free(stack);
@@ -33,37 +38,77 @@ err_malloc:
 	return NULL;
 }
 
+Stack *stack_new_guarded(size_t memlen)
+{
+	Stack *stack;
+	size_t page;
+	size_t size;
+	char *p;
+	stack = (Stack *) malloc(sizeof(Stack));
+	if (NULL == stack) {
+		goto err_malloc;
+	}
+	/* [ガード・ページ][番兵と要素][ガード・ページ] の順に並べる */
+	page = (size_t) sysconf(_SC_PAGESIZE);
+	size = (sizeof(Cell) * (memlen + 1) + page - 1) / page * page;
+	p = (char *) mmap(NULL, size + 2 * page, PROT_NONE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p) {
+		goto err_mmap;
+	}
+	if (0 != mprotect(p + page, size, PROT_READ | PROT_WRITE)) {
+		goto err_mprotect;
+	}
+	stack->guard = page / sizeof(Cell);
+	stack->values = (Cell *) (p + page) + 1;
+	stack->memlen = size / sizeof(Cell) - 1 + stack->guard;
+	stack->len = 0;
+	return stack;
+err_mprotect:
+	munmap(p, size + 2 * page);
+err_mmap:
+	free(stack);
+err_malloc:
+	return NULL;
+}
+
 void stack_free(Stack *stack)
 {
-	FreeFunc *value_free;
-	int i;
-	if (stack->value_free) {
-		value_free = stack->value_free;
+	/* セルは整数かシンボルなので、個別に解放すべきものはない */
+	if (0 != stack->guard) {
+		munmap(stack->values - 1 - stack->guard,
+			   sizeof(Cell) * (stack->memlen + 1 + stack->guard));
 	} else {
-		value_free = free;
-	}
-	for (i = 0; i < stack->len; ++i) {
-		value_free(stack->values[i]);
+		free(stack->values - 1);
 	}
-	free(stack->values);
 	free(stack);
 }
 
 static bool stack_realloc(Stack *stack)
 {
+	Cell *values;
+	if (0 != stack->guard) {  // 固定長
+		return FALSE;
+	}
+	values = (Cell *) realloc(stack->values - 1,
+							  sizeof(Cell) * (stack->memlen * 2 + 1));
+	if (NULL == values) {
+		return FALSE;
+	}
+	stack->values = values + 1;
 	stack->memlen *= 2;
-	return NULL != realloc(stack->values, sizeof(void *) * stack->memlen);
+	return TRUE;
 }
 
-void stack_each(Stack *stack, void (*func)(void*))
+void stack_each(Stack *stack, void (*func)(Cell))
 {
-	int i;
+	size_t i;
 	for (i = 0; i < stack->len; ++i) {
 		func(stack->values[i]);
 	}
 }
 
-bool stack_push(Stack *stack, void *value)
+bool stack_push(Stack *stack, Cell value)
 {
 	if (stack->memlen <= stack->len) {
 		if (!stack_realloc(stack)) {
@@ -75,9 +120,20 @@ bool stack_push(Stack *stack, void *value)
 	return TRUE;
 }
 
-void *stack_pop(Stack *stack)
+bool stack_reserve(Stack *stack, size_t len)
 {
-	if (stack->len == 0) { return NULL; }
+	while (stack->memlen < len) {
+		if (!stack_realloc(stack)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+bool stack_pop(Stack *stack, Cell *value)
+{
+	if (stack->len == 0) { return FALSE; }
 	stack->len -= 1;
-	return stack->values[stack->len];
+	*value = stack->values[stack->len];
+	return TRUE;
 }
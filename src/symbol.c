@@ -0,0 +1,231 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/** シンボルを切り出す領域の一単位の大きさ */
+#define SYMBOL_CHUNK_SIZE 8192
+
+/** シンボルを切り出す領域 */
+typedef struct _SymbolChunk SymbolChunk;
+struct _SymbolChunk {
+	SymbolChunk *next;  /* 次の領域 */
+	size_t len;         /* 使用済みの長さ */
+	char data[SYMBOL_CHUNK_SIZE];  /* 領域本体 */
+};
+
+/**
+ * インターン表のスロット (オープン・アドレス法)。拡大しても古いスロッ
+ * トは解放せず、ロックせずに読んでいるスレッドが参照し続けられるよう
+ * にする。古いスロットの合計は現在のスロットより小さい。
+ */
+typedef struct _SymbolSlots SymbolSlots;
+struct _SymbolSlots {
+	SymbolSlots *prev;  /* 拡大する前のスロット */
+	size_t memlen;      /* スロットの数 (2 の冪) */
+	Symbol *slots[];    /* スロット */
+};
+
+/**
+ * インターン表。登録済みのシンボルはロックせずに引き、見つからなけれ
+ * ばロックしてから登録する。
+ */
+typedef struct _SymbolTable SymbolTable;
+struct _SymbolTable {
+	SymbolSlots *slots;    /* 現在のスロット */
+	size_t len;            /* 登録されているシンボルの数 */
+	SymbolChunk *chunks;   /* シンボルの格納領域 */
+	pthread_mutex_t lock;  /* 登録を直列化する */
+};
+
+/** プロセス全体で唯一のインターン表 */
+static SymbolTable table = { NULL, 0, NULL, PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * 領域からシンボルを切り出す。ロックしてから呼び出す。
+ * \size 切り出す大きさ
+ */
+static Symbol *symbol_alloc(size_t size);
+
+/**
+ * インターン表のスロットの数を倍に拡大する。ロックしてから呼び出す。
+ */
+static bool symbol_table_realloc(void);
+
+/**
+ * スロットから名前に一致するシンボルを探す。見つからなければ NULL を
+ * 返し、index に登録すべき空きスロットの位置を書き込む。
+ * \slots スロット
+ * \name 名前
+ * \len 名前の長さ
+ * \hash 名前のハッシュ値
+ * \index 空きスロットの位置の書き込み先
+ */
+static Symbol *symbol_find(SymbolSlots const *slots, char const *name,
+						   size_t len, unsigned int hash, size_t *index);
+
+unsigned int str_hash(char const *str, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		hash ^= (unsigned char) str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static Symbol *symbol_alloc(size_t size)
+{
+	SymbolChunk *chunk;
+	Symbol *symbol;
+	/* Symbol のアラインメントを保つ */
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	chunk = table.chunks;
+	if (NULL == chunk || SYMBOL_CHUNK_SIZE < chunk->len + size) {
+		if (SYMBOL_CHUNK_SIZE < size) {  /* 巨大な名前は個別に確保する */
+			return (Symbol *) malloc(size);
+		}
+		chunk = (SymbolChunk *) malloc(sizeof(SymbolChunk));
+		if (NULL == chunk) {
+			return NULL;
+		}
+		chunk->next = table.chunks;
+		chunk->len = 0;
+		table.chunks = chunk;
+	}
+	symbol = (Symbol *) &chunk->data[chunk->len];
+	chunk->len += size;
+	return symbol;
+}
+
+static bool symbol_table_realloc(void)
+{
+	SymbolSlots *slots;
+	size_t memlen;
+	size_t i;
+	memlen = (NULL == table.slots) ? 256 : table.slots->memlen * 2;
+	slots = (SymbolSlots *) calloc(1, offsetof(SymbolSlots, slots)
+								   + sizeof(Symbol *) * memlen);
+	if (NULL == slots) {
+		return FALSE;
+	}
+	slots->prev = table.slots;
+	slots->memlen = memlen;
+	for (i = 0; NULL != table.slots && i < table.slots->memlen; ++i) {
+		Symbol *symbol;
+		size_t j;
+		symbol = table.slots->slots[i];
+		if (NULL == symbol) {
+			continue;
+		}
+		for (j = symbol->hash & (memlen - 1);
+			 NULL != slots->slots[j];
+			 j = (j + 1) & (memlen - 1)) {
+		}
+		slots->slots[j] = symbol;
+	}
+	/* 埋め終えてから公開する */
+	__atomic_store_n(&table.slots, slots, __ATOMIC_RELEASE);
+	return TRUE;
+}
+
+static Symbol *symbol_find(SymbolSlots const *slots, char const *name,
+						   size_t len, unsigned int hash, size_t *index)
+{
+	size_t mask;
+	size_t i;
+	Symbol *symbol;
+	mask = slots->memlen - 1;
+	for (i = hash & mask;
+		 NULL != (symbol = __atomic_load_n(&slots->slots[i],
+											__ATOMIC_ACQUIRE));
+		 i = (i + 1) & mask) {
+		if (hash == symbol->hash && len == symbol->len
+			&& 0 == memcmp(symbol->name, name, len)) {
+			return symbol;
+		}
+	}
+	*index = i;
+	return NULL;
+}
+
+Symbol const *symbol_intern(char const *name)
+{
+	return symbol_intern_n(name, strlen(name));
+}
+
+Symbol const *symbol_intern_n(char const *name, size_t len)
+{
+	unsigned int hash;
+	size_t i;
+	SymbolSlots *slots;
+	Symbol *symbol;
+	hash = str_hash(name, len);
+	/* ほとんどのトークンは登録済みなので、まずロックせずに引く */
+	slots = __atomic_load_n(&table.slots, __ATOMIC_ACQUIRE);
+	if (NULL != slots
+		&& NULL != (symbol = symbol_find(slots, name, len, hash, &i))) {
+		return symbol;
+	}
+	pthread_mutex_lock(&table.lock);
+	if (NULL == table.slots
+		|| table.slots->memlen * 3 <= (table.len + 1) * 4) {
+		if (!symbol_table_realloc()) {
+			pthread_mutex_unlock(&table.lock);
+			return NULL;
+		}
+	}
+	/* ロックを待つ間に他のスレッドが登録したかもしれない */
+	symbol = symbol_find(table.slots, name, len, hash, &i);
+	if (NULL == symbol) {
+		symbol = symbol_alloc(offsetof(Symbol, name) + len + 1);
+		if (NULL != symbol) {
+			symbol->id = table.len;
+			symbol->hash = hash;
+			symbol->len = len;
+			memcpy(symbol->name, name, len);
+			symbol->name[len] = '\0';
+			/* 中身を書き終えてから公開する */
+			__atomic_store_n(&table.slots->slots[i], symbol,
+							 __ATOMIC_RELEASE);
+			table.len += 1;
+		}
+	}
+	pthread_mutex_unlock(&table.lock);
+	return symbol;
+}
+
+Symbol const *symbol_lookup(char const *name)
+{
+	return symbol_lookup_n(name, strlen(name));
+}
+
+Symbol const *symbol_lookup_n(char const *name, size_t len)
+{
+	unsigned int hash;
+	size_t i;
+	SymbolSlots *slots;
+	Symbol *symbol = NULL;
+	hash = str_hash(name, len);
+	slots = __atomic_load_n(&table.slots, __ATOMIC_ACQUIRE);
+	if (NULL != slots
+		&& NULL != (symbol = symbol_find(slots, name, len, hash, &i))) {
+		return symbol;
+	}
+	/* 拡大した後のスロットに登録されたばかりかもしれないので引き直す */
+	pthread_mutex_lock(&table.lock);
+	if (NULL != table.slots) {
+		symbol = symbol_find(table.slots, name, len, hash, &i);
+	}
+	pthread_mutex_unlock(&table.lock);
+	return symbol;
+}
+
+char const *symbol_name(Symbol const *symbol)
+{
+	return symbol->name;
+}
@@ -0,0 +1,741 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+#include <unistd.h>
+
+/*
+ * タスクとスレッド・プール。SPAWN したタスクは、それを実行しているス
+ * レッドのデックの末尾に積む。スレッドは自分のデックの末尾から取り出
+ * して実行し、空になれば他のスレッドのデックの先頭から盗む。JOIN で待
+ * つスレッドも、待つ間は同じようにタスクを実行する。
+ *
+ * タスクはスタックとリターン・スタックだけを持つ子の文脈で実行し、シ
+ * ンボル・テーブル、定義、データ空間は親と共有する。共有しているもの
+ * を書き換える前には task_quiesce でタスクの終わりを待つ。
+ */
+
+/**
+ * タスクが語の代わりに実行する関数。
+ * \context 子の文脈
+ * \arg 引数
+ */
+typedef Error *TaskFunc(Context *context, void *arg);
+
+/** タスク */
+typedef struct _Task Task;
+struct _Task {
+	Context *context;  /* 子の文脈 */
+	Value *value;      /* 実行する語 */
+	TaskFunc *func;    /* 語の代わりに実行する関数。なければ NULL */
+	void *arg;         /* func の引数 */
+	Error *error;      /* 起きたエラー。なければ NULL */
+	int done;          /* 終わっていれば 1 (アトミックに読み書きする) */
+};
+
+/** スレッドごとのデック。ロックして操作する */
+typedef struct _TaskDeque TaskDeque;
+struct _TaskDeque {
+	pthread_mutex_t lock;  /* ロック */
+	Task **tasks;          /* リング・バッファ */
+	size_t head;           /* 先頭 (盗まれる側) の位置 */
+	size_t tail;           /* 末尾 (持ち主が積み下ろす側) の位置 */
+	size_t memlen;         /* リング・バッファの長さ (2 の冪) */
+};
+
+/** プールのスレッド */
+typedef struct _TaskWorker TaskWorker;
+struct _TaskWorker {
+	pthread_t thread;  /* スレッド */
+	TaskDeque deque;   /* デック */
+	Output *output;    /* 実行するタスクの出力先 */
+};
+
+/** スレッド・プール */
+typedef struct _TaskPool TaskPool;
+struct _TaskPool {
+	TaskWorker *workers;   /* スレッド */
+	size_t count;          /* スレッドの数 */
+	size_t next;           /* プールの外から積むデックの順番 */
+	size_t queued;         /* デックに積まれているタスクの数 */
+	size_t sleeping;       /* 眠っているスレッドの数 */
+	pthread_mutex_t lock;  /* 眠りと目覚めのためのロック */
+	pthread_cond_t wake;   /* タスクが積まれたか終わった */
+};
+
+/**
+ * PMAP と PREDUCE が配列を塊に分けて計算するための状態。塊は空いたス
+ * レッドが順に取っていく。
+ */
+typedef struct _TaskLoop TaskLoop;
+struct _TaskLoop {
+	Array const *src;  /* 読む配列 */
+	Array *dst;        /* PMAP の書き込み先。PREDUCE では NULL */
+	Value *value;      /* 要素ごとに実行する語 */
+	Cell *partials;    /* PREDUCE の塊ごとの結果 */
+	size_t chunk;      /* 一つの塊の要素の数 */
+	size_t chunks;     /* 塊の数 */
+	size_t next;       /* 次に計算する塊 (アトミックに読み書きする) */
+	int failed;        /* エラーが起きていれば 1 (アトミックに読み書きする) */
+};
+
+/**
+ * PMAP と PREDUCE の一つの塊の大きさ (バイト)。PMAP が読む塊と書く塊
+ * が合わせて L1 データ・キャッシュに収まるようにする。
+ */
+#define TASK_CHUNK_SIZE (16 * 1024)
+
+/** プロセス全体で唯一のスレッド・プール */
+static TaskPool pool = {
+	NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+/** プールを一度だけ起動するための制御変数 */
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/** 実行中のスレッドがプールのスレッドであれば、そのスレッド */
+static THREAD_LOCAL TaskWorker *task_worker;
+
+/** 盗む相手を選ぶ乱数の状態 */
+static THREAD_LOCAL unsigned int task_seed;
+
+/**
+ * スレッド・プールを起動する。スレッドの数は CPU の数とする。
+ * pthread_once で一度だけ呼び出す。
+ */
+static void task_start(void);
+
+/**
+ * プールのスレッドの本体。タスクを取り出しては実行する。
+ * \arg TaskWorker
+ */
+static void *task_main(void *arg);
+
+/**
+ * デックの末尾にタスクを積む。
+ * \deque デック
+ * \task タスク
+ */
+static bool task_push(TaskDeque *deque, Task *task);
+
+/**
+ * 実行するタスクを取り出す。自分のデックの末尾から取り出し、なければ
+ * 他のデックの先頭から盗む。なければ NULL を返す。
+ */
+static Task *task_take(void);
+
+/**
+ * タスクを実行し、終わったことを知らせる。
+ * \task タスク
+ * \output タスクの出力先
+ */
+static void task_run(Task *task, Output *output);
+
+/**
+ * タスクが終わるまで、他のタスクを実行しながら待つ。
+ * \task タスク
+ * \output 待つ間に実行するタスクの出力先
+ */
+static void task_wait(Task *task, Output *output);
+
+/**
+ * 待っているスレッドがあれば起こす。
+ */
+static void task_wake(void);
+
+/**
+ * 子の文脈とタスクを解放する。
+ * \task タスク
+ */
+static void task_free(Task *task);
+
+/**
+ * 語か関数を実行するタスクを作る。作れなければ NULL を返す。
+ * \context タスクを作る文脈
+ * \value 実行する語
+ * \func 語の代わりに実行する関数。なければ NULL
+ * \arg func の引数
+ */
+static Task *task_new(Context *context, Value *value,
+					  TaskFunc *func, void *arg);
+
+/**
+ * タスクをスレッド・プールで実行させる。計測中はその場で実行する。
+ * \context タスクを作った文脈
+ * \task タスク
+ */
+static void task_submit(Context *context, Task *task);
+
+/**
+ * 子のスタックに積んだ引数で語を実行し、ただ一つ残った整数を下ろす。
+ * \context 子の文脈
+ * \value 実行する語
+ * \result 結果の書き込み先
+ */
+static Error *task_apply(Context *context, Value *value, Cell *result);
+
+/**
+ * TaskLoop の塊を取っては計算する。TaskFunc として実行する。
+ * \context 子の文脈
+ * \arg TaskLoop
+ */
+static Error *task_loop_run(Context *context, void *arg);
+
+/**
+ * TaskLoop の塊を、THREADS で設定した数までのスレッドで計算する。こ
+ * のスレッドも一つとして数える。
+ * \context 文脈
+ * \loop 計算する状態
+ */
+static Error *task_loop(Context *context, TaskLoop *loop);
+
+/**
+ * PMAP と PREDUCE の共通の引数 ( a x xt ) を確かめる。下ろさない。
+ * \context 文脈
+ * \loop 配列と語の書き込み先
+ */
+static Error *task_loop_args(Context *context, TaskLoop *loop);
+
+static void task_start(void)
+{
+	long n;
+	size_t i;
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	pool.workers = (TaskWorker *) calloc(n < 1 ? 1 : n, sizeof(TaskWorker));
+	if (NULL == pool.workers) {
+		return;
+	}
+	for (i = 0; i < (size_t) (n < 1 ? 1 : n); ++i) {
+		TaskWorker *worker;
+		worker = &pool.workers[i];
+		pthread_mutex_init(&worker->deque.lock, NULL);
+		worker->output = output_new(fileno(stdout));
+		if (NULL == worker->output) {
+			break;
+		}
+		pool.count = i + 1;  // 起動する前に盗む相手として見えるようにする
+		if (0 != pthread_create(&worker->thread, NULL, task_main, worker)) {
+			output_free(worker->output);
+			pool.count = i;
+			break;
+		}
+		pthread_detach(worker->thread);
+	}
+}
+
+static void *task_main(void *arg)
+{
+	task_worker = (TaskWorker *) arg;
+	task_seed = (unsigned int) (task_worker - pool.workers) + 1;
+	while (TRUE) {
+		Task *task;
+		task = task_take();
+		if (NULL != task) {
+			task_run(task, task_worker->output);
+			continue;
+		}
+		pthread_mutex_lock(&pool.lock);
+		__atomic_add_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+		while (0 == __atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST)) {
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		}
+		__atomic_sub_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool.lock);
+	}
+	return NULL;
+}
+
+static bool task_push(TaskDeque *deque, Task *task)
+{
+	pthread_mutex_lock(&deque->lock);
+	if (deque->memlen <= deque->tail - deque->head) {  // 満杯なので拡大する
+		Task **tasks;
+		size_t memlen, i;
+		memlen = 0 == deque->memlen ? 64 : deque->memlen * 2;
+		tasks = (Task **) malloc(sizeof(Task *) * memlen);
+		if (NULL == tasks) {
+			pthread_mutex_unlock(&deque->lock);
+			return FALSE;
+		}
+		for (i = deque->head; i != deque->tail; ++i) {
+			tasks[i & (memlen - 1)] = deque->tasks[i & (deque->memlen - 1)];
+		}
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->memlen = memlen;
+	}
+	deque->tasks[deque->tail & (deque->memlen - 1)] = task;
+	deque->tail += 1;
+	pthread_mutex_unlock(&deque->lock);
+	return TRUE;
+}
+
+static Task *task_take(void)
+{
+	Task *task = NULL;
+	size_t i, start;
+	if (0 == __atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST)) {
+		return NULL;
+	}
+	if (NULL != task_worker) {  // 自分が最後に積んだものから実行する
+		TaskDeque *deque;
+		deque = &task_worker->deque;
+		pthread_mutex_lock(&deque->lock);
+		if (deque->head != deque->tail) {
+			deque->tail -= 1;
+			task = deque->tasks[deque->tail & (deque->memlen - 1)];
+		}
+		pthread_mutex_unlock(&deque->lock);
+	}
+	task_seed = task_seed * 1103515245u + 12345u;
+	start = (task_seed >> 16) % pool.count;
+	for (i = 0; NULL == task && i < pool.count; ++i) {  // 古いものから盗む
+		TaskDeque *deque;
+		deque = &pool.workers[(start + i) % pool.count].deque;
+		pthread_mutex_lock(&deque->lock);
+		if (deque->head != deque->tail) {
+			task = deque->tasks[deque->head & (deque->memlen - 1)];
+			deque->head += 1;
+		}
+		pthread_mutex_unlock(&deque->lock);
+	}
+	if (NULL != task) {
+		__atomic_sub_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+	}
+	return task;
+}
+
+static void task_wake(void)
+{
+	if (0 != __atomic_load_n(&pool.sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&pool.lock);
+		pthread_cond_broadcast(&pool.wake);
+		pthread_mutex_unlock(&pool.lock);
+	}
+}
+
+static void task_run(Task *task, Output *output)
+{
+	Context *context;
+	context = task->context;
+	context->output = output;
+	task->error = NULL != task->func ? task->func(context, task->arg)
+		: context_execute(context, task->value);
+	task_discard(context);  // JOIN されなかった孫のタスク
+	output_flush(output);
+	__atomic_sub_fetch(&context->parent->running, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&task->done, 1, __ATOMIC_SEQ_CST);
+	task_wake();
+}
+
+static void task_wait(Task *task, Output *output)
+{
+	while (!__atomic_load_n(&task->done, __ATOMIC_SEQ_CST)) {
+		Task *other;
+		other = task_take();
+		if (NULL != other) {
+			task_run(other, output);
+			continue;
+		}
+		/* 実行できるタスクがなければ、積まれるか終わるまで眠る */
+		pthread_mutex_lock(&pool.lock);
+		__atomic_add_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+		while (!__atomic_load_n(&task->done, __ATOMIC_SEQ_CST)
+			   && 0 == __atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST)) {
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		}
+		__atomic_sub_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool.lock);
+	}
+}
+
+static void task_free(Task *task)
+{
+	context_free(task->context);
+	free(task);
+}
+
+Error *task_spawn(Context *context)
+{
+	Stack *stack;
+	Task *task;
+	Value *value;
+	Cell cell;
+	size_t handle;
+	int n;
+	stack = context->stack;
+	if (stack->len < 2) {
+		return error_new(EmptyStackError, NULL);
+	}
+	cell = stack->values[stack->len - 2];
+	if (!cell_is_symbol(stack->values[stack->len - 1])
+		|| !cell_is_integer(cell) || cell_integer(cell) < 0) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	n = cell_integer(cell);
+	if (stack->len - 2 < (size_t) n) {
+		return error_new(EmptyStackError, NULL);
+	}
+	value = context_resolve(context,
+							cell_symbol(stack->values[stack->len - 1]));
+	if (NULL == value) {
+		return error_new(IllegalDefinitionError, NULL);
+	}
+	if (NULL == context->tasks && NULL == (context->tasks = stack_new())) {
+		return error_new(StackOverflowError, NULL);
+	}
+	/* 空いているハンドルを探す */
+	for (handle = 0; handle < context->tasks->len; ++handle) {
+		if (0 == context->tasks->values[handle]) {
+			break;
+		}
+	}
+	if (handle == context->tasks->len
+		&& !stack_push(context->tasks, 0)) {
+		return error_new(StackOverflowError, NULL);
+	}
+	task = task_new(context, value, NULL, NULL);
+	if (NULL == task || !stack_reserve(task->context->stack, n)) {
+		if (NULL != task) {
+			task_free(task);
+		}
+		return error_new(StackOverflowError, NULL);
+	}
+	/* 子のスタックの種を移す */
+	stack->len -= 2;
+	memcpy(task->context->stack->values, &stack->values[stack->len - n],
+		   sizeof(Cell) * n);
+	task->context->stack->len = n;
+	stack->len -= n;
+	context->tasks->values[handle] = (Cell) task;
+	stack_push(stack, cell_from_integer((int) handle));
+	task_submit(context, task);
+	return NULL;
+}
+
+static Task *task_new(Context *context, Value *value,
+					  TaskFunc *func, void *arg)
+{
+	Task *task;
+	/* 共有した定義はタスクの実行中には最適化できないので、先に行う */
+	if (TYPE_DEFINITION == value->type && SIZE_MAX != context->tier_threshold) {
+		vm_promote(context, value_definition(value));
+	}
+	pthread_once(&pool_once, task_start);
+	task = (Task *) malloc(sizeof(Task));
+	if (NULL == task) {
+		return NULL;
+	}
+	task->context = context_new_task(context);
+	if (NULL == task->context) {
+		free(task);
+		return NULL;
+	}
+	task->value = value;
+	task->func = func;
+	task->arg = arg;
+	task->error = NULL;
+	task->done = 0;
+	return task;
+}
+
+static void task_submit(Context *context, Task *task)
+{
+	__atomic_add_fetch(&context->running, 1, __ATOMIC_SEQ_CST);
+	/* 計測中は定義を書き換えながら数えるので、その場で実行する */
+	if (context->profiling || 0 == pool.count) {
+		task_run(task, context->output);
+		return;
+	}
+	/* 盗まれるより先に数える */
+	__atomic_add_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+	if (!task_push(NULL != task_worker ? &task_worker->deque
+				   : &pool.workers[__atomic_fetch_add(&pool.next, 1,
+													  __ATOMIC_RELAXED)
+								   % pool.count].deque, task)) {
+		__atomic_sub_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+		task_run(task, context->output);
+		return;
+	}
+	task_wake();
+}
+
+Error *task_join(Context *context)
+{
+	Stack *stack;
+	Stack *results;
+	Task *task;
+	Error *error;
+	Cell cell;
+	size_t handle;
+	stack = context->stack;
+	if (stack->len < 1) {
+		return error_new(EmptyStackError, NULL);
+	}
+	cell = stack->values[stack->len - 1];
+	if (!cell_is_integer(cell) || cell_integer(cell) < 0
+		|| NULL == context->tasks
+		|| context->tasks->len <= (size_t) cell_integer(cell)
+		|| 0 == context->tasks->values[cell_integer(cell)]) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	handle = (size_t) cell_integer(cell);
+	task = (Task *) context->tasks->values[handle];
+	task_wait(task, context->output);
+	context->tasks->values[handle] = 0;
+	stack->len -= 1;
+	error = task->error;
+	results = task->context->stack;
+	if (NULL == error) {
+		if (stack_reserve(stack, stack->len + results->len)) {
+			memcpy(&stack->values[stack->len], results->values,
+				   sizeof(Cell) * results->len);
+			stack->len += results->len;
+		} else {
+			error = error_new(StackOverflowError, NULL);
+		}
+	}
+	task_free(task);
+	return error;
+}
+
+void task_quiesce(Context *context)
+{
+	size_t i;
+	if (0 == task_running(context)) {
+		return;
+	}
+	for (i = 0; i < context->tasks->len; ++i) {
+		if (0 != context->tasks->values[i]) {
+			task_wait((Task *) context->tasks->values[i], context->output);
+		}
+	}
+}
+
+void task_discard(Context *context)
+{
+	size_t i;
+	if (NULL == context->tasks) {
+		return;
+	}
+	for (i = 0; i < context->tasks->len; ++i) {
+		Task *task;
+		task = (Task *) context->tasks->values[i];
+		if (NULL != task) {
+			task_wait(task, context->output);
+			if (NULL != task->error) {
+				error_free(task->error);
+			}
+			task_free(task);
+		}
+	}
+	context->tasks->len = 0;
+}
+
+static Error *task_apply(Context *context, Value *value, Cell *result)
+{
+	Stack *stack;
+	Error *error;
+	stack = context->stack;
+	error = context_execute(context, value);
+	if (NULL != error) {
+		return error;
+	}
+	if (0 == stack->len) {
+		return error_new(EmptyStackError, NULL);
+	}
+	if (1 != stack->len || !cell_is_integer(stack->values[0])) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	stack->len = 0;
+	*result = stack->values[0];
+	return NULL;
+}
+
+static Error *task_loop_run(Context *context, void *arg)
+{
+	TaskLoop *loop;
+	Stack *stack;
+	int const *src;
+	loop = (TaskLoop *) arg;
+	stack = context->stack;
+	src = loop->src->values;
+	while (!__atomic_load_n(&loop->failed, __ATOMIC_RELAXED)) {
+		Error *error = NULL;
+		size_t c, i, begin, end;
+		Cell cell;
+		c = __atomic_fetch_add(&loop->next, 1, __ATOMIC_RELAXED);
+		if (loop->chunks <= c) {
+			break;
+		}
+		begin = c * loop->chunk;
+		end = begin + loop->chunk < loop->src->len
+			? begin + loop->chunk : loop->src->len;
+		if (NULL != loop->dst) {  // PMAP: ( x -- y )
+			for (i = begin; i < end && NULL == error; ++i) {
+				stack_push(stack, cell_from_integer(src[i]));
+				error = task_apply(context, loop->value, &cell);
+				if (NULL == error) {
+					loop->dst->values[i] = cell_integer(cell);
+				}
+			}
+		} else {  // PREDUCE: 塊の先頭から ( acc x -- acc ) で畳み込む
+			cell = cell_from_integer(src[begin]);
+			for (i = begin + 1; i < end && NULL == error; ++i) {
+				stack_push(stack, cell);
+				stack_push(stack, cell_from_integer(src[i]));
+				error = task_apply(context, loop->value, &cell);
+			}
+			loop->partials[c] = cell;
+		}
+		if (NULL != error) {  // 他のスレッドにも止めさせる
+			__atomic_store_n(&loop->failed, 1, __ATOMIC_RELAXED);
+			return error;
+		}
+	}
+	return NULL;
+}
+
+static Error *task_loop(Context *context, TaskLoop *loop)
+{
+	Task **tasks;
+	Error *error = NULL;
+	size_t threads, n, i;
+	if (0 == loop->chunks) {
+		return NULL;
+	}
+	pthread_once(&pool_once, task_start);
+	threads = 0 != context->threads ? context->threads : pool.count;
+	n = threads < loop->chunks ? threads : loop->chunks;
+	tasks = (Task **) malloc(sizeof(Task *) * n);
+	if (NULL == tasks) {
+		return error_new(StackOverflowError, NULL);
+	}
+	/* 作れた数だけのスレッドで計算する */
+	for (i = 0; i < n; ++i) {
+		tasks[i] = task_new(context, loop->value, task_loop_run, loop);
+		if (NULL == tasks[i]) {
+			break;
+		}
+	}
+	n = i;
+	if (0 == n) {
+		free(tasks);
+		return error_new(StackOverflowError, NULL);
+	}
+	for (i = 1; i < n; ++i) {
+		task_submit(context, tasks[i]);
+	}
+	__atomic_add_fetch(&context->running, 1, __ATOMIC_SEQ_CST);
+	task_run(tasks[0], context->output);
+	for (i = 0; i < n; ++i) {
+		task_wait(tasks[i], context->output);
+		if (NULL == error) {
+			error = tasks[i]->error;
+		} else if (NULL != tasks[i]->error) {
+			error_free(tasks[i]->error);
+		}
+		task_free(tasks[i]);
+	}
+	free(tasks);
+	return error;
+}
+
+static Error *task_loop_args(Context *context, TaskLoop *loop)
+{
+	Stack *stack;
+	Cell a, xt;
+	stack = context->stack;
+	if (stack->len < 3) {
+		return error_new(EmptyStackError, NULL);
+	}
+	a = stack->values[stack->len - 3];
+	xt = stack->values[stack->len - 1];
+	if (!cell_is_array(a) || !cell_is_symbol(xt)) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	loop->value = context_resolve(context, cell_symbol(xt));
+	if (NULL == loop->value) {
+		return error_new(IllegalDefinitionError, NULL);
+	}
+	loop->src = cell_array(a);
+	loop->chunk = TASK_CHUNK_SIZE / sizeof(int);
+	loop->chunks = (loop->src->len + loop->chunk - 1) / loop->chunk;
+	loop->next = 0;
+	loop->failed = 0;
+	return NULL;
+}
+
+Error *task_map(Context *context)
+{
+	TaskLoop loop;
+	Stack *stack;
+	Error *error;
+	Cell b;
+	stack = context->stack;
+	if (NULL != (error = task_loop_args(context, &loop))) {
+		return error;
+	}
+	b = stack->values[stack->len - 2];
+	if (!cell_is_array(b)) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	loop.dst = cell_array(b);
+	if (loop.src->len != loop.dst->len) {
+		return error_new(IllegalAddressError, NULL);
+	}
+	loop.partials = NULL;
+	if (NULL != (error = task_loop(context, &loop))) {
+		return error;
+	}
+	stack->len -= 3;
+	return NULL;
+}
+
+Error *task_reduce(Context *context)
+{
+	TaskLoop loop;
+	Context *child;
+	Stack *stack;
+	Error *error;
+	Cell acc;
+	size_t i;
+	stack = context->stack;
+	if (NULL != (error = task_loop_args(context, &loop))) {
+		return error;
+	}
+	acc = stack->values[stack->len - 2];
+	if (!cell_is_integer(acc)) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	loop.dst = NULL;
+	loop.partials = (Cell *) malloc(sizeof(Cell) * (loop.chunks + 1));
+	child = context_new_task(context);
+	if (NULL == loop.partials || NULL == child) {
+		error = error_new(StackOverflowError, NULL);
+		goto out;
+	}
+	if (NULL != (error = task_loop(context, &loop))) {
+		goto out;
+	}
+	/* 塊ごとの結果を順に畳み込む。結合的な語であれば逐次と一致する */
+	for (i = 0; i < loop.chunks && NULL == error; ++i) {
+		stack_push(child->stack, acc);
+		stack_push(child->stack, loop.partials[i]);
+		error = task_apply(child, loop.value, &acc);
+	}
+	if (NULL == error) {
+		stack->len -= 3;
+		stack_push(stack, acc);
+	}
+out:
+	if (NULL != child) {
+		context_free(child);
+	}
+	free(loop.partials);
+	return error;
+}
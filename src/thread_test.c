@@ -0,0 +1,204 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/** 同時に動かすスレッドの数 */
+#define THREADS 8
+
+/** 一つのスレッドが繰り返す回数 */
+#define ROUNDS 200
+
+/** スレッドに渡す引数と結果 */
+typedef struct _Worker Worker;
+struct _Worker {
+	pthread_t thread;  /* スレッド */
+	int id;            /* 通し番号 */
+	bool ok;           /* 結果 */
+};
+
+/**
+ * ソースを文脈に解釈させる。エラーが起きれば FALSE を返す。
+ * \context 文脈
+ * \source ソース
+ */
+static bool interpret(Context *context, char const *source)
+{
+	Lexer lexer;
+	char const *token;
+	size_t len;
+	bool ok = TRUE;
+	lexer_init(&lexer, source, strlen(source));
+	while (lexer_next(&lexer, &token, &len)) {
+		Error *error;
+		error = context_interpret_n(context, token, len);
+		if (NULL != error) {
+			error_free(error);
+			ok = FALSE;
+		}
+	}
+	return ok;
+}
+
+/**
+ * スタックの一番上が期待する整数であることを確かめ、スタックを空にす
+ * る。
+ * \context 文脈
+ * \expected 期待する整数
+ */
+static bool expect_top(Context *context, int expected)
+{
+	Cell cell;
+	bool ok;
+	ok = stack_pop(context->stack, &cell)
+		&& cell_is_integer(cell) && expected == cell_integer(cell);
+	context->stack->len = 0;
+	return ok;
+}
+
+/**
+ * 文脈を作っては捨てながら、スレッドごとに異なる語を定義して実行する。
+ * ビルトインの語を再定義したり計測したりしても、他のスレッドの文脈に
+ * 影響しないことを確かめる。
+ * \arg Worker
+ */
+static void *worker_run(void *arg)
+{
+	Worker *worker;
+	char source[512];
+	int round;
+	worker = (Worker *) arg;
+	worker->ok = TRUE;
+	for (round = 0; round < ROUNDS && worker->ok; ++round) {
+		Context *context;
+		int n, expected;
+		context = context_new();
+		if (NULL == context) {
+			worker->ok = FALSE;
+			break;
+		}
+		context->output->line_buffered = FALSE;
+		n = worker->id * ROUNDS + round;
+		if (0 == round % 4) {
+			interpret(context, "PROFILE");
+		}
+		if (1 == worker->id % 2) {  // 奇数のスレッドだけ DUP を再定義する
+			interpret(context, ": DUP 100 ;");
+		}
+		/* スレッドと回ごとに新しいシンボルを登録する */
+		snprintf(source, sizeof(source),
+				 ": w%d-%d DUP * %d + ; : sum%d 0 SWAP 0 DO I + LOOP ; "
+				 "VARIABLE v%d 3 v%d ! 7 w%d-%d v%d @ + 10 sum%d +",
+				 worker->id, round, n, n, n, n, worker->id, round, n, n);
+		expected = (1 == worker->id % 2 ? 7 * 100 : 7 * 7) + n + 3 + 45;
+		if (!interpret(context, source) || !expect_top(context, expected)) {
+			printf("worker %d round %d: %s\n", worker->id, round, source);
+			worker->ok = FALSE;
+		}
+		/* ビルトインの語を引けることと、エラーの自由リストを使うこと */
+		if (!interpret(context, "6 7 * ' + CATCH DROP")
+			|| !expect_top(context, 42)) {
+			worker->ok = FALSE;
+		}
+		/* 文脈ごとのタスクが同じスレッド・プールを共有する */
+		snprintf(source, sizeof(source),
+				 ": t%d 1 + ; 1 1 ' t%d SPAWN 2 1 ' t%d SPAWN JOIN SWAP JOIN +",
+				 n, n, n);
+		if (!interpret(context, source) || !expect_top(context, 5)) {
+			printf("worker %d round %d: %s\n", worker->id, round, source);
+			worker->ok = FALSE;
+		}
+		/* 配列の並列計算も同じスレッド・プールを共有する */
+		if (0 == round % 8) {
+			snprintf(source, sizeof(source),
+					 "20000 ARRAY p%d : f%d 20000 0 DO I I p%d A! LOOP ; f%d "
+					 "p%d p%d ' w%d-%d PMAP p%d 0 ' + PREDUCE p%d ASUM -",
+					 n, n, n, n, n, n, worker->id, round, n, n);
+			if (!interpret(context, source) || !expect_top(context, 0)) {
+				printf("worker %d round %d: %s\n", worker->id, round, source);
+				worker->ok = FALSE;
+			}
+		}
+		interpret(context, "1 0 /");
+		context->stack->len = 0;
+		context->output->len = 0;
+		context_free(context);
+	}
+	return NULL;
+}
+
+/** 多数のスレッドで同時に文脈を使う */
+static bool test_contexts(void)
+{
+	Worker workers[THREADS];
+	bool ok = TRUE;
+	int i;
+	for (i = 0; i < THREADS; ++i) {
+		workers[i].id = i;
+		pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+	}
+	for (i = 0; i < THREADS; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		ok &= workers[i].ok;
+	}
+	return ok;
+}
+
+/**
+ * 全スレッドで同じ名前の並びをインターンし、結果を記録する。
+ * \arg 結果の書き込み先 (Symbol const * の配列)
+ */
+static void *intern_run(void *arg)
+{
+	Symbol const **symbols;
+	char name[32];
+	int i;
+	symbols = (Symbol const **) arg;
+	for (i = 0; i < 4096; ++i) {
+		snprintf(name, sizeof(name), "intern%d", i);
+		symbols[i] = symbol_intern(name);
+	}
+	return NULL;
+}
+
+/** 同じ名前を同時にインターンしても、同じシンボルになる */
+static bool test_intern(void)
+{
+	static Symbol const *symbols[THREADS][4096];
+	pthread_t threads[THREADS];
+	bool ok = TRUE;
+	int i, j;
+	for (i = 0; i < THREADS; ++i) {
+		pthread_create(&threads[i], NULL, intern_run, symbols[i]);
+	}
+	for (i = 0; i < THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	for (j = 0; j < 4096; ++j) {
+		char name[32];
+		snprintf(name, sizeof(name), "intern%d", j);
+		for (i = 0; i < THREADS; ++i) {
+			if (NULL == symbols[i][j] || symbols[0][j] != symbols[i][j]
+				|| 0 != strcmp(name, symbol_name(symbols[i][j]))) {
+				printf("%s is interned twice\n", name);
+				ok = FALSE;
+				break;
+			}
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	bool ok = TRUE;
+	ok &= test_intern();
+	ok &= test_contexts();
+	if (ok) {
+		puts("OK");
+	}
+	return ok ? 0 : 1;
+}
@@ -6,8 +6,6 @@
 
 #include "forsh.h"
 
-static bool is_valid_symbol(char const *name);
-
 void value_str(Value const *value, char *buf, size_t size)
 {
 	switch (value->type) {
@@ -17,28 +15,43 @@ void value_str(Value const *value, char *buf, size_t size)
 	case TYPE_FUNCTION:
 		snprintf(buf, size, "FUNC(%d)", (int) value->data.p);
 		break;
-	case TYPE_SYMBOL:
-		snprintf(buf, size, "%s", (char *) value->data.p);
+	case TYPE_CONSTANT:
+		cell_str(value->data.cell, buf, size);
+		break;
+	case TYPE_DEFINITION:
+		snprintf(buf, size, "DEF(%s)",
+				 symbol_name(((Definition *) value->data.p)->name));
+		break;
+	case TYPE_OPCODE:
+		snprintf(buf, size, "OP(%s)", opcode_name(value->data.i));
+		break;
+	case TYPE_ARRAY:
+		snprintf(buf, size, "ARRAY(%zu)", value_array(value)->len);
 		break;
 	}
 }
 
-void value_free(Value *value)
+void cell_str(Cell cell, char *buf, size_t size)
 {
-	if (NULL == value) { return; }
-	if (value->type == TYPE_SYMBOL) {
-		free(value->data.p);
+	if (cell_is_integer(cell)) {
+		snprintf(buf, size, "%d", cell_integer(cell));
+	} else if (cell_is_symbol(cell)) {
+		snprintf(buf, size, "%s", symbol_name(cell_symbol(cell)));
+	} else if (cell_is_array(cell)) {
+		snprintf(buf, size, "%s[%zu]", symbol_name(cell_array(cell)->name),
+				 cell_array(cell)->len);
+	} else {
+		snprintf(buf, size, "CELL(%p)", (void *) cell);
 	}
-	free(value);
 }
 
 // ==================================================
 // 整数
 
-Value *value_new_integer(int i)
+Value *value_new_integer(Arena *arena, int i)
 {
 	Value *value;
-	value = (Value *) malloc(sizeof(Value));
+	value = (Value *) arena_alloc(arena, sizeof(Value));
 	if (NULL == value) {
 		return NULL;
 	}
@@ -47,11 +60,6 @@ Value *value_new_integer(int i)
 	return value;
 }
 
-Value *value_new_integer_str(char const *str)
-{
-	return value_new_integer(atoi(str));
-}
-
 int value_integer_value(Value *integer)
 {
 	return integer->data.i;
@@ -60,15 +68,17 @@ int value_integer_value(Value *integer)
 // ==================================================
 // 関数
 
-Value *value_new_function(ForshFunc *func)
+Value *value_new_function(Arena *arena, ForshFunc *func)
 {
 	Value *value;
-	value = (Value *) malloc(sizeof(Value));
+	value = (Value *) arena_alloc(arena, sizeof(Value));
 	if (NULL == value) {
 		return NULL;
 	}
 	value->type = TYPE_FUNCTION;
 	value->data.p = func;
+	value->profile.calls = 0;
+	value->profile.cycles = 0;
 	return value;
 }
 
@@ -78,45 +88,97 @@ ForshFunc *value_function(Value const *value)
 }
 
 // ==================================================
-// シンボル
+// コロン定義
 
-Value *value_new_symbol(char const *name)
+Value *value_new_definition(Arena *arena, Definition *definition)
 {
 	Value *value;
-	if (!is_valid_symbol(name)) {
+	value = (Value *) arena_alloc(arena, sizeof(Value));
+	if (NULL == value) {
 		return NULL;
 	}
-	value = (Value *) malloc(sizeof(Value));
+	value->type = TYPE_DEFINITION;
+	value->data.p = definition;
+	return value;
+}
+
+Definition *value_definition(Value const *value)
+{
+	return value->data.p;
+}
+
+// ==================================================
+// 定数
+
+Value *value_new_constant(Arena *arena, Cell cell)
+{
+	Value *value;
+	value = (Value *) arena_alloc(arena, sizeof(Value));
 	if (NULL == value) {
 		return NULL;
 	}
-	value->type = TYPE_SYMBOL;
-	value->data.p = strdup(name);
-	if (NULL == value->data.p) {
-		goto err_strdup;
+	value->type = TYPE_CONSTANT;
+	value->data.cell = cell;
+	return value;
+}
+
+Cell value_constant(Value const *value)
+{
+	return value->data.cell;
+}
+
+// ==================================================
+// 配列
+
+Value *value_new_array(Arena *arena, Array *array)
+{
+	Value *value;
+	value = (Value *) arena_alloc(arena, sizeof(Value));
+	if (NULL == value) {
+		return NULL;
 	}
+	value->type = TYPE_ARRAY;
+	value->data.cell = cell_from_array(array);  // 定数と同じく積む
 	return value;
-err_strdup:
-	free(value);
-	return NULL;
 }
 
-char const *value_symbol_name(Value const *value)
+Array *value_array(Value const *value)
 {
-	return value->data.p;
+	return cell_array(value->data.cell);
+}
+
+// ==================================================
+// 命令
+
+Value *value_new_opcode(Arena *arena, Opcode op)
+{
+	Value *value;
+	value = (Value *) arena_alloc(arena, sizeof(Value));
+	if (NULL == value) {
+		return NULL;
+	}
+	value->type = TYPE_OPCODE;
+	value->data.i = op;
+	value->profile.calls = 0;
+	value->profile.cycles = 0;
+	return value;
+}
+
+Opcode value_opcode(Value const *value)
+{
+	return (Opcode) value->data.i;
 }
 
-static bool is_valid_symbol(char const *name)
+bool value_is_valid_symbol(char const *name, size_t len)
 {
+	size_t i;
 	if (NULL == name) { return FALSE; }
-	if (strlen(name) < 1) { return FALSE; }
-	if (!isalpha(name[0])) { return FALSE; }
-	++name;
-	while (*name) {
-		if (!isalnum(*name)) {
+	if (len < 1) { return FALSE; }
+	if (!isalpha((unsigned char) name[0])) { return FALSE; }
+	for (i = 1; i < len; ++i) {
+		if (!isalnum((unsigned char) name[i])) {
 			return FALSE;
 		}
-		++name;
 	}
 	return TRUE;
 }
@@ -0,0 +1,1229 @@
+/*
+ * Copyright 2012 Yuichi Araki. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "forsh.h"
+
+/*
+ * 内部インタープリター。GCC と clang ではラベルの番地 (labels as
+ * values) を用いた直接スレッデッド・コードとして実行し、それ以外のコ
+ * ンパイラーでは switch による命令ループで実行する。FORSH_NO_THREADED
+ * を定義すれば後者を強制できる。
+ */
+#if defined(__GNUC__) && !defined(FORSH_NO_THREADED)
+#define FORSH_THREADED
+#endif
+
+#ifdef FORSH_THREADED
+#define CASE(op) L_##op:
+#define NEXT goto *(ip++)->label
+#define DISPATCH NEXT;
+#define END_DISPATCH
+#else
+#define CASE(op) case op:
+#define NEXT continue
+#define DISPATCH for (;;) { switch ((ip++)->op) {
+#define END_DISPATCH default: abort(); } }
+#endif
+
+/*
+ * vm_run はスタックの長さを len に、一番上の要素を tos に置いたまま実
+ * 行する。values[len - 1] のメモリは古い値のままで、ビルトイン関数を
+ * 呼び出すときやエラー、戻るときだけ Stack に書き戻す (SPILL)。
+ * ガード・ページで挟んだスタックでは、積む前に余地を確かめない (limit
+ * が SIZE_MAX)。
+ */
+#define SPILL() (values[len - 1] = tos, stack->len = len)
+#define RELOAD() \
+	(values = stack->values, len = stack->len, tos = values[len - 1], \
+	 limit = 0 != stack->guard ? SIZE_MAX : stack->memlen)
+
+/** tos を押し下げて値を積む。メモリが確保できなければ積まない */
+#define PUSH(value) \
+	do { \
+		if (limit <= len) { \
+			if (!stack_reserve(stack, len + 1)) { \
+				break; \
+			} \
+			values = stack->values; \
+			limit = stack->memlen; \
+		} \
+		values[len - 1] = tos; \
+		tos = (value); \
+		len += 1; \
+	} while (0)
+
+/**
+ * リターン・スタックに n 個積む余地がなければ拡大する。拡大できなけれ
+ * ば溢れたことにする。
+ */
+#define RRESERVE(n) \
+	do { \
+		if (rstack->memlen < rstack->len + (n) \
+			&& !vm_reserve_rstack(rstack, (n))) { \
+			goto err_overflow; \
+		} \
+	} while (0)
+
+/** 上の二つが整数であれば TRUE */
+#define INTEGERS() \
+	(2 <= len && cell_is_integer(tos) && cell_is_integer(values[len - 2]))
+
+#ifdef FORSH_THREADED
+/** 命令の種別から処理の番地への対応表。vm_run が初期化する */
+static void const *const *vm_labels;
+
+/** vm_labels を一度だけ初期化するための制御変数 */
+static pthread_once_t vm_once = PTHREAD_ONCE_INIT;
+
+/**
+ * vm_labels を初期化する。pthread_once で一度だけ呼び出す。
+ */
+static void vm_init(void);
+#endif
+
+/**
+ * CATCH で実行したコロン定義の戻り先。スレッデッド・コードでは vm_run
+ * が処理の番地を設定する。
+ */
+static Inst vm_uncatch = { OP_UNCATCH };
+
+/**
+ * リターン・スタックに戻り番地を積めなかった場合に、翻訳された機械語
+ * から内部インタープリターに戻る先。
+ */
+static Inst vm_overflow_inst = { OP_OVERFLOW };
+
+/**
+ * スレッデッド・コードを実行する。context が NULL の場合は vm_labels
+ * を初期化するだけで戻る。
+ * \context 文脈
+ * \ip 最初に実行するコード
+ * \rbase 呼び出し時のリターン・スタックの深さ。この深さで EXIT すると
+ * 戻る
+ */
+static Error *vm_run(Context *context, Inst const *ip, size_t rbase);
+
+/**
+ * スタックに指定した数以上の要素があるかを調べる。
+ * \stack スタック
+ * \depth 必要な要素の数
+ */
+static Error *vm_check_depth(Stack const *stack, size_t depth);
+
+/**
+ * スタックの上の二つが整数であるかを調べる。検査の順序は
+ * two_integer_func と同じである。
+ * \stack スタック
+ * \nozero 一番上がゼロであるときにエラーとするなら TRUE
+ */
+static Error *vm_check_integers(Stack const *stack, bool nozero);
+
+/**
+ * スーパー命令を構成する一つ目の命令を実行し、二つ目の命令の前提を検
+ * 査した結果を返す。スーパー命令がエラーになるときに、まとめる前のコー
+ * ドと同じ状態のスタックと同じエラーを得るために用いる。
+ * \stack スタック
+ * \first 一つ目の命令
+ * \operand 一つ目の命令の被演算子
+ */
+static Error *vm_unfused(Stack *stack, Opcode first, Inst const *operand);
+
+/**
+ * 命令に検査を省いた版があればその種別を、なければ同じ種別を返す。
+ * \op 命令の種別
+ */
+static Opcode vm_unchecked(Opcode op);
+
+/**
+ * スタックがコロン定義のスタック効果の前提を満たすかを調べ、実行中に
+ * 伸びる分のメモリを確保する。
+ * \stack スタック
+ * \len スタックの長さ
+ * \tos スタックの一番上の要素
+ * \effect スタック効果
+ */
+static bool vm_check_effect(Stack *stack, size_t len, Cell tos,
+							Effect const *effect);
+
+/**
+ * スレッデッド・コードの命令を置き換える。
+ * \inst 置き換える命令
+ * \op 命令の種別
+ */
+static void vm_patch(Inst *inst, Opcode op);
+
+#ifdef FORSH_THREADED
+static void vm_init(void)
+{
+	vm_run(NULL, NULL, 0);
+}
+#endif
+
+Inst *vm_thread(Arena *arena, Inst const *code, size_t len, bool unchecked)
+{
+	Inst *threaded;
+	size_t i;
+	threaded = (Inst *) arena_alloc(arena, sizeof(Inst) * len);
+	if (NULL == threaded) {
+		return NULL;
+	}
+	memcpy(threaded, code, sizeof(Inst) * len);
+#ifdef FORSH_THREADED
+	pthread_once(&vm_once, vm_init);
+#endif
+	for (i = 0; i < len; i += 1 + opcode_operands(code[i].op)) {
+		vm_patch(&threaded[i], unchecked ? vm_unchecked(code[i].op)
+				 : code[i].op);
+	}
+	return threaded;
+}
+
+Error *vm_execute_op(Context *context, Opcode op)
+{
+	Inst code[2];
+#ifdef FORSH_THREADED
+	pthread_once(&vm_once, vm_init);
+#endif
+	vm_patch(&code[0], op);
+	vm_patch(&code[1], OP_EXIT);
+	return vm_run(context, code, context->rstack->len);
+}
+
+Error *vm_execute(Context *context, Definition const *definition)
+{
+	Inst const *ip;
+	size_t rbase;
+	rbase = context->rstack->len;
+	ip = definition->threaded;
+	/* 計測中は ENTER を数えられるよう内部インタープリターで実行する */
+	if (NULL != definition->native && !context->profiling) {
+		ip = jit_execute(context, definition);
+		if (NULL == ip) {
+			return NULL;
+		}
+	}
+	return vm_run(context, ip, rbase);
+}
+
+void vm_promote(Context *context, Definition *definition)
+{
+	size_t i;
+	/*
+	 * タスクが実行している間は、タスクと共有している定義を書き換えず、
+	 * JIT の領域の保護も変えない
+	 */
+	if (!definition_is_cold(definition) || NULL != context->parent
+		|| 0 != task_running(context)) {
+		return;
+	}
+	/* 呼び出し先を先に翻訳しておけば、機械語から直接呼び出せる */
+	for (i = 0; i < definition->len;
+		 i += 1 + opcode_operands(definition->code[i].op)) {
+		Opcode op;
+		op = definition->code[i].op;
+		/* 自身の呼び出し (RECURSE) は、これから最適化する */
+		if ((OP_ENTER == op || OP_TAIL == op)
+			&& definition != definition->code[i + 1].definition) {
+			vm_promote(context, definition->code[i + 1].definition);
+		}
+	}
+	if (!definition_promote(context->arena, definition)) {
+		return;  // 第 0 層のまま実行を続ける
+	}
+	if (NULL != context->jit) {  // 翻訳できなければ内部インタープリターで実行する
+		jit_compile(context->jit, definition);
+	}
+	if (context->profiling) {
+		vm_profile(definition, TRUE);
+	}
+}
+
+void vm_profile(Definition *definition, bool enable)
+{
+	size_t i;
+	for (i = 0; i < definition->len;
+		 i += 1 + opcode_operands(definition->code[i].op)) {
+		Opcode op;
+		switch (definition->code[i].op) {
+		case OP_ENTER:
+			op = enable ? OP_PROFILE_ENTER : OP_ENTER;
+			break;
+		case OP_TAIL:  // 計測中は戻って経過時間を数える
+			op = enable ? OP_PROFILE_ENTER : OP_TAIL;
+			break;
+		case OP_EXIT:
+			op = enable ? OP_PROFILE_EXIT : OP_EXIT;
+			break;
+		default:
+			continue;
+		}
+		vm_patch(&definition->checked[i], op);
+		if (definition->threaded != definition->checked) {
+			vm_patch(&definition->threaded[i], vm_unchecked(op));
+		}
+	}
+}
+
+bool vm_reserve_rstack(Stack *rstack, size_t n)
+{
+	return rstack->len + n <= FORSH_RSTACK_MAX
+		&& stack_reserve(rstack, rstack->len + n);
+}
+
+Inst const *vm_overflow(void)
+{
+	return &vm_overflow_inst;
+}
+
+static void vm_patch(Inst *inst, Opcode op)
+{
+#ifdef FORSH_THREADED
+	inst->label = vm_labels[op];
+#else
+	inst->op = op;
+#endif
+}
+
+static Opcode vm_unchecked(Opcode op)
+{
+	switch (op) {
+	case OP_LIT:
+		return OP_LIT_UNCHECKED;
+	case OP_ENTER:
+		return OP_ENTER_UNCHECKED;
+	case OP_TAIL:
+		return OP_TAIL_UNCHECKED;
+	case OP_PLUS:
+		return OP_PLUS_UNCHECKED;
+	case OP_MINUS:
+		return OP_MINUS_UNCHECKED;
+	case OP_STAR:
+		return OP_STAR_UNCHECKED;
+	case OP_SLASH:
+		return OP_SLASH_UNCHECKED;
+	case OP_DUP:
+		return OP_DUP_UNCHECKED;
+	case OP_DROP:
+		return OP_DROP_UNCHECKED;
+	case OP_SWAP:
+		return OP_SWAP_UNCHECKED;
+	case OP_OVER:
+		return OP_OVER_UNCHECKED;
+	case OP_LIT_PLUS:
+		return OP_LIT_PLUS_UNCHECKED;
+	case OP_LIT_MINUS:
+		return OP_LIT_MINUS_UNCHECKED;
+	case OP_LIT_STAR:
+		return OP_LIT_STAR_UNCHECKED;
+	case OP_LIT_SLASH:
+		return OP_LIT_SLASH_UNCHECKED;
+	case OP_DUP_PLUS:
+		return OP_DUP_PLUS_UNCHECKED;
+	case OP_DUP_STAR:
+		return OP_DUP_STAR_UNCHECKED;
+	case OP_OVER_PLUS:
+		return OP_OVER_PLUS_UNCHECKED;
+	case OP_OVER_MINUS:
+		return OP_OVER_MINUS_UNCHECKED;
+	case OP_SWAP_MINUS:
+		return OP_SWAP_MINUS_UNCHECKED;
+	case OP_NIP:
+		return OP_NIP_UNCHECKED;
+	default:
+		return op;
+	}
+}
+
+static bool vm_check_effect(Stack *stack, size_t len, Cell tos,
+							Effect const *effect)
+{
+	size_t i;
+	if (len < effect->in) {
+		return FALSE;
+	}
+	if ((effect->integers & 1) && !cell_is_integer(tos)) {
+		return FALSE;
+	}
+	for (i = 1; i < effect->in; ++i) {
+		if ((effect->integers & ((uint32_t) 1 << i))
+			&& !cell_is_integer(stack->values[len - 1 - i])) {
+			return FALSE;
+		}
+	}
+	return stack->memlen >= len + effect->peak
+		|| stack_reserve(stack, len + effect->peak);
+}
+
+static Error *vm_check_depth(Stack const *stack, size_t depth)
+{
+	if (stack->len < depth) {
+		return error_new(EmptyStackError, NULL);
+	}
+	return NULL;
+}
+
+static Error *vm_check_integers(Stack const *stack, bool nozero)
+{
+	Cell a;
+	if (stack->len < 1) {
+		return error_new(EmptyStackError, NULL);
+	}
+	a = stack->values[stack->len - 1];
+	if (!cell_is_integer(a)) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	if (nozero && 0 == cell_integer(a)) {
+		return error_new(DividedByZeroError, NULL);
+	}
+	if (stack->len < 2) {
+		return error_new(EmptyStackError, NULL);
+	}
+	if (!cell_is_integer(stack->values[stack->len - 2])) {
+		return error_new(IllegalTypeError, NULL);
+	}
+	return NULL;
+}
+
+static Error *vm_unfused(Stack *stack, Opcode first, Inst const *operand)
+{
+	Error *error;
+	Cell *top;
+	Cell a;
+	switch (first) {
+	case OP_LIT:
+		stack_push(stack, operand->cell);
+		break;
+	case OP_DUP:
+		if (NULL != (error = vm_check_depth(stack, 1))) {
+			return error;
+		}
+		stack_push(stack, stack->values[stack->len - 1]);
+		break;
+	case OP_OVER:
+		if (NULL != (error = vm_check_depth(stack, 2))) {
+			return error;
+		}
+		stack_push(stack, stack->values[stack->len - 2]);
+		break;
+	case OP_SWAP:
+		if (NULL != (error = vm_check_depth(stack, 2))) {
+			return error;
+		}
+		top = &stack->values[stack->len - 1];
+		a = top[0];
+		top[0] = top[-1];
+		top[-1] = a;
+		break;
+	default:
+		break;
+	}
+	return vm_check_integers(stack, FALSE);
+}
+
+static Error *vm_run(Context *context, Inst const *ip, size_t rbase)
+{
+#ifdef FORSH_THREADED
+	static void const *const labels[OP_COUNT] = {
+		[OP_LIT] = &&L_OP_LIT,
+		[OP_CALL] = &&L_OP_CALL,
+		[OP_ENTER] = &&L_OP_ENTER,
+		[OP_EXIT] = &&L_OP_EXIT,
+		[OP_PLUS] = &&L_OP_PLUS,
+		[OP_MINUS] = &&L_OP_MINUS,
+		[OP_STAR] = &&L_OP_STAR,
+		[OP_SLASH] = &&L_OP_SLASH,
+		[OP_DUP] = &&L_OP_DUP,
+		[OP_DROP] = &&L_OP_DROP,
+		[OP_SWAP] = &&L_OP_SWAP,
+		[OP_OVER] = &&L_OP_OVER,
+		[OP_CATCH] = &&L_OP_CATCH,
+		[OP_THROW] = &&L_OP_THROW,
+		[OP_HERE] = &&L_OP_HERE,
+		[OP_ALLOT] = &&L_OP_ALLOT,
+		[OP_COMMA] = &&L_OP_COMMA,
+		[OP_FETCH] = &&L_OP_FETCH,
+		[OP_STORE] = &&L_OP_STORE,
+		[OP_PLUS_STORE] = &&L_OP_PLUS_STORE,
+		[OP_CELLS] = &&L_OP_CELLS,
+		[OP_DOT] = &&L_OP_DOT,
+		[OP_EMIT] = &&L_OP_EMIT,
+		[OP_CR] = &&L_OP_CR,
+		[OP_TYPE] = &&L_OP_TYPE,
+		[OP_SPAWN] = &&L_OP_SPAWN,
+		[OP_JOIN] = &&L_OP_JOIN,
+		[OP_PMAP] = &&L_OP_PMAP,
+		[OP_PREDUCE] = &&L_OP_PREDUCE,
+		[OP_BRANCH] = &&L_OP_BRANCH,
+		[OP_ZBRANCH] = &&L_OP_ZBRANCH,
+		[OP_DO] = &&L_OP_DO,
+		[OP_LOOP] = &&L_OP_LOOP,
+		[OP_I] = &&L_OP_I,
+		[OP_J] = &&L_OP_J,
+		[OP_TAIL] = &&L_OP_TAIL,
+		[OP_LIT_PLUS] = &&L_OP_LIT_PLUS,
+		[OP_LIT_MINUS] = &&L_OP_LIT_MINUS,
+		[OP_LIT_STAR] = &&L_OP_LIT_STAR,
+		[OP_LIT_SLASH] = &&L_OP_LIT_SLASH,
+		[OP_DUP_PLUS] = &&L_OP_DUP_PLUS,
+		[OP_DUP_STAR] = &&L_OP_DUP_STAR,
+		[OP_OVER_PLUS] = &&L_OP_OVER_PLUS,
+		[OP_OVER_MINUS] = &&L_OP_OVER_MINUS,
+		[OP_SWAP_MINUS] = &&L_OP_SWAP_MINUS,
+		[OP_NIP] = &&L_OP_NIP,
+		[OP_PROFILE_ENTER] = &&L_OP_PROFILE_ENTER,
+		[OP_PROFILE_EXIT] = &&L_OP_PROFILE_EXIT,
+		[OP_TIER_UP] = &&L_OP_TIER_UP,
+		[OP_CHECK] = &&L_OP_CHECK,
+		[OP_UNCATCH] = &&L_OP_UNCATCH,
+		[OP_OVERFLOW] = &&L_OP_OVERFLOW,
+		[OP_LIT_UNCHECKED] = &&L_OP_LIT_UNCHECKED,
+		[OP_ENTER_UNCHECKED] = &&L_OP_ENTER_UNCHECKED,
+		[OP_TAIL_UNCHECKED] = &&L_OP_TAIL_UNCHECKED,
+		[OP_PLUS_UNCHECKED] = &&L_OP_PLUS_UNCHECKED,
+		[OP_MINUS_UNCHECKED] = &&L_OP_MINUS_UNCHECKED,
+		[OP_STAR_UNCHECKED] = &&L_OP_STAR_UNCHECKED,
+		[OP_SLASH_UNCHECKED] = &&L_OP_SLASH_UNCHECKED,
+		[OP_DUP_UNCHECKED] = &&L_OP_DUP_UNCHECKED,
+		[OP_DROP_UNCHECKED] = &&L_OP_DROP_UNCHECKED,
+		[OP_SWAP_UNCHECKED] = &&L_OP_SWAP_UNCHECKED,
+		[OP_OVER_UNCHECKED] = &&L_OP_OVER_UNCHECKED,
+		[OP_LIT_PLUS_UNCHECKED] = &&L_OP_LIT_PLUS_UNCHECKED,
+		[OP_LIT_MINUS_UNCHECKED] = &&L_OP_LIT_MINUS_UNCHECKED,
+		[OP_LIT_STAR_UNCHECKED] = &&L_OP_LIT_STAR_UNCHECKED,
+		[OP_LIT_SLASH_UNCHECKED] = &&L_OP_LIT_SLASH_UNCHECKED,
+		[OP_DUP_PLUS_UNCHECKED] = &&L_OP_DUP_PLUS_UNCHECKED,
+		[OP_DUP_STAR_UNCHECKED] = &&L_OP_DUP_STAR_UNCHECKED,
+		[OP_OVER_PLUS_UNCHECKED] = &&L_OP_OVER_PLUS_UNCHECKED,
+		[OP_OVER_MINUS_UNCHECKED] = &&L_OP_OVER_MINUS_UNCHECKED,
+		[OP_SWAP_MINUS_UNCHECKED] = &&L_OP_SWAP_MINUS_UNCHECKED,
+		[OP_NIP_UNCHECKED] = &&L_OP_NIP_UNCHECKED,
+	};
+#endif
+	Stack *stack;
+	Stack *rstack;
+	Stack *data;
+	Output *output;
+	Cell *values;
+	size_t len;
+	size_t limit;
+	Cell tos;
+	Cell a;
+	Definition *definition;
+	Value *value;
+	Cell const *frame;
+	Cell *cell;
+	Error *error;
+	int code;
+	int count;
+#ifdef FORSH_THREADED
+	if (NULL == context) {
+		vm_labels = labels;
+		vm_patch(&vm_uncatch, OP_UNCATCH);
+		vm_patch(&vm_overflow_inst, OP_OVERFLOW);
+		return NULL;
+	}
+#endif
+	stack = context->stack;
+	rstack = context->rstack;
+	data = context->data;
+	output = context->output;
+	RELOAD();
+dispatch:
+	DISPATCH
+	CASE(OP_LIT)
+		a = (ip++)->cell;
+		PUSH(a);
+		NEXT;
+	CASE(OP_CALL)
+		SPILL();
+		error = (ip++)->func(stack);
+		RELOAD();
+		if (NULL != error) {
+			goto err;
+		}
+		NEXT;
+	CASE(OP_ENTER)
+		RRESERVE(1);
+		stack_push(rstack, (Cell) (ip + 1));
+		ip = ip->definition->threaded;
+		NEXT;
+	CASE(OP_EXIT)
+		if (rstack->len == rbase) {
+			SPILL();
+			return NULL;
+		}
+		stack_pop(rstack, &a);
+		ip = (Inst const *) a;
+		NEXT;
+	CASE(OP_PLUS)
+		if (!INTEGERS()) {
+			goto err_integers;
+		}
+		len -= 1;
+		tos = cell_from_integer(cell_integer(values[len - 1])
+								+ cell_integer(tos));
+		NEXT;
+	CASE(OP_MINUS)
+		if (!INTEGERS()) {
+			goto err_integers;
+		}
+		len -= 1;
+		tos = cell_from_integer(cell_integer(values[len - 1])
+								- cell_integer(tos));
+		NEXT;
+	CASE(OP_STAR)
+		if (!INTEGERS()) {
+			goto err_integers;
+		}
+		len -= 1;
+		tos = cell_from_integer(cell_integer(values[len - 1])
+								* cell_integer(tos));
+		NEXT;
+	CASE(OP_SLASH)
+		if (!INTEGERS() || 0 == cell_integer(tos)) {
+			SPILL();
+			error = vm_check_integers(stack, TRUE);
+			goto err;
+		}
+		len -= 1;
+		tos = cell_from_integer(integer_divide(
+			cell_integer(values[len - 1]), cell_integer(tos)));
+		NEXT;
+	CASE(OP_DUP)
+		if (len < 1) {
+			goto err_depth;
+		}
+		PUSH(tos);
+		NEXT;
+	CASE(OP_DROP)
+		if (len < 1) {
+			goto err_depth;
+		}
+		len -= 1;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_SWAP)
+		if (len < 2) {
+			goto err_depth;
+		}
+		a = values[len - 2];
+		values[len - 2] = tos;
+		tos = a;
+		NEXT;
+	CASE(OP_OVER)
+		if (len < 2) {
+			goto err_depth;
+		}
+		a = values[len - 2];
+		PUSH(a);
+		NEXT;
+	/*
+	 * 例外フレームを積んで実行トークン (語のシンボル) を実行する。フレー
+	 * ムはリターン・スタックに積んだ戻り番地、スタックの深さ、外側のフ
+	 * レームの位置の三つで、エラーが起きると unwind で巻き戻す。
+	 */
+	CASE(OP_CATCH)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (!cell_is_symbol(tos)) {
+			goto err_type;
+		}
+		value = context_resolve(context, cell_symbol(tos));
+		if (NULL == value) {
+			SPILL();
+			error = error_new(IllegalDefinitionError, NULL);
+			goto err;
+		}
+		/* 例外フレームと戻り先 (計測中は定義と時刻も) を積む余地 */
+		RRESERVE(context->profiling ? 6 : 4);
+		len -= 1;
+		tos = values[len - 1];
+		stack_push(rstack, (Cell) ip);
+		stack_push(rstack, (Cell) len);
+		stack_push(rstack, (Cell) context->handler);
+		context->handler = rstack->len - 3;
+		switch (value->type) {
+		case TYPE_FUNCTION:
+			SPILL();
+			error = value_function(value)(stack);
+			RELOAD();
+			if (NULL != error) {
+				goto err;
+			}
+			ip = &vm_uncatch;
+			break;
+		case TYPE_DEFINITION:
+			definition = value_definition(value);
+			stack_push(rstack, (Cell) &vm_uncatch);
+			if (context->profiling) {  // OP_PROFILE_EXIT で戻る
+				definition->profile.calls += 1;
+				stack_push(rstack, (Cell) definition);
+				stack_push(rstack, (Cell) profile_clock());
+			}
+			ip = definition->threaded;
+			break;
+		case TYPE_OPCODE:
+			SPILL();
+			error = vm_execute_op(context, value_opcode(value));
+			RELOAD();
+			if (NULL != error) {
+				goto err;
+			}
+			ip = &vm_uncatch;
+			break;
+		default:  // 定数
+			PUSH(value_constant(value));
+			ip = &vm_uncatch;
+			break;
+		}
+		NEXT;
+	CASE(OP_THROW)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		code = cell_integer(tos);
+		len -= 1;
+		tos = values[len - 1];
+		if (0 == code) {
+			NEXT;
+		}
+		SPILL();
+		goto raise;
+	/*
+	 * データ空間。番地は整数で、data_cell でデータ空間の中のセルの境界
+	 * にあることを確かめる。
+	 */
+	CASE(OP_HERE)
+		a = cell_from_integer(data_here(data));
+		PUSH(a);
+		NEXT;
+	CASE(OP_ALLOT)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		/* タスクの間で共有しているデータ空間は、タスクの中では伸縮しない */
+		if (NULL != context->parent) {
+			goto err_address;
+		}
+		task_quiesce(context);
+		if (!data_allot(data, cell_integer(tos))) {
+			goto err_address;
+		}
+		len -= 1;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_COMMA)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (NULL != context->parent) {
+			goto err_address;
+		}
+		task_quiesce(context);
+		if (!data_allot(data, sizeof(Cell))) {
+			goto err_address;
+		}
+		data->values[data->len - 1] = tos;
+		len -= 1;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_FETCH)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		if (NULL == (cell = data_cell(data, tos))) {
+			goto err_address;
+		}
+		tos = *cell;
+		NEXT;
+	CASE(OP_STORE)
+		if (len < 2) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		if (NULL == (cell = data_cell(data, tos))) {
+			goto err_address;
+		}
+		*cell = values[len - 2];
+		len -= 2;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_PLUS_STORE)
+		if (len < 2) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		if (NULL == (cell = data_cell(data, tos))) {
+			goto err_address;
+		}
+		if (!cell_is_integer(values[len - 2]) || !cell_is_integer(*cell)) {
+			goto err_type;
+		}
+		*cell = cell_from_integer(cell_integer(*cell)
+								  + cell_integer(values[len - 2]));
+		len -= 2;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_CELLS)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		tos = cell_from_integer(cell_integer(tos) * (int) sizeof(Cell));
+		NEXT;
+	/*
+	 * 出力。出力バッファに書き込むだけで、書き出すのは output_flush か
+	 * バッファが一杯になったときである。
+	 */
+	CASE(OP_DOT)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		output_integer(output, cell_integer(tos), context->base);
+		output_char(output, ' ');
+		len -= 1;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_EMIT)
+		if (len < 1) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos)) {
+			goto err_type;
+		}
+		output_char(output, (char) cell_integer(tos));
+		len -= 1;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_CR)
+		output_char(output, '\n');
+		NEXT;
+	CASE(OP_TYPE)
+		/* データ空間には文字をセルごとに置くので、セルを一文字ずつ出力する */
+		if (len < 2) {
+			goto err_depth;
+		}
+		if (!cell_is_integer(tos) || !cell_is_integer(values[len - 2])) {
+			goto err_type;
+		}
+		count = cell_integer(tos);
+		if (0 < count) {
+			if (NULL == (cell = data_cell(data, values[len - 2]))
+				|| (size_t) (data->values + data->len - cell) < (size_t) count) {
+				goto err_address;
+			}
+			for (; 0 < count; --count, ++cell) {
+				if (!cell_is_integer(*cell)) {
+					goto err_type;
+				}
+				output_char(output, (char) cell_integer(*cell));
+			}
+		}
+		len -= 2;
+		tos = values[len - 1];
+		NEXT;
+	/* タスク。スタックを直接操作するので、キャッシュした TOS を書き戻す */
+	CASE(OP_SPAWN)
+		SPILL();
+		error = task_spawn(context);
+		RELOAD();
+		if (NULL != error) {
+			goto err;
+		}
+		NEXT;
+	CASE(OP_JOIN)
+		SPILL();
+		error = task_join(context);
+		RELOAD();
+		if (NULL != error) {
+			goto err;
+		}
+		NEXT;
+	CASE(OP_PMAP)
+		SPILL();
+		error = task_map(context);
+		RELOAD();
+		if (NULL != error) {
+			goto err;
+		}
+		NEXT;
+	CASE(OP_PREDUCE)
+		SPILL();
+		error = task_reduce(context);
+		RELOAD();
+		if (NULL != error) {
+			goto err;
+		}
+		NEXT;
+	/*
+	 * 分岐。ip は被演算子を指しているので、そこからの相対位置へ飛ぶ。
+	 * DO ... LOOP の上限と添字はリターン・スタックの上の二つに置く。
+	 */
+	CASE(OP_BRANCH)
+		ip += ip->offset;
+		NEXT;
+	CASE(OP_ZBRANCH)
+		if (len < 1) {
+			goto err_depth;
+		}
+		a = tos;
+		len -= 1;
+		tos = values[len - 1];
+		ip += cell_from_integer(0) == a ? ip->offset : 1;
+		NEXT;
+	CASE(OP_DO)
+		if (!INTEGERS()) {
+			goto err_integers;
+		}
+		RRESERVE(2);
+		stack_push(rstack, values[len - 2]);
+		stack_push(rstack, tos);
+		len -= 2;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_LOOP)
+		frame = &rstack->values[rstack->len - 2];
+		/* 添字は int と同じく回り込む */
+		a = cell_from_integer((int) ((unsigned int) cell_integer(frame[1])
+									 + 1));
+		if (a != frame[0]) {
+			rstack->values[rstack->len - 1] = a;
+			ip += ip->offset;
+		} else {
+			rstack->len -= 2;
+			ip += 1;
+		}
+		NEXT;
+	CASE(OP_I)
+		a = rstack->values[rstack->len - 1];
+		PUSH(a);
+		NEXT;
+	CASE(OP_J)
+		a = rstack->values[rstack->len - 3];
+		PUSH(a);
+		NEXT;
+	CASE(OP_TAIL)
+		ip = ip->definition->threaded;
+		NEXT;
+	/*
+	 * スーパー命令。上の値が整数であることを一度に確かめ、そうでなけれ
+	 * ば vm_unfused でまとめる前と同じエラーを起こす。
+	 */
+	CASE(OP_LIT_PLUS)
+		if (len < 1 || !cell_is_integer(tos)) {
+			SPILL();
+			error = vm_unfused(stack, OP_LIT, ip);
+			goto err;
+		}
+		tos = cell_from_integer(cell_integer(tos)
+								+ cell_integer((ip++)->cell));
+		NEXT;
+	CASE(OP_LIT_MINUS)
+		if (len < 1 || !cell_is_integer(tos)) {
+			SPILL();
+			error = vm_unfused(stack, OP_LIT, ip);
+			goto err;
+		}
+		tos = cell_from_integer(cell_integer(tos)
+								- cell_integer((ip++)->cell));
+		NEXT;
+	CASE(OP_LIT_STAR)
+		if (len < 1 || !cell_is_integer(tos)) {
+			SPILL();
+			error = vm_unfused(stack, OP_LIT, ip);
+			goto err;
+		}
+		tos = cell_from_integer(cell_integer(tos)
+								* cell_integer((ip++)->cell));
+		NEXT;
+	CASE(OP_LIT_SLASH)
+		if (len < 1 || !cell_is_integer(tos)) {
+			SPILL();
+			error = vm_unfused(stack, OP_LIT, ip);
+			goto err;
+		}
+		tos = cell_from_integer(integer_divide(
+			cell_integer(tos), cell_integer((ip++)->cell)));
+		NEXT;
+	CASE(OP_DUP_PLUS)
+		if (len < 1 || !cell_is_integer(tos)) {
+			SPILL();
+			error = vm_unfused(stack, OP_DUP, ip);
+			goto err;
+		}
+		tos = cell_from_integer(cell_integer(tos) + cell_integer(tos));
+		NEXT;
+	CASE(OP_DUP_STAR)
+		if (len < 1 || !cell_is_integer(tos)) {
+			SPILL();
+			error = vm_unfused(stack, OP_DUP, ip);
+			goto err;
+		}
+		tos = cell_from_integer(cell_integer(tos) * cell_integer(tos));
+		NEXT;
+	CASE(OP_OVER_PLUS)
+		if (!INTEGERS()) {
+			SPILL();
+			error = vm_unfused(stack, OP_OVER, ip);
+			goto err;
+		}
+		tos = cell_from_integer(cell_integer(tos)
+								+ cell_integer(values[len - 2]));
+		NEXT;
+	CASE(OP_OVER_MINUS)
+		if (!INTEGERS()) {
+			SPILL();
+			error = vm_unfused(stack, OP_OVER, ip);
+			goto err;
+		}
+		tos = cell_from_integer(cell_integer(tos)
+								- cell_integer(values[len - 2]));
+		NEXT;
+	CASE(OP_SWAP_MINUS)
+		if (!INTEGERS()) {
+			SPILL();
+			error = vm_unfused(stack, OP_SWAP, ip);
+			goto err;
+		}
+		len -= 1;
+		tos = cell_from_integer(cell_integer(tos)
+								- cell_integer(values[len - 1]));
+		NEXT;
+	CASE(OP_NIP)
+		if (len < 2) {
+			goto err_depth;
+		}
+		len -= 1;
+		NEXT;
+	/*
+	 * 計測中の呼び出し。リターン・スタックに戻り番地に加えて呼び出した
+	 * 定義と時刻を積み、戻るときに経過時間を定義に加える。
+	 */
+	CASE(OP_PROFILE_ENTER)
+		RRESERVE(3);
+		definition = ip->definition;
+		definition->profile.calls += 1;
+		stack_push(rstack, (Cell) (ip + 1));
+		stack_push(rstack, (Cell) definition);
+		stack_push(rstack, (Cell) profile_clock());
+		ip = definition->threaded;
+		NEXT;
+	CASE(OP_PROFILE_EXIT)
+		if (rstack->len == rbase) {
+			SPILL();
+			return NULL;
+		}
+		stack_pop(rstack, &a);
+		rstack->len -= 1;
+		definition = (Definition *) rstack->values[rstack->len];
+		definition->profile.cycles += profile_clock() - (uint64_t) a;
+		stack_pop(rstack, &a);
+		ip = (Inst const *) a;
+		NEXT;
+	/*
+	 * 第 0 層の定義の先頭。十分に呼び出されたら最適化し、この呼び出しか
+	 * ら最適化したコードを実行する。
+	 */
+	CASE(OP_TIER_UP)
+		definition = (ip++)->definition;
+		if (NULL != context->parent) {  // タスクは共有している定義を数えない
+			NEXT;
+		}
+		definition->hotness += 1;
+		if (context->tier_threshold <= definition->hotness) {
+			vm_promote(context, definition);
+			if (!definition_is_cold(definition)) {
+				ip = definition->threaded;
+			}
+		}
+		NEXT;
+	/*
+	 * スタック効果を推論できた定義の先頭。前提を満たさなければ、検査す
+	 * る版のコードで実行してエラーを起こす場所と状態を合わせる。
+	 */
+	CASE(OP_CHECK)
+		definition = (ip++)->definition;
+		if (!vm_check_effect(stack, len, tos, &definition->effect)) {
+			ip = definition->checked + 2;
+		}
+		values = stack->values;
+		limit = 0 != stack->guard ? SIZE_MAX : stack->memlen;
+		NEXT;
+	/* CATCH した語がエラーを起こさずに戻った */
+	CASE(OP_UNCATCH)
+		rstack->len -= 3;
+		frame = &rstack->values[rstack->len];
+		context->handler = (size_t) frame[2];
+		ip = (Inst const *) frame[0];
+		PUSH(cell_from_integer(0));
+		NEXT;
+	/* 翻訳された機械語がリターン・スタックに戻り番地を積めなかった */
+	CASE(OP_OVERFLOW)
+		goto err_overflow;
+	/*
+	 * 検査を省いた命令。OP_CHECK により、スタックの深さと型、積む余地
+	 * があることがわかっている。
+	 */
+	CASE(OP_LIT_UNCHECKED)
+		values[len - 1] = tos;
+		tos = (ip++)->cell;
+		len += 1;
+		NEXT;
+	CASE(OP_ENTER_UNCHECKED)
+		RRESERVE(1);
+		stack_push(rstack, (Cell) (ip + 1));
+		ip = ip->definition->threaded + 2;
+		NEXT;
+	CASE(OP_TAIL_UNCHECKED)
+		ip = ip->definition->threaded + 2;
+		NEXT;
+	CASE(OP_PLUS_UNCHECKED)
+		len -= 1;
+		tos = cell_from_integer(cell_integer(values[len - 1])
+								+ cell_integer(tos));
+		NEXT;
+	CASE(OP_MINUS_UNCHECKED)
+		len -= 1;
+		tos = cell_from_integer(cell_integer(values[len - 1])
+								- cell_integer(tos));
+		NEXT;
+	CASE(OP_STAR_UNCHECKED)
+		len -= 1;
+		tos = cell_from_integer(cell_integer(values[len - 1])
+								* cell_integer(tos));
+		NEXT;
+	CASE(OP_SLASH_UNCHECKED)
+		if (0 == cell_integer(tos)) {
+			SPILL();
+			error = error_new(DividedByZeroError, NULL);
+			goto err;
+		}
+		len -= 1;
+		tos = cell_from_integer(integer_divide(
+			cell_integer(values[len - 1]), cell_integer(tos)));
+		NEXT;
+	CASE(OP_DUP_UNCHECKED)
+		values[len - 1] = tos;
+		len += 1;
+		NEXT;
+	CASE(OP_DROP_UNCHECKED)
+		len -= 1;
+		tos = values[len - 1];
+		NEXT;
+	CASE(OP_SWAP_UNCHECKED)
+		a = values[len - 2];
+		values[len - 2] = tos;
+		tos = a;
+		NEXT;
+	CASE(OP_OVER_UNCHECKED)
+		values[len - 1] = tos;
+		tos = values[len - 2];
+		len += 1;
+		NEXT;
+	CASE(OP_LIT_PLUS_UNCHECKED)
+		tos = cell_from_integer(cell_integer(tos)
+								+ cell_integer((ip++)->cell));
+		NEXT;
+	CASE(OP_LIT_MINUS_UNCHECKED)
+		tos = cell_from_integer(cell_integer(tos)
+								- cell_integer((ip++)->cell));
+		NEXT;
+	CASE(OP_LIT_STAR_UNCHECKED)
+		tos = cell_from_integer(cell_integer(tos)
+								* cell_integer((ip++)->cell));
+		NEXT;
+	CASE(OP_LIT_SLASH_UNCHECKED)
+		tos = cell_from_integer(integer_divide(
+			cell_integer(tos), cell_integer((ip++)->cell)));
+		NEXT;
+	CASE(OP_DUP_PLUS_UNCHECKED)
+		tos = cell_from_integer(cell_integer(tos) + cell_integer(tos));
+		NEXT;
+	CASE(OP_DUP_STAR_UNCHECKED)
+		tos = cell_from_integer(cell_integer(tos) * cell_integer(tos));
+		NEXT;
+	CASE(OP_OVER_PLUS_UNCHECKED)
+		tos = cell_from_integer(cell_integer(tos)
+								+ cell_integer(values[len - 2]));
+		NEXT;
+	CASE(OP_OVER_MINUS_UNCHECKED)
+		tos = cell_from_integer(cell_integer(tos)
+								- cell_integer(values[len - 2]));
+		NEXT;
+	CASE(OP_SWAP_MINUS_UNCHECKED)
+		len -= 1;
+		tos = cell_from_integer(cell_integer(tos)
+								- cell_integer(values[len - 1]));
+		NEXT;
+	CASE(OP_NIP_UNCHECKED)
+		len -= 1;
+		NEXT;
+	END_DISPATCH
+err_integers:
+	SPILL();
+	error = vm_check_integers(stack, FALSE);
+	goto err;
+err_depth:
+	SPILL();
+	error = error_new(EmptyStackError, NULL);
+	goto err;
+err_type:
+	SPILL();
+	error = error_new(IllegalTypeError, NULL);
+	goto err;
+err_address:
+	SPILL();
+	error = error_new(IllegalAddressError, NULL);
+	goto err;
+err_overflow:
+	SPILL();
+	error = error_new(StackOverflowError, NULL);
+err:
+	if (NO_HANDLER == context->handler || context->handler < rbase) {
+		rstack->len = rbase;
+		return error;
+	}
+	code = error->code;
+	error_free(error);
+	goto unwind;
+raise:
+	if (NO_HANDLER == context->handler || context->handler < rbase) {
+		rstack->len = rbase;
+		return error_new_code(code);
+	}
+unwind:
+	/*
+	 * 一番内側の例外フレームまでリターン・スタックを巻き戻し、スタック
+	 * の深さを CATCH したときに戻して例外番号を積む
+	 */
+	frame = &rstack->values[context->handler];
+	rstack->len = context->handler;
+	context->handler = (size_t) frame[2];
+	stack->len = (size_t) frame[1];
+	ip = (Inst const *) frame[0];
+	RELOAD();
+	PUSH(cell_from_integer(code));
+	goto dispatch;
+}